@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "gridfile.h"
+#include "frozengrid.h"
+#include "datagenerator.h"
+
+#define SIZE 64
+#define PSIZE 4096
+#define NAME "dbwritable"
+#define FROZEN "dbfrozen"
+#define NRECORDS 1000000
+#define NQUERIES 10000
+#define QSIZE (INT_MAX / 100)
+
+/* Fetches monotonic time in seconds
+*/
+double getTime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Fetches size of file
+
+   Parameters:
+   name: Name of file
+
+   Return:
+   Size of file in bytes, zero if missing
+*/
+int64_t getFileSize(string name)
+{
+	struct stat st;
+
+	if (stat(name.c_str(), &st) < 0) {
+		return 0;
+	}
+
+	return st.st_size;
+}
+
+int main()
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t x = 0;
+	int64_t y = 0;
+	int64_t rsize = 0;
+	int64_t ds = 0;
+	int64_t fds = 0;
+	int64_t found = 0;
+	int64_t ffound = 0;
+	int64_t mismatches = 0;
+	void *record = NULL;
+	void *records = NULL;
+	void *frecords = NULL;
+	double start = 0;
+	vector < int64_t > xs;
+	vector < int64_t > ys;
+	struct gridconfig vconfig;
+	struct gridfile vgrid;
+	struct frozengrid fgrid;
+
+	vconfig.size = SIZE;
+	vconfig.psize = PSIZE;
+	vconfig.name = NAME;
+
+	error = vgrid.createGrid(&vconfig);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = vgrid.loadGrid();
+	if (error < 0) {
+		goto clean;
+	}
+
+	for (iter = 0; iter < NRECORDS; iter++) {
+		getRandomRecord(&x, &y, &rsize, &record);
+
+		error = vgrid.insertRecord(x, y, record, rsize);
+		free(record);
+		if (error < 0) {
+			goto pclean;
+		}
+
+		if (iter % (NRECORDS / NQUERIES) == 0) {
+			xs.push_back(x);
+			ys.push_back(y);
+		}
+	}
+
+	start = getTime();
+	error = vgrid.freezeGrid(FROZEN);
+	if (error < 0) {
+		goto pclean;
+	}
+	printf("Freeze: %.2f s\n", getTime() - start);
+
+	printf("Writable grid: %ld bytes, frozen grid: %ld bytes\n",
+	       getFileSize(string(NAME) + "scale") +
+	       getFileSize(string(NAME) + "directory") +
+	       getFileSize(string(NAME) + "buckets"), getFileSize(FROZEN));
+
+	start = getTime();
+	error = fgrid.loadGrid(FROZEN);
+	if (error < 0) {
+		goto pclean;
+	}
+	printf("Frozen load: %.6f s, %ld records\n", getTime() - start,
+	       fgrid.getRecordCount());
+
+	start = getTime();
+	for (iter = 0; iter < (int64_t) xs.size(); iter++) {
+		error = vgrid.findRecord(xs[iter], ys[iter], &record);
+		free(record);
+		if (error < 0) {
+			goto fclean;
+		}
+	}
+	printf("Writable lookup, %ld queries: %.4f s\n", xs.size(),
+	       getTime() - start);
+
+	start = getTime();
+	for (iter = 0; iter < (int64_t) xs.size(); iter++) {
+		error = fgrid.findRecord(xs[iter], ys[iter], &record);
+		free(record);
+		if (error < 0) {
+			goto fclean;
+		}
+	}
+	printf("Frozen lookup, %ld queries: %.4f s\n", xs.size(),
+	       getTime() - start);
+
+	srand(2);
+	start = getTime();
+	for (iter = 0; iter < NQUERIES; iter++) {
+		x = rand();
+		y = rand();
+		error =
+		    vgrid.findRangeRecords(x, y, x + QSIZE, y + QSIZE, &ds,
+					   &records);
+		if (error < 0) {
+			goto fclean;
+		}
+		found += ((int64_t *) records)[0];
+		free(records);
+	}
+	printf("Writable range, %d queries: %.4f s, %ld records\n", NQUERIES,
+	       getTime() - start, found);
+
+	srand(2);
+	start = getTime();
+	for (iter = 0; iter < NQUERIES; iter++) {
+		x = rand();
+		y = rand();
+		error =
+		    fgrid.findRangeRecords(x, y, x + QSIZE, y + QSIZE, &fds,
+					   &frecords);
+		if (error < 0) {
+			goto fclean;
+		}
+		ffound += ((int64_t *) frecords)[0];
+		free(frecords);
+	}
+	printf("Frozen range, %d queries: %.4f s, %ld records\n", NQUERIES,
+	       getTime() - start, ffound);
+
+	srand(3);
+	for (iter = 0; iter < NQUERIES / 10; iter++) {
+		x = rand();
+		y = rand();
+		error =
+		    vgrid.findRangeRecords(x, y, x + QSIZE, y + QSIZE, &ds,
+					   &records);
+		if (error < 0) {
+			goto fclean;
+		}
+
+		error =
+		    fgrid.findRangeRecords(x, y, x + QSIZE, y + QSIZE, &fds,
+					   &frecords);
+		if (error < 0) {
+			free(records);
+			goto fclean;
+		}
+
+		/* Buckets are visited in other order, so only totals compare */
+		if (ds != fds
+		    || ((int64_t *) records)[0] != ((int64_t *) frecords)[0]) {
+			mismatches += 1;
+		}
+
+		free(records);
+		free(frecords);
+	}
+	printf("Range mismatches: %ld\n", mismatches);
+
+ fclean:
+	fgrid.unloadGrid();
+
+ pclean:
+	vgrid.unloadGrid();
+
+ clean:
+	printf("Error: %d\n", error);
+	return error;
+}
@@ -0,0 +1,443 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "frozengrid.h"
+
+/* Unmaps frozen grid file, if mapped
+*/
+frozengrid::~frozengrid()
+{
+	unloadGrid();
+}
+
+/* Maps frozen grid file in one piece and locates its sections
+
+   Parameters:
+   path: Name of frozen grid file
+
+   Return:
+   Zero on success, error on failure
+*/
+int frozengrid::loadGrid(string path)
+{
+	int error = 0;
+	int fd = -1;
+	int64_t offset = sizeof(struct gridfrozen);
+	int64_t ncells = 0;
+	struct stat st;
+
+	unloadGrid();
+
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		error = -errno;
+		goto clean;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		error = -errno;
+		goto pclean;
+	}
+
+	if (st.st_size < offset) {
+		error = -EINVAL;
+		goto pclean;
+	}
+
+	frozenMap = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (frozenMap == MAP_FAILED) {
+		frozenMap = NULL;
+		error = -errno;
+		goto pclean;
+	}
+	frozenSize = st.st_size;
+
+	header = (struct gridfrozen *)frozenMap;
+	if (header->magic != FROZEN_MAGIC) {
+		error = -EINVAL;
+		goto pclean;
+	}
+
+	ncells = (header->xparts + 1) * (header->yparts + 1);
+	ncells += ncells % 2;
+
+	xparts = (int64_t *) (frozenMap + offset);
+	offset += header->xparts * 8;
+	yparts = (int64_t *) (frozenMap + offset);
+	offset += header->yparts * 8;
+	cells = (uint32_t *) (frozenMap + offset);
+	offset += ncells * 4;
+	buckets = (int64_t *) (frozenMap + offset);
+	offset += header->buckets * FROZEN_BUCKET * 8;
+	entries = frozenMap + offset;
+	offset += header->dataSize;
+
+	if (offset != frozenSize) {
+		error = -EINVAL;
+		goto pclean;
+	}
+
+	headerSize = 2 * header->coordinateSize + (header->recordSize ? 0 : 8);
+
+ pclean:
+	close(fd);
+
+	if (error < 0) {
+		unloadGrid();
+	}
+
+ clean:
+	return error;
+}
+
+/* Unmaps frozen grid file
+*/
+void frozengrid::unloadGrid()
+{
+	if (frozenMap != NULL) {
+		munmap(frozenMap, frozenSize);
+	}
+
+	frozenMap = NULL;
+	frozenSize = 0;
+	header = NULL;
+}
+
+/* Fetches grid longitude and latitude for given coordinates from scale
+
+   Parameters:
+   lon: Grid longitude for given coordinates is stored
+   lat: Grid latitude for given coordinates is stored
+   x: Coordinate (x) of record
+   y: Coordinate (y) of record
+*/
+void frozengrid::getGridLocation(int64_t * lon, int64_t * lat, int64_t x,
+				 int64_t y)
+{
+	*lon = lower_bound(xparts, xparts + header->xparts, x) - xparts;
+	*lat = lower_bound(yparts, yparts + header->yparts, y) - yparts;
+}
+
+/* Fetches bucket of grid entry
+
+   Parameters:
+   lon: Grid longitude of entry
+   lat: Grid latitude of entry
+
+   Return:
+   Offset, number of records and region of bucket
+*/
+int64_t *frozengrid::getGridBucket(int64_t lon, int64_t lat)
+{
+	uint32_t bucket = cells[lon * (header->yparts + 1) + lat];
+
+	return buckets + bucket * FROZEN_BUCKET;
+}
+
+/* Computes number of bytes of packed entries of bucket
+
+   Parameters:
+   bucket: Bucket
+
+   Return:
+   Number of bytes of entries of bucket
+*/
+int64_t frozengrid::getBucketBytes(int64_t * bucket)
+{
+	if (bucket + FROZEN_BUCKET == buckets + header->buckets * FROZEN_BUCKET) {
+		return header->dataSize - bucket[0];
+	}
+
+	return bucket[FROZEN_BUCKET] - bucket[0];
+}
+
+/* Fetches coordinates of bucket entry
+
+   Parameters:
+   x: Coordinate (x) is stored
+   y: Coordinate (y) is stored
+   bentry: Bucket entry
+*/
+void frozengrid::getEntryCoordinates(int64_t * x, int64_t * y, char *bentry)
+{
+	if (header->coordinateSize == 4) {
+		*x = ((int32_t *) bentry)[0];
+		*y = ((int32_t *) bentry)[1];
+	} else {
+		*x = ((int64_t *) bentry)[0];
+		*y = ((int64_t *) bentry)[1];
+	}
+}
+
+/* Fetches size of record data of bucket entry
+
+   Parameters:
+   bentry: Bucket entry
+
+   Return:
+   Fixed record size if configured, stored record size otherwise
+*/
+int64_t frozengrid::getEntrySize(char *bentry)
+{
+	if (header->recordSize) {
+		return header->recordSize;
+	}
+
+	return *(int64_t *) (bentry + 2 * header->coordinateSize);
+}
+
+/* Collects distinct buckets intersecting region of grid entries, bucket
+   being taken at its lowest grid entry within region
+
+   Parameters:
+   rbuckets: Each bucket is appended
+   lon1: Lowest grid longitude of region
+   lat1: Lowest grid latitude of region
+   lon2: Highest grid longitude of region
+   lat2: Highest grid latitude of region
+*/
+void frozengrid::getRangeBuckets(vector < int64_t * >&rbuckets, int64_t lon1,
+				 int64_t lat1, int64_t lon2, int64_t lat2)
+{
+	int64_t xiter = 0;
+	int64_t yiter = 0;
+	int64_t *bucket = NULL;
+
+	for (xiter = lon1; xiter <= lon2; xiter++) {
+		for (yiter = lat1; yiter <= lat2; yiter++) {
+			bucket = getGridBucket(xiter, yiter);
+			if (max(bucket[2], lon1) == xiter
+			    && max(bucket[3], lat1) == yiter) {
+				rbuckets.push_back(bucket);
+			}
+		}
+	}
+}
+
+/* Retrieves record for given coordinates
+
+   Parameters:
+   x: Coordinate (x) of record to be retrieved
+   y: Coordinate (y) of record to be retrieved
+   record: Buffer holding retrieved record is stored, NULL on failure
+
+   Return:
+   Zero on success, error on failure
+*/
+int frozengrid::findRecord(int64_t x, int64_t y, void **record)
+{
+	int error = -EINVAL;
+	int64_t lon = 0;
+	int64_t lat = 0;
+	int64_t iter = 0;
+	int64_t bx = 0;
+	int64_t by = 0;
+	int64_t rsize = 0;
+	int64_t *bucket = NULL;
+	char *be = NULL;
+
+	*record = NULL;
+
+	if (header == NULL) {
+		goto clean;
+	}
+
+	getGridLocation(&lon, &lat, x, y);
+	bucket = getGridBucket(lon, lat);
+	be = entries + bucket[0];
+
+	for (iter = 0; iter < bucket[1]; iter++) {
+		getEntryCoordinates(&bx, &by, be);
+		rsize = getEntrySize(be);
+
+		if (bx == x && by == y) {
+			error = 0;
+			break;
+		}
+
+		be += headerSize + rsize;
+	}
+
+	if (error < 0) {
+		goto clean;
+	}
+
+	*record = malloc(rsize);
+	if (*record == NULL) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	memcpy(*record, be + headerSize, rsize);
+
+ clean:
+	return error;
+}
+
+/* Retrieves records within specified coordinate range, laid out as
+   gridfile returns them: number of records followed by x, y, record size
+   and record of each
+
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   dsize: Number of bytes written in buffer after number of records is
+   stored
+   records: Buffer to hold retrieved records
+
+   Return:
+   Zero on success, error on failure
+*/
+int frozengrid::findRangeRecords(int64_t x1, int64_t y1, int64_t x2,
+				 int64_t y2, int64_t * dsize, void **records)
+{
+	int error = 0;
+	int64_t lon1 = 0;
+	int64_t lat1 = 0;
+	int64_t lon2 = 0;
+	int64_t lat2 = 0;
+	int64_t iter = 0;
+	int64_t eiter = 0;
+	int64_t bx = 0;
+	int64_t by = 0;
+	int64_t rsize = 0;
+	int64_t bound = 0;
+	int64_t nr = 0;
+	int64_t *bucket = NULL;
+	int64_t *dentry = NULL;
+	char *be = NULL;
+	char *rrecords = NULL;
+	vector < int64_t * >rbuckets;
+
+	*dsize = 0;
+
+	if (header == NULL) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	getGridLocation(&lon1, &lat1, x1, y1);
+	getGridLocation(&lon2, &lat2, x2, y2);
+	getRangeBuckets(rbuckets, lon1, lat1, lon2, lat2);
+
+	for (iter = 0; iter < (int64_t) rbuckets.size(); iter++) {
+		bucket = rbuckets[iter];
+		bound += getBucketBytes(bucket) + bucket[1] * (24 - headerSize);
+	}
+
+	*records = malloc(8 + bound);
+	if (*records == NULL) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	rrecords = (char *)*records + 8;
+
+	for (iter = 0; iter < (int64_t) rbuckets.size(); iter++) {
+		bucket = rbuckets[iter];
+		be = entries + bucket[0];
+
+		for (eiter = 0; eiter < bucket[1]; eiter++) {
+			getEntryCoordinates(&bx, &by, be);
+			rsize = getEntrySize(be);
+
+			if (bx >= x1 && bx <= x2 && by >= y1 && by <= y2) {
+				dentry = (int64_t *) rrecords;
+				dentry[0] = bx;
+				dentry[1] = by;
+				dentry[2] = rsize;
+				memcpy(dentry + 3, be + headerSize, rsize);
+				rrecords += 24 + rsize;
+				*dsize += 24 + rsize;
+				nr += 1;
+			}
+
+			be += headerSize + rsize;
+		}
+	}
+
+	((int64_t *) * records)[0] = nr;
+
+ clean:
+	return error;
+}
+
+/* Counts records within specified coordinate range, buckets lying inside
+   range being counted without reading their entries
+
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   count: Number of records within range is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int frozengrid::countInRange(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			     int64_t * count)
+{
+	int error = 0;
+	int64_t lon1 = 0;
+	int64_t lat1 = 0;
+	int64_t lon2 = 0;
+	int64_t lat2 = 0;
+	int64_t iter = 0;
+	int64_t eiter = 0;
+	int64_t bx = 0;
+	int64_t by = 0;
+	int64_t *bucket = NULL;
+	char *be = NULL;
+	vector < int64_t * >rbuckets;
+
+	*count = 0;
+
+	if (header == NULL) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	getGridLocation(&lon1, &lat1, x1, y1);
+	getGridLocation(&lon2, &lat2, x2, y2);
+	getRangeBuckets(rbuckets, lon1, lat1, lon2, lat2);
+
+	for (iter = 0; iter < (int64_t) rbuckets.size(); iter++) {
+		bucket = rbuckets[iter];
+
+		/* Grid entries strictly inside region lie inside range */
+		if (bucket[2] > lon1 && bucket[3] > lat1 && bucket[4] < lon2
+		    && bucket[5] < lat2) {
+			*count += bucket[1];
+			continue;
+		}
+
+		be = entries + bucket[0];
+		for (eiter = 0; eiter < bucket[1]; eiter++) {
+			getEntryCoordinates(&bx, &by, be);
+
+			if (bx >= x1 && bx <= x2 && by >= y1 && by <= y2) {
+				*count += 1;
+			}
+
+			be += headerSize + getEntrySize(be);
+		}
+	}
+
+ clean:
+	return error;
+}
+
+/* Fetches number of records of frozen grid
+
+   Return:
+   Number of records, zero if no grid is loaded
+*/
+int64_t frozengrid::getRecordCount()
+{
+	return header ? header->records : 0;
+}
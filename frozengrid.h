@@ -0,0 +1,46 @@
+#ifndef FROZENGRID_HPP
+#define FROZENGRID_HPP
+
+#include <vector>
+#include "gridfile.h"
+
+using namespace std;
+
+/* Read-only grid served from frozen grid file written by freezeGrid. File
+   is mapped at once and never changes, so lookups and range queries need
+   no locks and return records laid out as gridfile returns them
+*/
+struct frozengrid {
+ private:
+	char *frozenMap = NULL;
+	int64_t frozenSize = 0;
+	struct gridfrozen *header = NULL;
+	int64_t *xparts = NULL;
+	int64_t *yparts = NULL;
+	uint32_t *cells = NULL;
+	int64_t *buckets = NULL;
+	char *entries = NULL;
+	int64_t headerSize = 0;
+
+	void getGridLocation(int64_t * lon, int64_t * lat, int64_t x,
+			     int64_t y);
+	int64_t *getGridBucket(int64_t lon, int64_t lat);
+	int64_t getBucketBytes(int64_t * bucket);
+	void getEntryCoordinates(int64_t * x, int64_t * y, char *bentry);
+	int64_t getEntrySize(char *bentry);
+	void getRangeBuckets(vector < int64_t * >&rbuckets, int64_t lon1,
+			     int64_t lat1, int64_t lon2, int64_t lat2);
+
+ public:
+	~frozengrid();
+	int loadGrid(string path);
+	void unloadGrid();
+	int findRecord(int64_t x, int64_t y, void **record);
+	int findRangeRecords(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			     int64_t * dsize, void **records);
+	int countInRange(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			 int64_t * count);
+	int64_t getRecordCount();
+};
+
+#endif
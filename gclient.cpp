@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <algorithm>
+#include "gridserver.h"
+#include "datagenerator.h"
+
+#define SOCKET "gridsocket"
+#define NRECORDS 200000
+#define NQUERIES 20000
+#define BATCH 64
+#define DEPTH 8
+#define QSIZE (INT_MAX / 1000)
+
+/* Fetches monotonic time in seconds
+*/
+double getTime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Sends requests in batches, keeping up to DEPTH batches in flight, and
+   reports throughput as well as latency of batches from sending to last
+   reply
+
+   Parameters:
+   client: Connected client
+   title: Title of report
+   messages: Requests to send
+   records: Records of requests
+
+   Return:
+   Zero on success, error on failure
+*/
+int runRequests(struct gridclient *client, const char *title,
+		vector < struct gridmessage >&messages,
+		vector < void *>&records)
+{
+	int error = 0;
+	int64_t nmessages = messages.size();
+	int64_t nbatches = (nmessages + BATCH - 1) / BATCH;
+	int64_t sent = 0;
+	int64_t received = 0;
+	int64_t done = 0;
+	int64_t failed = 0;
+	int64_t nentries = 0;
+	int64_t bsize = 0;
+	double start = 0;
+	double elapsed = 0;
+	void *payload = NULL;
+	struct gridreply reply;
+	vector < double >starts(nbatches);
+	vector < double >latencies;
+
+	start = getTime();
+
+	while (received < nbatches) {
+		if (sent < nbatches && sent - received < DEPTH) {
+			bsize = min((int64_t) BATCH, nmessages - sent * BATCH);
+			starts[sent] = getTime();
+			error =
+			    client->sendBatch(&messages[sent * BATCH],
+					      &records[sent * BATCH], bsize);
+			if (error < 0) {
+				goto clean;
+			}
+			sent++;
+			continue;
+		}
+
+		error = client->receiveReply(&reply, &payload);
+		free(payload);
+		if (error < 0) {
+			goto clean;
+		}
+
+		nentries += reply.count;
+		if (reply.more) {
+			continue;
+		}
+		if (reply.status < 0) {
+			failed++;
+		}
+
+		done++;
+		if (done % BATCH == 0 || done == nmessages) {
+			latencies.push_back(getTime() - starts[received]);
+			received++;
+		}
+	}
+
+	elapsed = getTime() - start;
+	sort(latencies.begin(), latencies.end());
+
+	printf("%s: %ld requests, %.0f requests/s, %ld failed, %ld entries\n",
+	       title, nmessages, nmessages / elapsed, failed, nentries);
+	printf("%s: batch latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+	       title, latencies[nbatches / 2] * 1e6,
+	       latencies[nbatches * 99 / 100] * 1e6,
+	       latencies[nbatches - 1] * 1e6);
+
+ clean:
+	return error;
+}
+
+/* Generates load on server listening on Unix domain socket given as first
+   argument or, when given as second argument, on TCP port of localhost:
+   inserts, finds of inserted records, ranges and deletes
+*/
+int main(int argc, char **argv)
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t x = 0;
+	int64_t y = 0;
+	int64_t rsize = 0;
+	void *record = NULL;
+	string path = SOCKET;
+	struct gridclient vclient;
+	struct gridmessage message;
+	vector < struct gridmessage >inserts;
+	vector < struct gridmessage >messages;
+	vector < void *>records;
+	vector < void *>empty;
+
+	if (argc > 1) {
+		path = argv[1];
+	}
+
+	if (argc > 2) {
+		error = vclient.connectTcp(atol(argv[2]));
+	} else {
+		error = vclient.connectUnix(path);
+	}
+	if (error < 0) {
+		goto clean;
+	}
+
+	memset(&message, 0, sizeof(message));
+
+	for (iter = 0; iter < NRECORDS; iter++) {
+		getRandomRecord(&x, &y, &rsize, &record);
+		message.type = MESSAGE_INSERT;
+		message.tag = iter;
+		message.x1 = x;
+		message.y1 = y;
+		message.size = rsize;
+		inserts.push_back(message);
+		records.push_back(record);
+	}
+
+	error = runRequests(&vclient, "Insert", inserts, records);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	empty.assign(NQUERIES, NULL);
+
+	for (iter = 0; iter < NQUERIES; iter++) {
+		message = inserts[rand() % NRECORDS];
+		message.type = MESSAGE_FIND;
+		message.tag = iter;
+		message.size = 0;
+		messages.push_back(message);
+	}
+
+	error = runRequests(&vclient, "Find", messages, empty);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	messages.clear();
+	for (iter = 0; iter < NQUERIES; iter++) {
+		message.type = MESSAGE_RANGE;
+		message.tag = iter;
+		message.x1 = rand();
+		message.y1 = rand();
+		message.x2 = message.x1 + QSIZE;
+		message.y2 = message.y1 + QSIZE;
+		message.size = 0;
+		messages.push_back(message);
+	}
+
+	error = runRequests(&vclient, "Range", messages, empty);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	messages.clear();
+	for (iter = 0; iter < NQUERIES; iter++) {
+		message = inserts[iter];
+		message.type = MESSAGE_DELETE;
+		message.size = 0;
+		messages.push_back(message);
+	}
+
+	error = runRequests(&vclient, "Delete", messages, empty);
+
+ pclean:
+	for (iter = 0; iter < (int64_t) records.size(); iter++) {
+		free(records[iter]);
+	}
+	vclient.disconnect();
+
+ clean:
+	printf("Error: %d\n", error);
+	return error;
+}
@@ -1,8 +1,55 @@
 #include <errno.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <time.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <math.h>
+#include <algorithm>
+#include <queue>
+#include <vector>
 #include "gridfile.h"
 
+#define MAXSPLITS 64
+
+/* Grid entry holds bytes, records, sum of x, sum of y, bucket address,
+   region (lowest longitude, latitude, highest longitude, latitude) of grid
+   entries sharing bucket and order of bucket extent, bucket spanning two to
+   the power of order contiguous pages */
+#define GENTRY 10
+
+/* Placement of bucket region relative to query shape */
+#define REGION_OUTSIDE 0
+#define REGION_INSIDE 1
+#define REGION_BOUNDARY 2
+
+/* Requests served by executor thread */
+#define REQUEST_FIND 0
+#define REQUEST_RANGE 1
+#define REQUEST_INSERT 2
+
+/* Buckets read ahead of bucket being processed, requests taken at once by
+   executor thread */
+#define PREFETCH 16
+#define MAXBATCH 64
+
+/* Orders grid entries by address of their buckets
+
+   Parameters:
+   gentry1: First grid entry
+   gentry2: Second grid entry
+
+   Return:
+   True if bucket of first entry lies before bucket of second entry
+*/
+static bool isBucketBefore(int64_t * gentry1, int64_t * gentry2)
+{
+	return gentry1[4] < gentry2[4];
+}
+
 /* Creates a file of given size and with given access mode
 
    Parameters:
@@ -44,36 +91,113 @@ int gridfile::createFile(int64_t size, string fname, const char *mode)
 	return error;
 }
 
-/* Creates grid files and initializes grid parameters
+/* Initializes grid parameters from configuration
 
    Parameters:
-   configuration: Enlists grid size, page size and grid name
+   configuration: Enlists grid size, page size, grid name, record size,
+   coordinate size, split policy, random read cost and highest number of
+   pages of bucket
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::createGrid(struct gridconfig *configuration)
+int gridfile::setGridConfig(struct gridconfig *configuration)
 {
 	int error = 0;
-	int sfd = -1;
-	int dfd = -1;
-	int64_t *saddr = NULL;
-	int64_t *daddr = NULL;
 	int64_t size = configuration->size;
 	int64_t psize = configuration->psize;
+	int64_t fsize = configuration->fsize;
+	int64_t csize = configuration->csize;
 	string name = configuration->name;
 
+	if (csize != 4 && csize != 8) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	if (fsize < 0 || 16 + 2 * csize + 8 + fsize > psize) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	if (configuration->quantile < 0 || configuration->quantile > 1) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	if (configuration->pages < 1
+	    || (configuration->pages & (configuration->pages - 1))) {
+		error = -EINVAL;
+		goto clean;
+	}
+
 	gridSize = size;
 	pageSize = psize;
+	recordSize = fsize;
+	coordinateSize = csize;
+	headerSize = 2 * coordinateSize + (recordSize ? 0 : 8);
+	splitPolicy = configuration->split;
+	splitQuantile = configuration->quantile;
+	randomCost = configuration->rcost;
+	bucketPages = configuration->pages;
+	gridSplits = 0;
+	bucketSplits = 0;
+	bucketMerges = 0;
+	bucketGrowths = 0;
 	scaleSize = (2 * gridSize + 1) * 8;
-	directorySize = (gridSize * gridSize) * 5 * 8 + 8;
+	directorySize = (gridSize * gridSize) * GENTRY * 8 + 8;
 	bucketSize = (gridSize * gridSize) * pageSize;
 	gridName = name;
 	scaleName = name + "scale";
 	directoryName = name + "directory";
 	bucketName = name + "buckets";
+	sharedName = name + "shared";
+	metaName = name + "meta";
 	gridScale = NULL;
 	gridDirectory = NULL;
+	gridShared = NULL;
+	sharedSlot = -1;
+	accessDepth = 0;
+	logFd = -1;
+	logLsn = 0;
+	pinnedViews = 0;
+	memBytes = 0;
+	memLimit = 0;
+	memStop = false;
+
+ clean:
+	return error;
+}
+
+/* Creates grid files and initializes grid parameters
+
+   Parameters:
+   configuration: Enlists grid size, page size, grid name, record size,
+   coordinate size, split policy, random read cost and highest number of
+   pages of bucket
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::createGrid(struct gridconfig *configuration)
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+	int error = 0;
+	int sfd = -1;
+	int dfd = -1;
+	int64_t *saddr = NULL;
+	int64_t *daddr = NULL;
+	int64_t size = configuration->size;
+
+	error = setGridConfig(configuration);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = createGridShared();
+	if (error < 0) {
+		goto clean;
+	}
 
 	error = createFile(scaleSize, scaleName, "w");
 	if (error < 0) {
@@ -128,1316 +252,6627 @@ int gridfile::createGrid(struct gridconfig *configuration)
 		goto clean;
 	}
 
+	error = writeGridMeta();
+
  clean:
 	return error;
 }
 
-/* Maps grid scale file into memory
+/* Initializes grid parameters for grid created by another process, sizes
+   of grid files being taken from coordination segment once grid is loaded
+
+   Parameters:
+   configuration: Configuration grid was created with
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::mapGridScale()
+int gridfile::attachGrid(struct gridconfig *configuration)
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+
+	return setGridConfig(configuration);
+}
+
+/* Opens existing grid by name, taking configuration and split counts from
+   its metadata file and mapping its files as they are, so that no file is
+   created or truncated. Coordination segment is recreated, from sizes of
+   grid files, only if it is missing, growth of grid left unfinished being
+   completed first.
+
+   Parameters:
+   name: Name grid was created with
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::openGrid(string name)
 {
+	lock_guard < recursive_mutex > guard(gridLock);
 	int error = 0;
-	int sfd = -1;
+	struct gridconfig configuration;
+	struct gridmeta meta;
+	struct stat st;
+	int64_t size = 0;
+
+	/* Without coordination segment no other process is growing grid */
+	if (stat((name + "shared").c_str(), &st) == -1) {
+		error = recoverGrowth(name, &size);
+		if (error < 0) {
+			goto clean;
+		}
+	}
 
-	sfd = open(scaleName.c_str(), O_RDWR);
-	if (sfd == -1) {
-		error = -errno;
+	error = readGridMeta(name, &configuration, &meta);
+	if (error < 0) {
 		goto clean;
 	}
 
-	gridScale =
-	    (int64_t *) mmap(NULL, scaleSize, PROT_READ | PROT_WRITE,
-			     MAP_SHARED, sfd, 0);
-	if (*gridScale == -1) {
-		error = -errno;
+	error = setGridConfig(&configuration);
+	if (error < 0) {
+		goto clean;
 	}
 
-	close(sfd);
+	gridSplits = meta.gridSplits;
+	bucketSplits = meta.bucketSplits;
+	bucketMerges = meta.bucketMerges;
+	bucketGrowths = meta.bucketGrowths;
+
+	if (stat(sharedName.c_str(), &st) == -1) {
+		if (stat(bucketName.c_str(), &st) == -1) {
+			error = -errno;
+			goto clean;
+		}
+
+		bucketSize = st.st_size;
+
+		error = createGridShared();
+		if (error < 0) {
+			goto clean;
+		}
+	}
+
+	error = loadGrid();
 
  clean:
 	return error;
 }
 
-/* Unmaps grid scale file from memory
+/* Writes metadata file of grid, replacing previous one at once
+
+   Return:
+   Zero on success, error on failure
 */
-void gridfile::unmapGridScale()
+int gridfile::writeGridMeta()
 {
-	munmap(gridScale, scaleSize);
-	gridScale = NULL;
+	int error = 0;
+	FILE *f = NULL;
+	string tname = metaName + "tmp";
+	struct gridmeta meta;
+
+	memset(&meta, 0, sizeof(meta));
+	meta.magic = META_MAGIC;
+	meta.version = META_VERSION;
+	meta.pageSize = pageSize;
+	meta.recordSize = recordSize;
+	meta.coordinateSize = coordinateSize;
+	meta.splitPolicy = splitPolicy;
+	meta.splitQuantile = splitQuantile;
+	meta.randomCost = randomCost;
+	meta.gridSplits = gridSplits;
+	meta.bucketSplits = bucketSplits;
+	meta.bucketMerges = bucketMerges;
+	meta.bucketPages = bucketPages;
+	meta.bucketGrowths = bucketGrowths;
+
+	f = fopen(tname.c_str(), "w");
+	if (f == NULL) {
+		error = -errno;
+		goto clean;
+	}
+
+	if (fwrite(&meta, sizeof(meta), 1, f) != 1 || fflush(f) != 0) {
+		error = -EIO;
+	}
+
+	fclose(f);
+
+	if (error == 0 && rename(tname.c_str(), metaName.c_str()) == -1) {
+		error = -errno;
+	}
+
+ clean:
+	return error;
 }
 
-/* Maps grid directory file into memory
+/* Reads metadata file of grid and current grid size from its grid scale
+
+   Parameters:
+   name: Name of grid
+   configuration: Configuration of grid is stored
+   meta: Metadata of grid is stored
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::mapGridDirectory()
+int gridfile::readGridMeta(string name, struct gridconfig *configuration,
+			   struct gridmeta *meta)
 {
 	int error = 0;
-	int dfd = -1;
+	int sfd = -1;
+	int64_t size = 0;
+	FILE *f = NULL;
 
-	dfd = open(directoryName.c_str(), O_RDWR);
-	if (dfd == -1) {
+	f = fopen((name + "meta").c_str(), "r");
+	if (f == NULL) {
 		error = -errno;
 		goto clean;
 	}
 
-	gridDirectory =
-	    (int64_t *) mmap(NULL, directorySize, PROT_READ | PROT_WRITE,
-			     MAP_SHARED, dfd, 0);
-	if (*gridDirectory == -1) {
+	if (fread(meta, sizeof(*meta), 1, f) != 1) {
+		error = -EINVAL;
+	}
+
+	fclose(f);
+
+	if (error < 0) {
+		goto clean;
+	}
+
+	if (meta->magic != META_MAGIC || meta->version != META_VERSION) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	sfd = open((name + "scale").c_str(), O_RDONLY);
+	if (sfd == -1) {
 		error = -errno;
+		goto clean;
 	}
 
-	close(dfd);
+	if (pread(sfd, &size, 8, 0) != 8 || size <= 0) {
+		error = -EINVAL;
+	}
+
+	close(sfd);
+
+	configuration->size = size;
+	configuration->psize = meta->pageSize;
+	configuration->name = name;
+	configuration->fsize = meta->recordSize;
+	configuration->csize = meta->coordinateSize;
+	configuration->split = meta->splitPolicy;
+	configuration->quantile = meta->splitQuantile;
+	configuration->rcost = meta->randomCost;
+	configuration->pages = meta->bucketPages;
 
  clean:
 	return error;
 }
 
-/* Unmaps grid directory file from memory
-*/
-void gridfile::unmapGridDirectory()
-{
-	munmap(gridDirectory, directorySize);
-	gridDirectory = NULL;
-}
-
-/* Maps grid scale file and grid directory file into memory
+/* Creates coordination segment, initializing its writer lock to be shared
+   by processes and to survive death of its owner
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::loadGrid()
+int gridfile::createGridShared()
 {
 	int error = 0;
+	int64_t iter = 0;
+	int64_t *saddr = NULL;
+	struct gridshared *shared = NULL;
+	pthread_mutexattr_t attr;
 
-	error = mapGridScale();
+	error = createFile(sizeof(struct gridshared), sharedName, "w");
 	if (error < 0) {
 		goto clean;
 	}
 
-	error = mapGridDirectory();
+	error = mapFile(sizeof(struct gridshared), sharedName, &saddr);
 	if (error < 0) {
-		unmapGridScale();
+		goto clean;
+	}
+
+	shared = (struct gridshared *)saddr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	error = -pthread_mutex_init(&shared->writerLock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	shared->writing = 0;
+	shared->writerSignal = 0;
+	shared->readerSignal = 0;
+	shared->epoch = 0;
+	shared->gridSize = gridSize;
+	shared->bucketSize = bucketSize;
+	for (iter = 0; iter < MAXPROCESSES; iter++) {
+		shared->slots[iter].pid = 0;
+		shared->slots[iter].active = 0;
 	}
 
+	munmap(saddr, sizeof(struct gridshared));
+
  clean:
 	return error;
 }
 
-/* Unmaps grid scale file and grid directory file from memory
+/* Checks if process is gone, its slot being free for reuse
+
+   Parameters:
+   pid: Process identifier
+
+   Return:
+   True if process no longer exists
 */
-void gridfile::unloadGrid()
+static bool isProcessGone(int64_t pid)
 {
-	unmapGridScale();
-	unmapGridDirectory();
+	return kill(pid, 0) == -1 && errno == ESRCH;
 }
 
-/* Fetches grid longitude and latitude for given coordinates from grid scale
+/* Sleeps on futex of shared signal while it keeps value seen, until woken
+   or until timeout passes
 
    Parameters:
-   lon: Grid longitude for given coordinates is stored
-   lat: Grid latitude for given coordinates is stored
-   x: Coordinate (x) of record
-   y: Coordinate (y) of record
+   signal: Signal in coordination segment
+   value: Value of signal seen before condition waited for was checked
+   timeout: Longest time to sleep, in microseconds
+
+   Return:
+   True if timeout passed
 */
-void gridfile::getGridLocation(int64_t * lon, int64_t * lat, int64_t x,
-			       int64_t y)
+static bool waitSignal(atomic < int32_t > *signal, int32_t value,
+		       int64_t timeout)
 {
-	int64_t xint = gridScale[1];
-	int64_t yint = gridScale[1 + gridSize];
-	int64_t *xpart = gridScale + 1 + 1;
-	int64_t *ypart = gridScale + 1 + gridSize + 1;
-	int64_t iter = 0;
+	struct timespec ts;
 
-	*lon = 0;
-	while (iter < xint && x > xpart[iter]) {
-		*lon = ++iter;
-	}
+	ts.tv_sec = timeout / 1000000;
+	ts.tv_nsec = (timeout % 1000000) * 1000;
 
-	iter = 0;
-	*lat = 0;
-	while (iter < yint && y > ypart[iter]) {
-		*lat = ++iter;
-	}
+	return syscall(SYS_futex, (int32_t *) signal, FUTEX_WAIT, value, &ts,
+		       NULL, 0) == -1 && errno == ETIMEDOUT;
 }
 
-/* Inserts new grid partition in grid scale
+/* Advances shared signal and wakes processes sleeping on it
 
    Parameters:
-   lon: Zero for latitude, one for longitude
-   partition: Value of partition to be inserted
+   signal: Signal in coordination segment
+*/
+static void wakeSignal(atomic < int32_t > *signal)
+{
+	*signal += 1;
+	syscall(SYS_futex, (int32_t *) signal, FUTEX_WAKE, INT_MAX, NULL, NULL,
+		0);
+}
+
+/* Maps coordination segment and takes slot of process in it, slot left by
+   process that is gone being taken over
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::insertGridPartition(int lon, int64_t partition)
+int gridfile::mapGridShared()
 {
 	int error = 0;
-	int64_t ints = 0;
-	int64_t *inta = NULL;
-	int64_t *part = NULL;
 	int64_t iter = 0;
-	int64_t ipart = 0;
-
-	if (lon) {
-		ints = gridScale[1];
-		inta = gridScale + 1;
-		part = gridScale + 1 + 1;
-	} else {
-		ints = gridScale[1 + gridSize];
-		inta = gridScale + 1 + gridSize;
-		part = gridScale + 1 + gridSize + 1;
-	}
+	int64_t pid = 0;
+	int64_t *saddr = NULL;
 
-	if (ints >= gridSize - 1) {
-		error = -ENOMEM;
+	error = mapFile(sizeof(struct gridshared), sharedName, &saddr);
+	if (error < 0) {
 		goto clean;
 	}
 
-	while (iter < ints && partition > part[iter]) {
-		iter++;
-	}
-
-	if (iter < ints && part[iter] == partition) {
-		error = -ENOMEM;
-		goto clean;
-	}
+	gridShared = (struct gridshared *)saddr;
+	sharedEpoch = gridShared->epoch;
 
-	ipart = iter;
+	for (iter = 0; iter < MAXPROCESSES; iter++) {
+		pid = gridShared->slots[iter].pid;
+		if (pid != 0 && !isProcessGone(pid)) {
+			continue;
+		}
 
-	for (iter = ints; iter > ipart; iter--) {
-		part[iter] = part[iter - 1];
+		if (gridShared->slots[iter].pid.compare_exchange_strong(pid,
+									 getpid()))
+		{
+			gridShared->slots[iter].active = 0;
+			sharedSlot = iter;
+			break;
+		}
 	}
 
-	part[ipart] = partition;
-	*inta += 1;
+	if (sharedSlot < 0) {
+		error = -EAGAIN;
+		unmapGridShared();
+	}
 
  clean:
 	return error;
 }
 
-/* Fetches grid partitions for given grid coordinates
+/* Gives up slot of process and unmaps coordination segment
+*/
+void gridfile::unmapGridShared()
+{
+	if (sharedSlot >= 0) {
+		gridShared->slots[sharedSlot].active = 0;
+		gridShared->slots[sharedSlot].pid = 0;
+		sharedSlot = -1;
+	}
 
-   Parameters:
-   x: Grid partition (x) is stored
-   y: Grid partition (y) is stored
-   lon: Grid longitude
-   lat: Grid latitude
+	munmap(gridShared, sizeof(struct gridshared));
+	gridShared = NULL;
+}
+
+/* Picks up sizes of grid files changed by other processes since last access
+   and remaps grid scale and grid directory replaced by grown ones. Current
+   maps are kept until new ones are in place
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::getGridPartitions(int64_t * x, int64_t * y, int64_t lon,
-				int64_t lat)
+int gridfile::refreshGrid()
 {
 	int error = 0;
-	int64_t xint = gridScale[1];
-	int64_t yint = gridScale[1 + gridSize];
-	int64_t xp = 0;
-	int64_t yp = 0;
-
-	if (lon > xint || lat > yint) {
-		error = -EINVAL;
+	int64_t epoch = gridShared->epoch;
+	int64_t nsize = gridShared->gridSize;
+	int64_t nscaleSize = (2 * nsize + 1) * 8;
+	int64_t ndirectorySize = (nsize * nsize) * GENTRY * 8 + 8;
+	int64_t *nscale = NULL;
+	int64_t *ndirectory = NULL;
+
+	if (epoch == sharedEpoch) {
 		goto clean;
 	}
 
-	xp = lon - 1 < 0 ? 0 : lon - 1;
-	yp = lat - 1 < 0 ? 0 : lat - 1;
+	if (nsize != gridSize) {
+		error = mapFile(nscaleSize, scaleName, &nscale);
+		if (error < 0) {
+			goto clean;
+		}
 
-	*x = gridScale[2 + xp];
-	*y = gridScale[2 + gridSize + yp];
+		error = mapFile(ndirectorySize, directoryName, &ndirectory);
+		if (error < 0) {
+			munmap(nscale, nscaleSize);
+			goto clean;
+		}
+
+		unmapGridScale();
+		unmapGridDirectory();
+
+		gridSize = nsize;
+		scaleSize = nscaleSize;
+		directorySize = ndirectorySize;
+		gridScale = nscale;
+		gridDirectory = ndirectory;
+	}
+
+	bucketSize = gridShared->bucketSize;
+	sharedEpoch = epoch;
 
  clean:
 	return error;
 }
 
-/* Fetches grid entry in grid directory for given coordinates
+/* Completes growth of grid interrupted by writer that is gone. Grown grid
+   directory replaces current one before grown grid scale does, so grown
+   grid scale left beside grid directory of its size still takes its place,
+   while files of growth interrupted earlier are removed. Grid directory is
+   then checked to match grid scale
 
-   Paramters:
-   lon: Grid longitude of record
-   lat: Grid latitude of record
-   gentry: Grid entry for given coordinates is stored
+   Parameters:
+   name: Name of grid
+   size: Size of grid is stored
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::getGridEntry(int64_t lon, int64_t lat, int64_t ** gentry)
+int gridfile::recoverGrowth(string name, int64_t * size)
 {
 	int error = 0;
-	int64_t offset = 1;
-	int64_t xint = gridScale[1];
-	int64_t yint = gridScale[1 + gridSize];
+	int fd = -1;
+	int64_t nsize = 0;
+	string sname = name + "scale";
+	string dname = name + "directory";
+	struct stat st;
+
+	fd = open((sname + "grow").c_str(), O_RDONLY);
+	if (fd != -1) {
+		if (pread(fd, &nsize, 8, 0) != 8) {
+			nsize = 0;
+		}
+		close(fd);
+	}
 
-	if (lon > xint || lat > yint) {
-		error = -EINVAL;
+	if (stat(dname.c_str(), &st) == -1) {
+		error = -errno;
+		goto clean;
+	}
+
+	if (nsize > 0 && st.st_size == (nsize * nsize) * GENTRY * 8 + 8
+	    && rename((sname + "grow").c_str(), sname.c_str()) == -1) {
+		error = -errno;
 		goto clean;
 	}
 
-	offset += (lon * gridSize * 5 + lat * 5);
+	unlink((sname + "grow").c_str());
+	unlink((dname + "grow").c_str());
 
-	*gentry = gridDirectory + offset;
+	fd = open(sname.c_str(), O_RDONLY);
+	if (fd == -1) {
+		error = -errno;
+		goto clean;
+	}
+
+	if (pread(fd, size, 8, 0) != 8 || *size <= 0
+	    || st.st_size != (*size * *size) * GENTRY * 8 + 8) {
+		error = -EINVAL;
+	}
+
+	close(fd);
 
  clean:
 	return error;
 }
 
-/* Maps grid bucket into memory for given grid entry
+/* Releases writer lock left locked by writer process that is gone, letting
+   readers waiting on it in. Changes of such writer are kept as far as they
+   got, growth of grid it left unfinished being completed. Lock taken while
+   no writer is gone is given back as is
+*/
+void gridfile::recoverWriter()
+{
+	int status = 0;
+	int64_t size = 0;
+
+	status = pthread_mutex_trylock(&gridShared->writerLock);
+	if (status == EOWNERDEAD) {
+		pthread_mutex_consistent(&gridShared->writerLock);
+		if (recoverGrowth(gridName, &size) == 0) {
+			gridShared->gridSize = size;
+		}
+		gridShared->epoch += 1;
+		gridShared->writing = 0;
+		wakeSignal(&gridShared->writerSignal);
+	}
+
+	if (status == 0 || status == EOWNERDEAD) {
+		pthread_mutex_unlock(&gridShared->writerLock);
+	}
+}
+
+/* Waits until readers of other processes finished operations begun before
+   writing started and released their views. Writer sleeps until woken by
+   leaving reader, readers that are gone being looked for only once sleep
+   times out, with timeout doubled up to limit
+*/
+void gridfile::waitReaders()
+{
+	int64_t iter = 0;
+	int64_t timeout = WAIT_MIN;
+	int32_t signal = 0;
+	struct gridslot *slot = NULL;
+
+	for (iter = 0; iter < MAXPROCESSES; iter++) {
+		slot = &gridShared->slots[iter];
+		while (iter != sharedSlot) {
+			signal = gridShared->readerSignal;
+			if (slot->active == 0) {
+				break;
+			}
+
+			if (!waitSignal(&gridShared->readerSignal, signal,
+					timeout)) {
+				continue;
+			}
+
+			if (isProcessGone(slot->pid)) {
+				slot->active = 0;
+				break;
+			}
+
+			timeout = min(2 * timeout, (int64_t) WAIT_MAX);
+		}
+	}
+}
+
+/* Begins access of process to grid. Writers take robust writer lock and
+   wait for readers to leave, readers announce themselves in their slot and
+   sleep while writing is in progress. Writer that is gone is looked for
+   only once sleep times out, with timeout doubled up to limit. Nested
+   accesses of same operation are covered by outermost one
 
    Parameters:
-   gentry: Grid entry of bucket to be mapped
-   gbucket: Mapped grid bucket is stored
+   exclusive: Access changes grid
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::mapGridBucket(int64_t * gentry, int64_t ** gbucket)
+int gridfile::enterGrid(bool exclusive)
 {
 	int error = 0;
-	int bfd = -1;
-	int64_t baddr = gentry[4];
-	int64_t boffset = baddr * pageSize;
+	int64_t timeout = WAIT_MIN;
+	int32_t signal = 0;
+	struct gridslot *slot = &gridShared->slots[sharedSlot];
 
-	bfd = open(bucketName.c_str(), O_RDWR);
-	if (bfd == -1) {
-		error = -errno;
+	accessDepth += 1;
+	if (accessDepth > 1) {
 		goto clean;
 	}
 
-	*gbucket =
-	    (int64_t *) mmap(NULL, pageSize, PROT_READ | PROT_WRITE, MAP_SHARED,
-			     bfd, boffset);
+	if (exclusive) {
+		error = -pthread_mutex_lock(&gridShared->writerLock);
+		if (error == -EOWNERDEAD) {
+			error = -pthread_mutex_consistent(&gridShared->writerLock);
+		}
+		if (error < 0) {
+			accessDepth -= 1;
+			goto clean;
+		}
 
-	if (**gbucket == -1) {
-		error = -errno;
+		gridShared->writing = 1;
+		waitReaders();
+	} else {
+		/* Process holding views is waited for by writer already */
+		while (true) {
+			slot->active += 1;
+			if (!gridShared->writing || slot->active > 1) {
+				break;
+			}
+
+			slot->active -= 1;
+			wakeSignal(&gridShared->readerSignal);
+			while (true) {
+				signal = gridShared->writerSignal;
+				if (!gridShared->writing) {
+					break;
+				}
+
+				if (waitSignal(&gridShared->writerSignal, signal,
+					       timeout)) {
+					recoverWriter();
+					timeout = min(2 * timeout,
+						      (int64_t) WAIT_MAX);
+				}
+			}
+		}
 	}
 
-	close(bfd);
+	error = refreshGrid();
+	if (error < 0) {
+		leaveGrid(exclusive);
+	}
 
  clean:
 	return error;
 }
 
-/* Unmaps grid bucket from memory
+/* Ends access of process to grid, writers publishing sizes of grid files
+   and advancing epoch
 
    Parameters:
-   gbucket: Grid bucket to be unmapped
+   exclusive: Access changed grid
 */
-void gridfile::unmapGridBucket(int64_t * gbucket)
+void gridfile::leaveGrid(bool exclusive)
 {
-	munmap(gbucket, pageSize);
-	gbucket = NULL;
+	accessDepth -= 1;
+	if (accessDepth > 0) {
+		return;
+	}
+
+	if (exclusive) {
+		gridShared->gridSize = gridSize;
+		gridShared->bucketSize = bucketSize;
+		gridShared->epoch += 1;
+		sharedEpoch = gridShared->epoch;
+		gridShared->writing = 0;
+		wakeSignal(&gridShared->writerSignal);
+		pthread_mutex_unlock(&gridShared->writerLock);
+	} else {
+		gridShared->slots[sharedSlot].active -= 1;
+		if (gridShared->writing) {
+			wakeSignal(&gridShared->readerSignal);
+		}
+	}
 }
 
-/* Appends x, y, record size and record at end of the bucket
+/* Begins access to grid, failure being kept for operation to return.
+   Outermost access flushes memtable first, unless operation reads changes
+   buffered in memtable itself
 
    Parameters:
-   gbucket: Bucket in which entry must be appended
-   x: Coordinate (x) for new record
-   y: Coordinate (y) for new record
-   rsize: Size of record data
-   record: Buffer holding record data
+   agrid: Grid being accessed
+   aexclusive: Access changes grid
+   abuffered: Operation reads buffered changes
 */
-void gridfile::appendBucketEntry(int64_t * gbucket, int64_t x, int64_t y,
-				 int64_t rsize, void *record)
+gridaccess::gridaccess(struct gridfile *agrid, bool aexclusive,
+		       bool abuffered)
 {
-	int64_t nbytes = gbucket[0];
-	int64_t boffset = 16 + nbytes;
-	int64_t *bentry = (int64_t *) ((char *)gbucket + boffset);
+	grid = agrid;
+	exclusive = aexclusive;
+	error = 0;
 
-	bentry[0] = x;
-	bentry[1] = y;
-	bentry[2] = rsize;
-	memcpy(bentry + 3, record, rsize);
+	if (!abuffered && grid->accessDepth == 0) {
+		error = grid->flushMemtable();
+	}
 
-	gbucket[0] += (24 + rsize);
-	gbucket[1] += 1;
+	if (error == 0) {
+		error = grid->enterGrid(exclusive);
+	}
 }
 
-/* Fetches bucket entry from mapped grid bucket
+/* Ends access to grid, if it began
+*/
+gridaccess::~gridaccess()
+{
+	if (error == 0) {
+		grid->leaveGrid(exclusive);
+	}
+}
 
-   Parameters:
-   bentry: Bucket entry is stored
-   gbucket: Mapped grid bucket for given entry
-   entry: Position of bucket entry in mapped grid bucket
+/* Takes exclusive hold of grid for outermost write of thread, once views
+   of process are released. Views are only taken while grid is held, so
+   that views taken meanwhile wait for write to finish, and are released
+   without it, so that grid may be kept by an enclosing read of thread
+   while waiting for them
 
-   Return:
-   Zero on success, error on failure
+   Parameters:
+   wgrid: Grid being written
 */
-int gridfile::getBucketEntry(int64_t ** bentry, int64_t * gbucket,
-			     int64_t entry)
+gridwriter::gridwriter(struct gridfile *wgrid)
 {
-	int error = 0;
-	int64_t nrecords = gbucket[1];
-	char *be = (char *)gbucket + 16;
-	int64_t *cbe = NULL;
-	int64_t rsize = 0;
-	int64_t iter = 0;
+	grid = wgrid;
+	outermost = grid->writerThread != this_thread::get_id();
 
-	if (entry >= nrecords) {
-		error = -EINVAL;
-		goto clean;
+	if (!outermost) {
+		grid->gridLock.lock();
+		return;
 	}
 
-	for (iter = 0; iter < entry; iter++) {
-		cbe = (int64_t *) be;
-		rsize = cbe[2];
-		be += (24 + rsize);
+	while (true) {
+		grid->gridLock.lock();
+
+		unique_lock < mutex > wait(grid->viewLock);
+		if (grid->pinnedViews == 0) {
+			break;
+		}
+
+		grid->gridLock.unlock();
+		grid->viewSignal.wait(wait, [this] {
+				      return grid->pinnedViews == 0;
+				      });
 	}
 
-	*bentry = (int64_t *) be;
+	grid->writerThread = this_thread::get_id();
+}
 
- clean:
-	return error;
+/* Gives up hold of grid
+*/
+gridwriter::~gridwriter()
+{
+	if (outermost) {
+		grid->writerThread = thread::id();
+	}
+
+	grid->gridLock.unlock();
 }
 
-/* Deletes bucket entry from mapped grid bucket
+/* Moves view, leaving moved view empty
 
    Parameters:
-   gbucket: Mapped grid bucket for given entry
-   entry: Position of bucket entry in mapped grid bucket
+   view: View to be moved
+*/
+gridview::gridview(gridview && view)
+{
+	grid = view.grid;
+	page = view.page;
+	data = view.data;
+	size = view.size;
+	view.grid = NULL;
+	view.page = NULL;
+	view.data = NULL;
+	view.size = 0;
+}
+
+/* Releases view and moves other view into it
+
+   Parameters:
+   view: View to be moved
 
    Return:
-   Zero on success, error on failure
+   This view
 */
-int gridfile::deleteBucketEntry(int64_t * gbucket, int64_t entry)
+gridview & gridview::operator=(gridview && view)
 {
-	int error = 0;
-	int64_t nbytes = gbucket[0];
-	int64_t nrecords = gbucket[1];
-	int64_t cbytes = nbytes;
-	int64_t *cbe = NULL;
-	int64_t *nbe = NULL;
-	int64_t rsize = 0;
-	int64_t iter = 0;
-
-	if (entry >= nrecords) {
-		error = -EINVAL;
-		goto clean;
+	if (this != &view) {
+		release();
+		grid = view.grid;
+		page = view.page;
+		data = view.data;
+		size = view.size;
+		view.grid = NULL;
+		view.page = NULL;
+		view.data = NULL;
+		view.size = 0;
 	}
 
-	for (iter = 0; iter < entry; iter++) {
-		error = getBucketEntry(&cbe, gbucket, iter);
-		if (error < 0) {
-			goto clean;
-		}
+	return *this;
+}
 
-		cbytes -= (24 + cbe[2]);
-	}
+/* Releases view
+*/
+gridview::~gridview()
+{
+	release();
+}
 
-	error = getBucketEntry(&cbe, gbucket, entry);
-	if (error < 0) {
-		goto clean;
-	}
+/* Fetches record of view
 
-	rsize = cbe[2];
-	cbytes -= (24 + rsize);
-	nbe = (int64_t *) ((char *)cbe + 24 + rsize);
+   Return:
+   Address of record inside bucket page, NULL if view is empty
+*/
+const void *gridview::getData()
+{
+	return data;
+}
 
-	memmove(cbe, nbe, cbytes);
+/* Fetches size of record of view
 
-	gbucket[0] -= (24 + rsize);
-	gbucket[1] -= 1;
+   Return:
+   Size of record, zero if view is empty
+*/
+int64_t gridview::getSize()
+{
+	return size;
+}
 
- clean:
-	return error;
+/* Unmaps bucket page of view and lets writers waiting for it in
+*/
+void gridview::release()
+{
+	if (grid == NULL) {
+		return;
+	}
+
+	grid->unpinView(page);
+	grid = NULL;
+	page = NULL;
+	data = NULL;
+	size = 0;
 }
 
-/* Inserts new record into bucket, updating bucket and grid entry statistics
+/* Releases chunks of arena
+*/
+gridarena::~gridarena()
+{
+	int64_t iter = 0;
+
+	for (iter = 0; iter < (int64_t) chunks.size(); iter++) {
+		free(chunks[iter]);
+	}
+}
+
+/* Takes memory from arena, moving on to next chunk, or new one of at least
+   ARENA_CHUNK bytes, if current one has no room left
 
    Parameters:
-   gentry: Grid entry for given coordinates
-   x: Coordinate (x) of new record
-   y: Coordinate (y) of new record
-   record: Buffer holding record data
-   rsize: Size of record data
+   size: Number of bytes needed
+   addr: Address of memory is stored
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::insertGridRecord(int64_t * gentry, int64_t x, int64_t y,
-			       void *record, int64_t rsize)
+int gridarena::allocate(int64_t size, void **addr)
 {
 	int error = 0;
-	int64_t nbytes = gentry[0];
-	int64_t nrecords = gentry[1];
-	int64_t sx = gentry[2];
-	int64_t sy = gentry[3];
-	int64_t esize = 24 + rsize;
-	int64_t capacity = pageSize - 16 - nbytes;
-	int64_t *gbucket = NULL;
+	int64_t asize = (size + 7) & ~7;
+	int64_t csize = 0;
+	char *caddr = NULL;
 
-	if (esize > capacity) {
-		error = -ENOMEM;
-		goto clean;
+	while (chunk < (int64_t) chunks.size() && used + asize > sizes[chunk]) {
+		chunk++;
+		used = 0;
 	}
 
-	error = mapGridBucket(gentry, &gbucket);
-	if (error < 0) {
-		goto clean;
+	if (chunk == (int64_t) chunks.size()) {
+		csize = max(asize, (int64_t) ARENA_CHUNK);
+		caddr = (char *)malloc(csize);
+		if (caddr == NULL) {
+			error = -ENOMEM;
+			goto clean;
+		}
+		chunks.push_back(caddr);
+		sizes.push_back(csize);
 	}
 
-	appendBucketEntry(gbucket, x, y, rsize, record);
-
-	gentry[2] = sx + x;
-	gentry[3] = sy + y;
-	gentry[1] += 1;
-	gentry[0] += (24 + rsize);
-
-	unmapGridBucket(gbucket);
+	*addr = chunks[chunk] + used;
+	last = used;
+	used += asize;
 
  clean:
 	return error;
 }
 
-/* Splits grid in one direction with new grid entries sharing buckets
+/* Gives back memory past given size of last memory taken from arena
 
    Parameters:
-   vertical: Zero for latitude wise, one for longitude wise
-   lon: Grid longitude along which to split if vertical
-   lat: Grid latitude along which to split if not vertical
-   x: Coordinate (x) of new record
-   y: Coordinate (y) of new record
+   addr: Address of last memory taken
+   size: Number of bytes kept
+*/
+void gridarena::shrink(void *addr, int64_t size)
+{
+	if (chunk < (int64_t) chunks.size() && addr == chunks[chunk] + last) {
+		used = last + ((size + 7) & ~7);
+	}
+}
 
-   Return:
-   Zero on success, error on failure
+/* Releases all memory taken from arena at once, keeping chunks for reuse
 */
-int gridfile::splitGrid(int vertical, int64_t lon, int64_t lat, int64_t x,
-			int64_t y)
+void gridarena::reset()
+{
+	chunk = 0;
+	used = 0;
+	last = 0;
+}
+
+/* Maps file of given size into memory
+
+   Parameters:
+   size: Size of file to be mapped
+   fname: Name of file as per convention
+   addr: Mapped address is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::mapFile(int64_t size, string fname, int64_t ** addr)
+{
+	int error = 0;
+	int fd = -1;
+	void *maddr = NULL;
+
+	fd = open(fname.c_str(), O_RDWR);
+	if (fd == -1) {
+		error = -errno;
+		goto clean;
+	}
+
+	maddr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (maddr == MAP_FAILED) {
+		error = -errno;
+	} else {
+		*addr = (int64_t *) maddr;
+	}
+
+	close(fd);
+
+ clean:
+	return error;
+}
+
+/* Maps grid scale file into memory
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::mapGridScale()
+{
+	return mapFile(scaleSize, scaleName, &gridScale);
+}
+
+/* Unmaps grid scale file from memory
+*/
+void gridfile::unmapGridScale()
+{
+	munmap(gridScale, scaleSize);
+	gridScale = NULL;
+}
+
+/* Maps grid directory file into memory
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::mapGridDirectory()
+{
+	return mapFile(directorySize, directoryName, &gridDirectory);
+}
+
+/* Unmaps grid directory file from memory
+*/
+void gridfile::unmapGridDirectory()
+{
+	munmap(gridDirectory, directorySize);
+	gridDirectory = NULL;
+}
+
+/* Maps coordination segment, grid scale file and grid directory file into
+   memory, sizes of grid files being the ones last published to segment
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::loadGrid()
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+	int error = 0;
+
+	error = mapGridShared();
+	if (error < 0) {
+		goto clean;
+	}
+
+	/* Sizes are read while no other process grows grid */
+	error = enterGrid(false);
+	if (error < 0) {
+		unmapGridShared();
+		goto clean;
+	}
+
+	gridSize = gridShared->gridSize;
+	bucketSize = gridShared->bucketSize;
+	scaleSize = (2 * gridSize + 1) * 8;
+	directorySize = (gridSize * gridSize) * GENTRY * 8 + 8;
+	sharedEpoch = gridShared->epoch;
+
+	error = mapGridScale();
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = mapGridDirectory();
+	if (error < 0) {
+		unmapGridScale();
+		goto pclean;
+	}
+
+	bucketFd = open(bucketName.c_str(), O_RDONLY);
+	if (bucketFd == -1) {
+		error = -errno;
+		unmapGridDirectory();
+		unmapGridScale();
+	}
+
+ pclean:
+	leaveGrid(false);
+	if (error < 0) {
+		unmapGridShared();
+	}
+
+ clean:
+	return error;
+}
+
+/* Stops executor and compactor, saves split counts to metadata file and
+   unmaps grid scale file, grid directory file and coordination segment
+   from memory
+*/
+void gridfile::unloadGrid()
+{
+	stopExecutor();
+	stopCompactor();
+	stopMemtable();
+
+	lock_guard < recursive_mutex > guard(gridLock);
+
+	if (gridShared != NULL) {
+		writeGridMeta();
+	}
+
+	unmapGridScale();
+	unmapGridDirectory();
+	unmapGridShared();
+	close(bucketFd);
+	bucketFd = -1;
+	stopLog();
+}
+
+/* Fetches grid longitude and latitude for given coordinates from grid scale
+
+   Parameters:
+   lon: Grid longitude for given coordinates is stored
+   lat: Grid latitude for given coordinates is stored
+   x: Coordinate (x) of record
+   y: Coordinate (y) of record
+*/
+void gridfile::getGridLocation(int64_t * lon, int64_t * lat, int64_t x,
+			       int64_t y)
+{
+	int64_t xint = gridScale[1];
+	int64_t yint = gridScale[1 + gridSize];
+	int64_t *xpart = gridScale + 1 + 1;
+	int64_t *ypart = gridScale + 1 + gridSize + 1;
+	int64_t iter = 0;
+
+	*lon = 0;
+	while (iter < xint && x > xpart[iter]) {
+		*lon = ++iter;
+	}
+
+	iter = 0;
+	*lat = 0;
+	while (iter < yint && y > ypart[iter]) {
+		*lat = ++iter;
+	}
+}
+
+/* Inserts new grid partition in grid scale
+
+   Parameters:
+   lon: Zero for latitude, one for longitude
+   partition: Value of partition to be inserted
+   ipartition: Index of inserted partition is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::insertGridPartition(int lon, int64_t partition,
+				  int64_t * ipartition)
+{
+	int error = 0;
+	int64_t ints = 0;
+	int64_t *inta = NULL;
+	int64_t *part = NULL;
+	int64_t iter = 0;
+	int64_t ipart = 0;
+
+	if (lon) {
+		ints = gridScale[1];
+		inta = gridScale + 1;
+		part = gridScale + 1 + 1;
+	} else {
+		ints = gridScale[1 + gridSize];
+		inta = gridScale + 1 + gridSize;
+		part = gridScale + 1 + gridSize + 1;
+	}
+
+	if (ints >= gridSize - 1) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	while (iter < ints && partition > part[iter]) {
+		iter++;
+	}
+
+	if (iter < ints && part[iter] == partition) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	ipart = iter;
+
+	for (iter = ints; iter > ipart; iter--) {
+		part[iter] = part[iter - 1];
+	}
+
+	part[ipart] = partition;
+	*inta += 1;
+	*ipartition = ipart;
+
+ clean:
+	return error;
+}
+
+/* Fetches grid partitions for given grid coordinates
+
+   Parameters:
+   x: Grid partition (x) is stored
+   y: Grid partition (y) is stored
+   lon: Grid longitude
+   lat: Grid latitude
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::getGridPartitions(int64_t * x, int64_t * y, int64_t lon,
+				int64_t lat)
+{
+	int error = 0;
+	int64_t xint = gridScale[1];
+	int64_t yint = gridScale[1 + gridSize];
+	int64_t xp = 0;
+	int64_t yp = 0;
+
+	if (lon > xint || lat > yint) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	xp = lon - 1 < 0 ? 0 : lon - 1;
+	yp = lat - 1 < 0 ? 0 : lat - 1;
+
+	*x = gridScale[2 + xp];
+	*y = gridScale[2 + gridSize + yp];
+
+ clean:
+	return error;
+}
+
+/* Fetches grid entry in grid directory for given coordinates
+
+   Paramters:
+   lon: Grid longitude of record
+   lat: Grid latitude of record
+   gentry: Grid entry for given coordinates is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::getGridEntry(int64_t lon, int64_t lat, int64_t ** gentry)
+{
+	int error = 0;
+	int64_t offset = 1;
+	int64_t xint = gridScale[1];
+	int64_t yint = gridScale[1 + gridSize];
+
+	if (lon > xint || lat > yint) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	offset += (lon * gridSize * GENTRY + lat * GENTRY);
+
+	*gentry = gridDirectory + offset;
+
+ clean:
+	return error;
+}
+
+/* Doubles grid size, rebuilding grid scale and grid directory into new
+   files which then replace current ones. Files of growth are removed if it
+   fails before grid directory is replaced
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::growGrid()
+{
+	int error = 0;
+	int64_t nsize = 2 * gridSize;
+	int64_t nscaleSize = (2 * nsize + 1) * 8;
+	int64_t ndirectorySize = (nsize * nsize) * GENTRY * 8 + 8;
+	string nscaleName = scaleName + "grow";
+	string ndirectoryName = directoryName + "grow";
+	int64_t *nscale = NULL;
+	int64_t *ndirectory = NULL;
+	int64_t xint = gridScale[1];
+	int64_t yint = gridScale[1 + gridSize];
+	int64_t xiter = 0;
+	int64_t *ge = NULL;
+
+	error = createFile(nscaleSize, nscaleName, "w");
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = createFile(ndirectorySize, ndirectoryName, "w");
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = mapFile(nscaleSize, nscaleName, &nscale);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = mapFile(ndirectorySize, ndirectoryName, &ndirectory);
+	if (error < 0) {
+		munmap(nscale, nscaleSize);
+		goto pclean;
+	}
+
+	nscale[0] = nsize;
+	memcpy(nscale + 1, gridScale + 1, (xint + 1) * 8);
+	memcpy(nscale + 1 + nsize, gridScale + 1 + gridSize, (yint + 1) * 8);
+
+	ndirectory[0] = gridDirectory[0];
+	for (xiter = 0; xiter <= xint; xiter++) {
+		getGridEntry(xiter, 0, &ge);
+		memcpy(ndirectory + 1 + xiter * nsize * GENTRY, ge,
+		       (yint + 1) * GENTRY * 8);
+	}
+
+	/* Grid scale is replaced last, its size telling openGrid and
+	   recoverGrowth which grid directory it goes with */
+	if (rename(ndirectoryName.c_str(), directoryName.c_str()) == -1) {
+		error = -errno;
+		munmap(nscale, nscaleSize);
+		munmap(ndirectory, ndirectorySize);
+		goto pclean;
+	}
+
+	/* Grown grid scale left in place is taken by recoverGrowth */
+	if (rename(nscaleName.c_str(), scaleName.c_str()) == -1) {
+		error = -errno;
+	}
+
+	unmapGridScale();
+	unmapGridDirectory();
+
+	gridSize = nsize;
+	scaleSize = nscaleSize;
+	directorySize = ndirectorySize;
+	gridScale = nscale;
+	gridDirectory = ndirectory;
+
+	goto clean;
+
+ pclean:
+	unlink(nscaleName.c_str());
+	unlink(ndirectoryName.c_str());
+
+ clean:
+	return error;
+}
+
+/* Allocates new bucket at end of bucket file, growing file if needed
+
+   Parameters:
+   baddr: Address of new bucket is stored
+   npages: Number of contiguous pages of new bucket
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::allocateGridBucket(int64_t * baddr, int64_t npages)
+{
+	int error = 0;
+	int64_t naddr = gridDirectory[0];
+	int64_t nsize = bucketSize;
+
+	while ((naddr + npages) * pageSize > nsize) {
+		nsize *= 2;
+	}
+
+	if (nsize > bucketSize) {
+		if (truncate(bucketName.c_str(), nsize) == -1) {
+			error = -errno;
+			goto clean;
+		}
+
+		bucketSize = nsize;
+	}
+
+	*baddr = naddr;
+	gridDirectory[0] += npages;
+
+ clean:
+	return error;
+}
+
+/* Maps grid bucket into memory for given grid entry, over pages of its
+   extent. Length of mapping is kept aside, so that bucket is unmapped
+   without its grid entry, which may have changed meanwhile
+
+   Parameters:
+   gentry: Grid entry of bucket to be mapped
+   gbucket: Mapped grid bucket is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::mapGridBucket(int64_t * gentry, int64_t ** gbucket)
+{
+	int error = 0;
+	int bfd = -1;
+	int64_t baddr = gentry[4];
+	int64_t boffset = baddr * pageSize;
+	int64_t length = getBucketPages(gentry) * pageSize;
+
+	bfd = open(bucketName.c_str(), O_RDWR);
+	if (bfd == -1) {
+		error = -errno;
+		goto clean;
+	}
+
+	*gbucket =
+	    (int64_t *) mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+			     bfd, boffset);
+
+	if (*gbucket == MAP_FAILED) {
+		error = -errno;
+	} else {
+		mappingLock.lock();
+		bucketMappings[*gbucket] = length;
+		mappingLock.unlock();
+	}
+
+	close(bfd);
+
+ clean:
+	return error;
+}
+
+/* Unmaps grid bucket from memory
+
+   Parameters:
+   gbucket: Grid bucket to be unmapped
+*/
+void gridfile::unmapGridBucket(int64_t * gbucket)
+{
+	int64_t length = 0;
+
+	mappingLock.lock();
+	length = bucketMappings[gbucket];
+	bucketMappings.erase(gbucket);
+	mappingLock.unlock();
+
+	munmap(gbucket, length);
+	gbucket = NULL;
+}
+
+/* Computes number of pages spanned by bucket
+
+   Parameters:
+   gentry: Grid entry of bucket
+
+   Return:
+   Number of contiguous pages of bucket
+*/
+int64_t gridfile::getBucketPages(int64_t * gentry)
+{
+	return (int64_t) 1 << gentry[9];
+}
+
+/* Computes number of bytes of entries bucket can hold
+
+   Parameters:
+   gentry: Grid entry of bucket
+
+   Return:
+   Capacity of bucket, pages of its extent less bucket header
+*/
+int64_t gridfile::getBucketCapacity(int64_t * gentry)
+{
+	return getBucketPages(gentry) * pageSize - 16;
+}
+
+/* Computes order of smallest extent holding given number of bytes
+
+   Parameters:
+   nbytes: Number of bytes of entries
+
+   Return:
+   Order of extent, bounded by largest extent
+*/
+int64_t gridfile::getExtentOrder(int64_t nbytes)
+{
+	int64_t order = 0;
+
+	while (((int64_t) 1 << order) < bucketPages
+	       && ((int64_t) 1 << order) * pageSize - 16 < nbytes) {
+		order++;
+	}
+
+	return order;
+}
+
+/* Asks kernel to read grid bucket ahead of its mapping, so that reads of
+   several buckets are in flight at once
+
+   Parameters:
+   gentry: Grid entry of bucket to be read
+*/
+void gridfile::prefetchBucket(int64_t * gentry)
+{
+	posix_fadvise(bucketFd, gentry[4] * pageSize,
+		      getBucketPages(gentry) * pageSize, POSIX_FADV_WILLNEED);
+}
+
+/* Fetches coordinates of bucket entry
+
+   Parameters:
+   x: Coordinate (x) of entry is stored
+   y: Coordinate (y) of entry is stored
+   bentry: Bucket entry
+*/
+void gridfile::getEntryCoordinates(int64_t * x, int64_t * y,
+				   int64_t * bentry)
+{
+	int32_t *cbentry = (int32_t *) bentry;
+
+	if (coordinateSize == 4) {
+		*x = cbentry[0];
+		*y = cbentry[1];
+	} else {
+		*x = bentry[0];
+		*y = bentry[1];
+	}
+}
+
+/* Stores coordinates in bucket entry
+
+   Parameters:
+   bentry: Bucket entry
+   x: Coordinate (x)
+   y: Coordinate (y)
+*/
+void gridfile::setEntryCoordinates(int64_t * bentry, int64_t x, int64_t y)
+{
+	int32_t *cbentry = (int32_t *) bentry;
+
+	if (coordinateSize == 4) {
+		cbentry[0] = x;
+		cbentry[1] = y;
+	} else {
+		bentry[0] = x;
+		bentry[1] = y;
+	}
+}
+
+/* Fetches size of record data of bucket entry
+
+   Parameters:
+   bentry: Bucket entry
+
+   Return:
+   Fixed record size if configured, stored record size otherwise
+*/
+int64_t gridfile::getEntrySize(int64_t * bentry)
+{
+	if (recordSize) {
+		return recordSize;
+	}
+
+	return *(int64_t *) ((char *)bentry + 2 * coordinateSize);
+}
+
+/* Fetches record data of bucket entry
+
+   Parameters:
+   bentry: Bucket entry
+
+   Return:
+   Pointer to record data following entry header
+*/
+void *gridfile::getEntryRecord(int64_t * bentry)
+{
+	return (char *)bentry + headerSize;
+}
+
+/* Copies bucket entry as x, y, record size and record into buffer
+
+   Parameters:
+   dest: Buffer in which entry must be copied
+   bentry: Bucket entry
+
+   Return:
+   Number of bytes written in buffer
+*/
+int64_t gridfile::copyBucketEntry(char *dest, int64_t * bentry)
+{
+	int64_t *dentry = (int64_t *) dest;
+	int64_t rsize = getEntrySize(bentry);
+
+	getEntryCoordinates(dentry, dentry + 1, bentry);
+	dentry[2] = rsize;
+	memcpy(dentry + 3, getEntryRecord(bentry), rsize);
+
+	return 24 + rsize;
+}
+
+/* Computes number of bytes needed to copy out entries of buckets
+
+   Parameters:
+   capacity: Total capacity of buckets
+
+   Return:
+   Upper bound on bytes written by copyBucketEntry for full buckets
+*/
+int64_t gridfile::getBucketOutputSize(int64_t capacity)
+{
+	int64_t nentries = capacity / (headerSize + recordSize);
+
+	return capacity + nentries * (24 - headerSize);
+}
+
+/* Appends x, y, record size and record at end of the bucket
+
+   Parameters:
+   gbucket: Bucket in which entry must be appended
+   x: Coordinate (x) for new record
+   y: Coordinate (y) for new record
+   rsize: Size of record data
+   record: Buffer holding record data
+*/
+void gridfile::appendBucketEntry(int64_t * gbucket, int64_t x, int64_t y,
+				 int64_t rsize, void *record)
+{
+	int64_t nbytes = gbucket[0];
+	int64_t boffset = 16 + nbytes;
+	int64_t *bentry = (int64_t *) ((char *)gbucket + boffset);
+
+	setEntryCoordinates(bentry, x, y);
+
+	if (!recordSize) {
+		*(int64_t *) ((char *)bentry + 2 * coordinateSize) = rsize;
+	}
+	memcpy(getEntryRecord(bentry), record, rsize);
+
+	gbucket[0] += (headerSize + rsize);
+	gbucket[1] += 1;
+}
+
+/* Fetches bucket entry from mapped grid bucket
+
+   Parameters:
+   bentry: Bucket entry is stored
+   gbucket: Mapped grid bucket for given entry
+   entry: Position of bucket entry in mapped grid bucket
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::getBucketEntry(int64_t ** bentry, int64_t * gbucket,
+			     int64_t entry)
+{
+	int error = 0;
+	int64_t nrecords = gbucket[1];
+	char *be = (char *)gbucket + 16;
+	int64_t iter = 0;
+
+	if (entry >= nrecords) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	if (recordSize) {
+		be += entry * (headerSize + recordSize);
+	} else {
+		for (iter = 0; iter < entry; iter++) {
+			be += (headerSize + getEntrySize((int64_t *) be));
+		}
+	}
+
+	*bentry = (int64_t *) be;
+
+ clean:
+	return error;
+}
+
+/* Searches mapped grid bucket for entry with given coordinates
+
+   Parameters:
+   bentry: Bucket entry is stored
+   entry: Position of bucket entry in mapped grid bucket is stored
+   gbucket: Mapped grid bucket
+   x: Coordinate (x) of entry
+   y: Coordinate (y) of entry
+
+   Return:
+   Zero on success, error if no entry has given coordinates
+*/
+int gridfile::findBucketEntry(int64_t ** bentry, int64_t * entry,
+			      int64_t * gbucket, int64_t x, int64_t y)
+{
+	int error = -EINVAL;
+	int64_t nrecords = gbucket[1];
+	int64_t iter = 0;
+	int64_t bx = 0;
+	int64_t by = 0;
+	char *be = (char *)gbucket + 16;
+
+	for (iter = 0; iter < nrecords; iter++) {
+		getEntryCoordinates(&bx, &by, (int64_t *) be);
+
+		if (bx == x && by == y) {
+			*bentry = (int64_t *) be;
+			*entry = iter;
+			error = 0;
+			break;
+		}
+
+		be += (headerSize + getEntrySize((int64_t *) be));
+	}
+
+	return error;
+}
+
+/* Finds bucket entry for given coordinates in mapped grid bucket, passing
+   over given number of entries for same coordinates first
+
+   Parameters:
+   bentry: Bucket entry for given coordinates is stored
+   gbucket: Mapped grid bucket
+   x: Coordinate (x) of bucket entry
+   y: Coordinate (y) of bucket entry
+   skip: Number of entries for same coordinates to be passed over
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::findMatchingEntry(int64_t ** bentry, int64_t * gbucket,
+				int64_t x, int64_t y, int64_t skip)
+{
+	int error = -EINVAL;
+	int64_t nrecords = gbucket[1];
+	int64_t iter = 0;
+	int64_t bx = 0;
+	int64_t by = 0;
+	char *be = (char *)gbucket + 16;
+
+	for (iter = 0; iter < nrecords; iter++) {
+		getEntryCoordinates(&bx, &by, (int64_t *) be);
+
+		if (bx == x && by == y && skip-- == 0) {
+			*bentry = (int64_t *) be;
+			error = 0;
+			break;
+		}
+
+		be += (headerSize + getEntrySize((int64_t *) be));
+	}
+
+	return error;
+}
+
+/* Deletes bucket entry from mapped grid bucket
+
+   Parameters:
+   gbucket: Mapped grid bucket for given entry
+   entry: Position of bucket entry in mapped grid bucket
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::deleteBucketEntry(int64_t * gbucket, int64_t entry)
+{
+	int error = 0;
+	int64_t nbytes = gbucket[0];
+	int64_t nrecords = gbucket[1];
+	int64_t cbytes = nbytes;
+	int64_t *cbe = NULL;
+	int64_t *nbe = NULL;
+	int64_t esize = 0;
+
+	if (entry >= nrecords) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	error = getBucketEntry(&cbe, gbucket, entry);
+	if (error < 0) {
+		goto clean;
+	}
+
+	esize = headerSize + getEntrySize(cbe);
+	cbytes -= ((char *)cbe - ((char *)gbucket + 16) + esize);
+	nbe = (int64_t *) ((char *)cbe + esize);
+
+	memmove(cbe, nbe, cbytes);
+
+	gbucket[0] -= esize;
+	gbucket[1] -= 1;
+
+ clean:
+	return error;
+}
+
+/* Inserts new record into bucket, updating bucket and grid entry statistics
+
+   Parameters:
+   gentry: Grid entry for given coordinates
+   x: Coordinate (x) of new record
+   y: Coordinate (y) of new record
+   record: Buffer holding record data
+   rsize: Size of record data
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::insertGridRecord(int64_t * gentry, int64_t x, int64_t y,
+			       void *record, int64_t rsize)
+{
+	int error = 0;
+	int64_t nbytes = gentry[0];
+	int64_t nrecords = gentry[1];
+	int64_t sx = gentry[2];
+	int64_t sy = gentry[3];
+	int64_t esize = headerSize + rsize;
+	int64_t capacity = getBucketCapacity(gentry) - nbytes;
+	int64_t *gbucket = NULL;
+
+	if (esize > capacity) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	error = mapGridBucket(gentry, &gbucket);
+	if (error < 0) {
+		goto clean;
+	}
+
+	appendBucketEntry(gbucket, x, y, rsize, record);
+
+	gentry[2] = sx + x;
+	gentry[3] = sy + y;
+	gentry[1] += 1;
+	gentry[0] += esize;
+
+	unmapGridBucket(gbucket);
+
+ clean:
+	return error;
+}
+
+/* Removes entry from bucket, updating bucket and grid entry statistics
+
+   Parameters:
+   gentry: Grid entry of bucket
+   gbucket: Mapped grid bucket
+   entry: Position of bucket entry in mapped grid bucket
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::removeGridRecord(int64_t * gentry, int64_t * gbucket,
+			       int64_t entry)
+{
+	int error = 0;
+	int64_t *be = NULL;
+	int64_t bx = 0;
+	int64_t by = 0;
+	int64_t esize = 0;
+
+	error = getBucketEntry(&be, gbucket, entry);
+	if (error < 0) {
+		goto clean;
+	}
+
+	getEntryCoordinates(&bx, &by, be);
+	esize = headerSize + getEntrySize(be);
+
+	error = deleteBucketEntry(gbucket, entry);
+	if (error < 0) {
+		goto clean;
+	}
+
+	gentry[0] -= esize;
+	gentry[1] -= 1;
+	gentry[2] -= bx;
+	gentry[3] -= by;
+
+ clean:
+	return error;
+}
+
+/* Chooses direction and value of partition splitting given coordinates as
+   per split policy. Mean policy splits preferred direction at average
+   coordinate, quantile policy splits direction of larger spread at given
+   quantile of coordinates.
+
+   Parameters:
+   vertical: Preferred direction, zero for latitude wise and one for
+   longitude wise, chosen direction is stored
+   partition: Value of partition is stored
+   xs: Coordinates (x) to be split
+   ys: Coordinates (y) to be split
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::getSplitPartition(int *vertical, int64_t * partition,
+				vector < int64_t > &xs, vector < int64_t > &ys)
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t sum = 0;
+	int64_t xspread = 0;
+	int64_t yspread = 0;
+	int64_t cmax = 0;
+	vector < int64_t > cs;
+
+	xspread = *max_element(xs.begin(), xs.end()) -
+	    *min_element(xs.begin(), xs.end());
+	yspread = *max_element(ys.begin(), ys.end()) -
+	    *min_element(ys.begin(), ys.end());
+
+	if (xspread == 0 && yspread == 0) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	if (splitPolicy == SPLIT_MEAN) {
+		if ((*vertical && xspread == 0) || (!*vertical && yspread == 0)) {
+			*vertical = !*vertical;
+		}
+	} else if (xspread != yspread) {
+		*vertical = xspread > yspread ? 1 : 0;
+	}
+
+	cs = *vertical ? xs : ys;
+
+	if (splitPolicy == SPLIT_MEAN) {
+		for (iter = 0; iter < (int64_t) cs.size(); iter++) {
+			sum += cs[iter];
+		}
+
+		*partition = sum / (int64_t) cs.size();
+		if (sum < 0 && sum % (int64_t) cs.size()) {
+			*partition -= 1;
+		}
+
+		goto clean;
+	}
+
+	cmax = *max_element(cs.begin(), cs.end());
+	iter = (int64_t) (splitQuantile * (cs.size() - 1));
+	nth_element(cs.begin(), cs.begin() + iter, cs.end());
+	*partition = cs[iter];
+
+	/* Partition equal to maximum would leave upper side empty */
+	if (*partition == cmax) {
+		*partition = *min_element(cs.begin(), cs.end());
+		for (iter = 0; iter < (int64_t) cs.size(); iter++) {
+			if (cs[iter] < cmax && cs[iter] > *partition) {
+				*partition = cs[iter];
+			}
+		}
+	}
+
+ clean:
+	return error;
+}
+
+/* Chooses partition of grid scale lying inside bucket region which divides
+   given coordinates most evenly, preferring partitions halving the region
+
+   Parameters:
+   vertical: Zero for latitude wise, one for longitude wise is stored
+   ipart: Index of partition in grid scale is stored
+   xs: Coordinates (x) to be split
+   ys: Coordinates (y) to be split
+   lon1: Lowest grid longitude of region
+   lat1: Lowest grid latitude of region
+   lon2: Highest grid longitude of region
+   lat2: Highest grid latitude of region
+*/
+void gridfile::getRegionPartition(int *vertical, int64_t * ipart,
+				  vector < int64_t > &xs,
+				  vector < int64_t > &ys, int64_t lon1,
+				  int64_t lat1, int64_t lon2, int64_t lat2)
+{
+	int direction = 0;
+	int64_t iter = 0;
+	int64_t piter = 0;
+	int64_t lower = 0;
+	int64_t partition = 0;
+	int64_t balance = 0;
+	int64_t centre = 0;
+	int64_t bbalance = -1;
+	int64_t bcentre = 0;
+	int64_t n = xs.size();
+	int64_t first = 0;
+	int64_t last = 0;
+	vector < int64_t > *cs = NULL;
+
+	for (direction = 0; direction < 2; direction++) {
+		first = direction ? lon1 : lat1;
+		last = direction ? lon2 : lat2;
+		cs = direction ? &xs : &ys;
+
+		for (piter = first; piter < last; piter++) {
+			partition = direction ? gridScale[2 + piter] :
+			    gridScale[2 + gridSize + piter];
+
+			lower = 0;
+			for (iter = 0; iter < n; iter++) {
+				if ((*cs)[iter] <= partition) {
+					lower++;
+				}
+			}
+
+			balance = llabs(2 * lower - n);
+			centre = llabs(2 * piter + 1 - first - last);
+
+			if (bbalance < 0 || balance < bbalance
+			    || (balance == bbalance && centre < bcentre)) {
+				bbalance = balance;
+				bcentre = centre;
+				*vertical = direction;
+				*ipart = piter;
+			}
+		}
+	}
+}
+
+/* Splits grid in one direction with new grid entries sharing buckets
+
+   Parameters:
+   vertical: Zero for latitude wise, one for longitude wise
+   partition: Value of partition to be inserted
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::splitGrid(int vertical, int64_t partition)
+{
+	int error = 0;
+	int64_t xint = gridScale[1];
+	int64_t yint = gridScale[1 + gridSize];
+	int64_t ipart = 0;
+	int64_t xiter = 0;
+	int64_t yiter = 0;
+	int64_t *cge = NULL;
+	int64_t *pge = NULL;
+
+	if ((vertical && xint == gridSize - 1)
+	    || (!vertical && yint == gridSize - 1)) {
+		error = growGrid();
+		if (error < 0) {
+			goto clean;
+		}
+	}
+
+	error = insertGridPartition(vertical, partition, &ipart);
+	if (error < 0) {
+		goto clean;
+	}
+
+	if (!vertical) {
+		for (xiter = 0; xiter <= xint; xiter++) {
+			for (yiter = yint + 1; yiter > ipart; yiter--) {
+				error = getGridEntry(xiter, yiter, &cge);
+				if (error < 0) {
+					goto clean;
+				}
+
+				error = getGridEntry(xiter, yiter - 1, &pge);
+				if (error < 0) {
+					goto clean;
+				}
+
+				memcpy(cge, pge, GENTRY * 8);
+			}
+		}
+	} else {
+		for (yiter = 0; yiter <= yint; yiter++) {
+			for (xiter = xint + 1; xiter > ipart; xiter--) {
+				error = getGridEntry(xiter, yiter, &cge);
+				if (error < 0) {
+					goto clean;
+				}
+
+				error = getGridEntry(xiter - 1, yiter, &pge);
+				if (error < 0) {
+					goto clean;
+				}
+
+				memcpy(cge, pge, GENTRY * 8);
+			}
+		}
+	}
+
+	/* Regions spanning or beyond split grid entry widen or shift */
+	xint = gridScale[1];
+	yint = gridScale[1 + gridSize];
+	for (xiter = 0; xiter <= xint; xiter++) {
+		for (yiter = 0; yiter <= yint; yiter++) {
+			getGridEntry(xiter, yiter, &cge);
+			if (cge[vertical ? 5 : 6] > ipart) {
+				cge[vertical ? 5 : 6] += 1;
+			}
+			if (cge[vertical ? 7 : 8] >= ipart) {
+				cge[vertical ? 7 : 8] += 1;
+			}
+		}
+	}
+
+	gridSplits += 1;
+
+ clean:
+	return error;
+}
+
+/* Fetches region of grid entries sharing bucket with given grid entry,
+   which always is a rectangle kept in grid entry
+
+   Parameters:
+   lon1: Lowest grid longitude of region is stored
+   lat1: Lowest grid latitude of region is stored
+   lon2: Highest grid longitude of region is stored
+   lat2: Highest grid latitude of region is stored
+   lon: Grid longitude of entry
+   lat: Grid latitude of entry
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::getBucketRegion(int64_t * lon1, int64_t * lat1, int64_t * lon2,
+			      int64_t * lat2, int64_t lon, int64_t lat)
+{
+	int error = 0;
+	int64_t *ge = NULL;
+
+	error = getGridEntry(lon, lat, &ge);
+	if (error < 0) {
+		goto clean;
+	}
+
+	*lon1 = ge[5];
+	*lat1 = ge[6];
+	*lon2 = ge[7];
+	*lat2 = ge[8];
+
+ clean:
+	return error;
+}
+
+/* Copies statistics, address and region of grid entry to all grid
+   entries sharing its bucket
+
+   Parameters:
+   lon: Grid longitude of entry
+   lat: Grid latitude of entry
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::updateBucketRegion(int64_t lon, int64_t lat)
+{
+	int error = 0;
+	int64_t lon1 = 0;
+	int64_t lat1 = 0;
+	int64_t lon2 = 0;
+	int64_t lat2 = 0;
+	int64_t xiter = 0;
+	int64_t yiter = 0;
+	int64_t *ge = NULL;
+	int64_t *cge = NULL;
+
+	error = getBucketRegion(&lon1, &lat1, &lon2, &lat2, lon, lat);
+	if (error < 0) {
+		goto clean;
+	}
+
+	getGridEntry(lon, lat, &ge);
+
+	for (xiter = lon1; xiter <= lon2; xiter++) {
+		for (yiter = lat1; yiter <= lat2; yiter++) {
+			getGridEntry(xiter, yiter, &cge);
+			if (cge != ge) {
+				memcpy(cge, ge, GENTRY * 8);
+			}
+		}
+	}
+
+ clean:
+	return error;
+}
+
+/* Fetches part of planned bucket split holding given coordinates
+
+   Parameters:
+   nsplits: Number of planned partitions
+   svertical: Direction of each planned partition
+   spartition: Value of each planned partition
+   supper: Side of each planned partition holding new record
+   x: Coordinate (x)
+   y: Coordinate (y)
+
+   Return:
+   Index of first partition separating coordinates from new record,
+   number of partitions if none does
+*/
+int gridfile::getSplitPart(int nsplits, int *svertical, int64_t * spartition,
+			   int *supper, int64_t x, int64_t y)
+{
+	int iter = 0;
+	int upper = 0;
+
+	for (iter = 0; iter < nsplits; iter++) {
+		upper = (svertical[iter] ? x : y) > spartition[iter];
+		if (upper != supper[iter]) {
+			break;
+		}
+	}
+
+	return iter;
+}
+
+/* Divides overflowing bucket so that new record fits. Bucket region is
+   first divided along partitions already in grid scale, then single grid
+   entry left is divided by new partitions chosen as per split policy,
+   each time continuing with part holding new record, until that part
+   fits new record. Partitions are then inserted in grid scale and bucket
+   entries distributed into one bucket per part in a single pass. Part kept
+   stays in extent of bucket, new parts get smallest extent holding their
+   entries.
+
+   Parameters:
+   lon: Grid longitude of new record
+   lat: Grid latitude of new record
+   x: Coordinate (x) of new record
+   y: Coordinate (y) of new record
+   rsize: Size of new record
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::splitBucket(int64_t lon, int64_t lat, int64_t x, int64_t y,
+			  int64_t rsize)
+{
+	int error = 0;
+	int nsplits = 0;
+	int vertical = 0;
+	int part = 0;
+	int svertical[MAXSPLITS];
+	int supper[MAXSPLITS];
+	int snew[MAXSPLITS];
+	int64_t spartition[MAXSPLITS];
+	int64_t saddr[MAXSPLITS + 1];
+	int64_t sbytes[MAXSPLITS + 1];
+	int64_t *sbucket[MAXSPLITS + 1];
+	int64_t sentry[MAXSPLITS + 1][GENTRY];
+	int64_t nxsplits = 0;
+	int64_t nysplits = 0;
+	int64_t lon1 = 0;
+	int64_t lat1 = 0;
+	int64_t lon2 = 0;
+	int64_t lat2 = 0;
+	int64_t ipart = 0;
+	int64_t baddr = 0;
+	int64_t border = 0;
+	int64_t capacity = 0;
+	int64_t nbytes = 0;
+	int64_t nrecords = 0;
+	int64_t iter = 0;
+	int64_t kiter = 0;
+	int64_t bx = 0;
+	int64_t by = 0;
+	int64_t esize = 0;
+	int64_t xiter = 0;
+	int64_t yiter = 0;
+	int64_t *ge = NULL;
+	int64_t *gb = NULL;
+	int64_t *be = NULL;
+	char *kept = NULL;
+	vector < int64_t > xs;
+	vector < int64_t > ys;
+	vector < int64_t > es;
+
+	error = getBucketRegion(&lon1, &lat1, &lon2, &lat2, lon, lat);
+	if (error < 0) {
+		goto clean;
+	}
+
+	getGridEntry(lon, lat, &ge);
+	baddr = ge[4];
+	border = ge[9];
+	capacity = getBucketCapacity(ge);
+
+	error = mapGridBucket(ge, &gb);
+	if (error < 0) {
+		goto clean;
+	}
+
+	xs.push_back(x);
+	ys.push_back(y);
+	es.push_back(headerSize + rsize);
+	nbytes = headerSize + rsize;
+
+	for (iter = 0; iter < gb[1]; iter++) {
+		error = getBucketEntry(&be, gb, iter);
+		if (error < 0) {
+			goto pclean;
+		}
+
+		getEntryCoordinates(&bx, &by, be);
+		xs.push_back(bx);
+		ys.push_back(by);
+		es.push_back(headerSize + getEntrySize(be));
+		nbytes += es.back();
+	}
+
+	/* Plan partitions, new record always staying first in part kept */
+	while (nbytes > capacity) {
+		if (nsplits == MAXSPLITS) {
+			error = -ENOMEM;
+			goto pclean;
+		}
+
+		if (lon2 > lon1 || lat2 > lat1) {
+			getRegionPartition(&vertical, &ipart, xs, ys, lon1, lat1,
+					   lon2, lat2);
+			spartition[nsplits] = vertical ? gridScale[2 + ipart] :
+			    gridScale[2 + gridSize + ipart];
+			snew[nsplits] = 0;
+		} else {
+			vertical = gridScale[1] + nxsplits ==
+			    gridScale[1 + gridSize] + nysplits ? 1 : 0;
+			error =
+			    getSplitPartition(&vertical, &spartition[nsplits],
+					      xs, ys);
+			if (error < 0) {
+				goto pclean;
+			}
+
+			snew[nsplits] = 1;
+			nxsplits += vertical;
+			nysplits += !vertical;
+		}
+
+		svertical[nsplits] = vertical;
+		supper[nsplits] = (vertical ? x : y) > spartition[nsplits];
+
+		if (!snew[nsplits] && vertical) {
+			if (supper[nsplits]) {
+				lon1 = ipart + 1;
+			} else {
+				lon2 = ipart;
+			}
+		} else if (!snew[nsplits]) {
+			if (supper[nsplits]) {
+				lat1 = ipart + 1;
+			} else {
+				lat2 = ipart;
+			}
+		}
+
+		nsplits++;
+
+		kiter = 0;
+		nbytes = 0;
+		for (iter = 0; iter < (int64_t) xs.size(); iter++) {
+			if (getSplitPart(nsplits, svertical, spartition, supper,
+					 xs[iter], ys[iter]) == nsplits) {
+				xs[kiter] = xs[iter];
+				ys[kiter] = ys[iter];
+				es[kiter] = es[iter];
+				nbytes += es[kiter];
+				kiter++;
+			}
+		}
+
+		xs.resize(kiter);
+		ys.resize(kiter);
+		es.resize(kiter);
+	}
+
+	for (part = 0; part < nsplits; part++) {
+		if (snew[part]) {
+			error = splitGrid(svertical[part], spartition[part]);
+			if (error < 0) {
+				goto pclean;
+			}
+		}
+	}
+
+	getGridLocation(&lon, &lat, x, y);
+
+	error = getBucketRegion(&lon1, &lat1, &lon2, &lat2, lon, lat);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	for (part = 0; part <= nsplits; part++) {
+		sbucket[part] = NULL;
+		sbytes[part] = 0;
+		memset(sentry[part], 0, GENTRY * 8);
+		sentry[part][5] = lon2;
+		sentry[part][6] = lat2;
+		sentry[part][7] = lon1;
+		sentry[part][8] = lat1;
+	}
+
+	saddr[nsplits] = baddr;
+	sbucket[nsplits] = gb;
+
+	be = gb + 2;
+	for (iter = 0; iter < gb[1]; iter++) {
+		getEntryCoordinates(&bx, &by, be);
+		esize = headerSize + getEntrySize(be);
+		part = getSplitPart(nsplits, svertical, spartition, supper, bx,
+				    by);
+		sbytes[part] += esize;
+		be = (int64_t *) ((char *)be + esize);
+	}
+
+	for (part = 0; part < nsplits; part++) {
+		sentry[part][9] = getExtentOrder(sbytes[part]);
+
+		error = allocateGridBucket(&saddr[part],
+					   getBucketPages(sentry[part]));
+		if (error < 0) {
+			goto uclean;
+		}
+
+		sentry[part][4] = saddr[part];
+		error = mapGridBucket(sentry[part], &sbucket[part]);
+		if (error < 0) {
+			goto uclean;
+		}
+
+		sbucket[part][0] = 0;
+		sbucket[part][1] = 0;
+		bucketSplits += 1;
+	}
+
+	/* Entries of part kept in bucket are compacted in place */
+	nrecords = gb[1];
+	kept = (char *)(gb + 2);
+	be = gb + 2;
+	gb[0] = 0;
+	gb[1] = 0;
+
+	for (iter = 0; iter < nrecords; iter++) {
+		getEntryCoordinates(&bx, &by, be);
+		esize = headerSize + getEntrySize(be);
+		part = getSplitPart(nsplits, svertical, spartition, supper, bx,
+				    by);
+
+		if (part == nsplits) {
+			memmove(kept, be, esize);
+			kept += esize;
+			gb[0] += esize;
+			gb[1] += 1;
+		} else {
+			appendBucketEntry(sbucket[part], bx, by,
+					  getEntrySize(be), getEntryRecord(be));
+		}
+
+		sentry[part][0] += esize;
+		sentry[part][1] += 1;
+		sentry[part][2] += bx;
+		sentry[part][3] += by;
+
+		be = (int64_t *) ((char *)be + esize);
+	}
+
+	sentry[nsplits][4] = baddr;
+	sentry[nsplits][9] = border;
+
+	/* Each part covers a rectangle of grid entries, found first */
+	for (iter = 0; iter < 2; iter++) {
+		for (xiter = lon1; xiter <= lon2; xiter++) {
+			for (yiter = lat1; yiter <= lat2; yiter++) {
+				bx = xiter < gridScale[1] ?
+				    gridScale[2 + xiter] : INT64_MAX;
+				by = yiter < gridScale[1 + gridSize] ?
+				    gridScale[2 + gridSize + yiter] :
+				    INT64_MAX;
+				part = getSplitPart(nsplits, svertical,
+						    spartition, supper, bx, by);
+
+				if (iter == 0) {
+					sentry[part][5] =
+					    min(sentry[part][5], xiter);
+					sentry[part][6] =
+					    min(sentry[part][6], yiter);
+					sentry[part][7] =
+					    max(sentry[part][7], xiter);
+					sentry[part][8] =
+					    max(sentry[part][8], yiter);
+				} else {
+					getGridEntry(xiter, yiter, &ge);
+					memcpy(ge, sentry[part], GENTRY * 8);
+				}
+			}
+		}
+	}
+
+ uclean:
+	for (part = 0; part < nsplits; part++) {
+		if (sbucket[part] != NULL) {
+			unmapGridBucket(sbucket[part]);
+		}
+	}
+
+ pclean:
+	unmapGridBucket(gb);
+
+ clean:
+	return error;
+}
+
+/* Copies bucket to pages at given address, which are free and span its
+   extent, and points grid entries of its region there
+
+   Parameters:
+   gentry: Grid entry of bucket, at lowest grid entry of its region
+   baddr: Address bucket is copied to
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::moveGridBucket(int64_t * gentry, int64_t baddr)
+{
+	int error = 0;
+	int64_t *gb = NULL;
+	int64_t *nb = NULL;
+	int64_t nentry[GENTRY];
+
+	memcpy(nentry, gentry, GENTRY * 8);
+	nentry[4] = baddr;
+
+	error = mapGridBucket(gentry, &gb);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = mapGridBucket(nentry, &nb);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	memcpy(nb, gb, 16 + gb[0]);
+	unmapGridBucket(nb);
+
+	gentry[4] = baddr;
+	error = updateBucketRegion(gentry[5], gentry[6]);
+
+ pclean:
+	unmapGridBucket(gb);
+
+ clean:
+	return error;
+}
+
+/* Doubles extent of bucket. Bucket at end of bucket file grows in place,
+   other buckets are copied to new extent at end of file, leaving pages of
+   old extent free until compaction fills them
+
+   Parameters:
+   lon: Grid longitude of bucket
+   lat: Grid latitude of bucket
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::growBucket(int64_t lon, int64_t lat)
+{
+	int error = 0;
+	int64_t baddr = 0;
+	int64_t npages = 0;
+	int64_t *ge = NULL;
+
+	error = getGridEntry(lon, lat, &ge);
+	if (error < 0) {
+		goto clean;
+	}
+
+	npages = getBucketPages(ge);
+	if (npages == bucketPages) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	if (ge[4] + npages == gridDirectory[0]) {
+		error = allocateGridBucket(&baddr, npages);
+		if (error < 0) {
+			goto clean;
+		}
+
+		ge[9] += 1;
+		error = updateBucketRegion(lon, lat);
+	} else {
+		error = allocateGridBucket(&baddr, 2 * npages);
+		if (error < 0) {
+			goto clean;
+		}
+
+		getGridEntry(ge[5], ge[6], &ge);
+		ge[9] += 1;
+		error = moveGridBucket(ge, baddr);
+	}
+
+	bucketGrowths += 1;
+
+ clean:
+	return error;
+}
+
+/* Tells whether full bucket is better grown than split: when records
+   sharing coordinates of new record take much of it, as splits never
+   separate them, or when bucket covers single grid entry and grid scale is
+   full, as split would grow the grid
+
+   Parameters:
+   lon: Grid longitude of new record
+   lat: Grid latitude of new record
+   x: Coordinate (x) of new record
+   y: Coordinate (y) of new record
+   rsize: Size of new record
+
+   Return:
+   Positive if bucket is better grown, zero if split, error on failure
+*/
+int gridfile::isBucketDense(int64_t lon, int64_t lat, int64_t x, int64_t y,
+			    int64_t rsize)
+{
+	int error = 0;
+	int64_t lon1 = 0;
+	int64_t lat1 = 0;
+	int64_t lon2 = 0;
+	int64_t lat2 = 0;
+	int64_t iter = 0;
+	int64_t bx = 0;
+	int64_t by = 0;
+	int64_t esize = 0;
+	int64_t nbytes = headerSize + rsize;
+	int64_t *ge = NULL;
+	int64_t *gb = NULL;
+	int64_t *be = NULL;
+
+	error = getGridEntry(lon, lat, &ge);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = mapGridBucket(ge, &gb);
+	if (error < 0) {
+		goto clean;
+	}
+
+	be = gb + 2;
+	for (iter = 0; iter < gb[1]; iter++) {
+		getEntryCoordinates(&bx, &by, be);
+		esize = headerSize + getEntrySize(be);
+		if (bx == x && by == y) {
+			nbytes += esize;
+		}
+
+		be = (int64_t *) ((char *)be + esize);
+	}
+
+	unmapGridBucket(gb);
+
+	if (2 * nbytes > getBucketCapacity(ge)) {
+		error = 1;
+		goto clean;
+	}
+
+	error = getBucketRegion(&lon1, &lat1, &lon2, &lat2, lon, lat);
+	if (error < 0) {
+		goto clean;
+	}
+
+	if (lon1 == lon2 && lat1 == lat2
+	    && (gridScale[1] == gridSize - 1
+		|| gridScale[1 + gridSize] == gridSize - 1)) {
+		error = 1;
+	}
+
+ clean:
+	return error;
+}
+
+/* Makes room for new record in full bucket, growing bucket if it is dense
+   or cannot be split and splitting it otherwise
+
+   Parameters:
+   lon: Grid longitude of new record
+   lat: Grid latitude of new record
+   x: Coordinate (x) of new record
+   y: Coordinate (y) of new record
+   rsize: Size of new record
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::makeBucketRoom(int64_t lon, int64_t lat, int64_t x, int64_t y,
+			     int64_t rsize)
+{
+	int error = 0;
+	int64_t *ge = NULL;
+
+	error = getGridEntry(lon, lat, &ge);
+	if (error < 0) {
+		goto clean;
+	}
+
+	if (getBucketPages(ge) < bucketPages) {
+		error = isBucketDense(lon, lat, x, y, rsize);
+		if (error < 0) {
+			goto clean;
+		}
+
+		if (error > 0) {
+			error = growBucket(lon, lat);
+			goto clean;
+		}
+	}
+
+	error = splitBucket(lon, lat, x, y, rsize);
+	if (error == -ENOMEM) {
+		getGridLocation(&lon, &lat, x, y);
+		if (growBucket(lon, lat) == 0) {
+			error = 0;
+		}
+	}
+
+ clean:
+	return error;
+}
+
+/* Collects distinct buckets intersecting region of grid entries, walking
+   from bucket to bucket by their regions. Bucket is reached from the bucket
+   holding grid entry left of its lowest grid entry within region, or from
+   the bucket below for buckets starting at lowest grid longitude of region,
+   so each bucket is collected once without visiting every grid entry.
+
+   Parameters:
+   gentries: Grid entry of each bucket is appended
+   lon1: Lowest grid longitude of region
+   lat1: Lowest grid latitude of region
+   lon2: Highest grid longitude of region
+   lat2: Highest grid latitude of region
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::getRangeBuckets(vector < int64_t * >&gentries, int64_t lon1,
+			      int64_t lat1, int64_t lon2, int64_t lat2)
+{
+	int error = 0;
+	int64_t rlon1 = 0;
+	int64_t rlat1 = 0;
+	int64_t rlon2 = 0;
+	int64_t rlat2 = 0;
+	int64_t yiter = 0;
+	int64_t *ge = NULL;
+	int64_t *nge = NULL;
+	vector < int64_t > pending;
+
+	pending.push_back(lon1);
+	pending.push_back(lat1);
+
+	while (!pending.empty()) {
+		yiter = pending.back();
+		pending.pop_back();
+		error = getGridEntry(pending.back(), yiter, &ge);
+		pending.pop_back();
+		if (error < 0) {
+			goto clean;
+		}
+
+		gentries.push_back(ge);
+
+		rlon1 = max(ge[5], lon1);
+		rlat1 = max(ge[6], lat1);
+		rlon2 = min(ge[7], lon2);
+		rlat2 = min(ge[8], lat2);
+
+		if (rlon1 == lon1 && rlat2 < lat2) {
+			pending.push_back(lon1);
+			pending.push_back(rlat2 + 1);
+		}
+
+		if (rlon2 == lon2) {
+			continue;
+		}
+
+		for (yiter = rlat1; yiter <= rlat2; yiter = nge[8] + 1) {
+			error = getGridEntry(rlon2 + 1, yiter, &nge);
+			if (error < 0) {
+				goto clean;
+			}
+
+			if (max(nge[6], lat1) == yiter) {
+				pending.push_back(rlon2 + 1);
+				pending.push_back(yiter);
+			}
+		}
+	}
+
+ clean:
+	return error;
+}
+
+/* Orders buckets by their grid entries along Z-order curve
+
+   Parameters:
+   lon: Grid longitude of lowest grid entry of bucket region
+   lat: Grid latitude of lowest grid entry of bucket region
+
+   Return:
+   Position of grid entry along curve, bits of longitude and latitude
+   interleaved
+*/
+uint64_t gridfile::getBucketOrder(int64_t lon, int64_t lat)
+{
+	int bit = 0;
+	uint64_t order = 0;
+
+	for (bit = 0; bit < 32; bit++) {
+		order |= ((uint64_t) (lon >> bit) & 1) << (2 * bit + 1);
+		order |= ((uint64_t) (lat >> bit) & 1) << (2 * bit);
+	}
+
+	return order;
+}
+
+/* Relocates buckets in bucket file into Z-order of their regions, so that
+   buckets of neighbouring regions lie close together and range retrieval
+   reads mostly contiguous pages. Each move swaps a bucket into its place in
+   order with the bucket of same extent occupying it, buckets otherwise
+   overlapping its place being moved to end of file first, so relocation
+   may be spread over several calls.
+
+   Parameters:
+   budget: Highest number of buckets to be moved, negative for no limit
+   nmoved: Number of buckets moved is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::relocateBuckets(int64_t budget, int64_t * nmoved)
+{
+	gridwriter writer(this);
+	gridaccess access(this, true);
+	int error = 0;
+	int64_t iter = 0;
+	int64_t piter = 0;
+	int64_t eiter = 0;
+	int64_t baddr = 0;
+	int64_t taddr = 0;
+	int64_t naddr = 0;
+	int64_t npages = 0;
+	int64_t *ge = NULL;
+	int64_t *oge = NULL;
+	int64_t *gb = NULL;
+	int64_t *ob = NULL;
+	int64_t *page = NULL;
+	vector < int64_t * >gentries;
+	vector < int64_t * >owners(gridDirectory[0], NULL);
+	vector < int64_t * >evicted;
+	vector < pair < uint64_t, int64_t * > >order;
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	*nmoved = 0;
+
+	error = getRangeBuckets(gentries, 0, 0, gridScale[1],
+				gridScale[1 + gridSize]);
+	if (error < 0) {
+		goto clean;
+	}
+
+	for (iter = 0; iter < (int64_t) gentries.size(); iter++) {
+		ge = gentries[iter];
+		for (piter = 0; piter < getBucketPages(ge); piter++) {
+			owners[ge[4] + piter] = ge;
+		}
+		order.push_back(make_pair(getBucketOrder(ge[5], ge[6]), ge));
+	}
+
+	sort(order.begin(), order.end());
+
+	page = (int64_t *) malloc(bucketPages * pageSize);
+	if (page == NULL) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	for (iter = 0; iter < (int64_t) order.size() && *nmoved != budget;
+	     iter++, taddr += npages) {
+		ge = order[iter].second;
+		baddr = ge[4];
+		npages = getBucketPages(ge);
+		if (baddr == taddr) {
+			continue;
+		}
+
+		oge = owners[taddr];
+
+		if (oge != NULL && oge[4] == taddr
+		    && getBucketPages(oge) == npages) {
+			error = mapGridBucket(ge, &gb);
+			if (error < 0) {
+				goto pclean;
+			}
+
+			error = mapGridBucket(oge, &ob);
+			if (error < 0) {
+				unmapGridBucket(gb);
+				goto pclean;
+			}
+
+			memcpy(page, gb, 16 + gb[0]);
+			memcpy(gb, ob, 16 + ob[0]);
+			memcpy(ob, page, 16 + page[0]);
+
+			unmapGridBucket(ob);
+			unmapGridBucket(gb);
+
+			ge[4] = taddr;
+			oge[4] = baddr;
+			for (piter = 0; piter < npages; piter++) {
+				owners[taddr + piter] = ge;
+				owners[baddr + piter] = oge;
+			}
+
+			updateBucketRegion(ge[5], ge[6]);
+			updateBucketRegion(oge[5], oge[6]);
+
+			*nmoved += 1;
+			continue;
+		}
+
+		evicted.clear();
+		for (piter = taddr; piter < taddr + npages; piter++) {
+			if (owners[piter] != NULL
+			    && find(evicted.begin(), evicted.end(),
+				    owners[piter]) == evicted.end()) {
+				evicted.push_back(owners[piter]);
+			}
+		}
+
+		if (budget >= 0 && *nmoved + (int64_t) evicted.size() >= budget) {
+			break;
+		}
+
+		/* Bucket itself is moved last, into place emptied */
+		evicted.push_back(ge);
+		for (eiter = 0; eiter < (int64_t) evicted.size(); eiter++) {
+			oge = evicted[eiter];
+			naddr = taddr;
+
+			if (eiter + 1 < (int64_t) evicted.size()) {
+				error = allocateGridBucket(&naddr,
+							   getBucketPages(oge));
+				if (error < 0) {
+					goto pclean;
+				}
+
+				owners.resize(gridDirectory[0], NULL);
+			}
+
+			for (piter = 0; piter < getBucketPages(oge); piter++) {
+				owners[oge[4] + piter] = NULL;
+			}
+
+			error = moveGridBucket(oge, naddr);
+			if (error < 0) {
+				goto pclean;
+			}
+
+			for (piter = 0; piter < getBucketPages(oge); piter++) {
+				owners[naddr + piter] = oge;
+			}
+
+			*nmoved += 1;
+		}
+	}
+
+	/* Pages past last bucket, freed by moves, are given back */
+	while (gridDirectory[0] > 0 && owners[gridDirectory[0] - 1] == NULL) {
+		gridDirectory[0]--;
+	}
+
+ pclean:
+	free(page);
+
+ clean:
+	if (error == 0) {
+		error = logChange(LOG_RELOCATE, budget, 0, 0, 0, NULL, 0);
+	}
+
+	return error;
+}
+
+/* Fetches buckets to be merged with given bucket, being all buckets of
+   smallest region covering bucket and its right or upper neighbour, if
+   none of them reaches out of that region and merged bucket stays at most
+   half full
+
+   Parameters:
+   mgentries: Grid entries of buckets of region, given bucket included, are
+   stored, none if no region qualifies
+   gentry: Grid entry of bucket
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::getMergeBuckets(vector < int64_t * >&mgentries,
+			      int64_t * gentry)
+{
+	int error = 0;
+	int side = 0;
+	int64_t lon1 = 0;
+	int64_t lat1 = 0;
+	int64_t lon2 = 0;
+	int64_t lat2 = 0;
+	int64_t nbytes = 0;
+	int64_t iter = 0;
+	int64_t *nge = NULL;
+
+	for (side = 0; side < 2; side++) {
+		mgentries.clear();
+
+		if (side == 0 && gentry[7] < gridScale[1]) {
+			error = getGridEntry(gentry[7] + 1, gentry[6], &nge);
+		} else if (side == 1 && gentry[8] < gridScale[1 + gridSize]) {
+			error = getGridEntry(gentry[5], gentry[8] + 1, &nge);
+		} else {
+			continue;
+		}
+
+		if (error < 0) {
+			goto clean;
+		}
+
+		lon1 = min(gentry[5], nge[5]);
+		lat1 = min(gentry[6], nge[6]);
+		lon2 = max(gentry[7], nge[7]);
+		lat2 = max(gentry[8], nge[8]);
+
+		error = getRangeBuckets(mgentries, lon1, lat1, lon2, lat2);
+		if (error < 0) {
+			goto clean;
+		}
+
+		nbytes = 0;
+		for (iter = 0; iter < (int64_t) mgentries.size(); iter++) {
+			nge = mgentries[iter];
+			if (nge[5] < lon1 || nge[6] < lat1 || nge[7] > lon2
+			    || nge[8] > lat2) {
+				break;
+			}
+
+			nbytes += nge[0];
+		}
+
+		if (iter == (int64_t) mgentries.size()
+		    && 2 * nbytes <= getBucketCapacity(gentry)) {
+			goto clean;
+		}
+	}
+
+	mgentries.clear();
+
+ clean:
+	return error;
+}
+
+/* Compacts bucket file. Sparse buckets absorb a neighbouring bucket whose
+   region completes theirs to a rectangle, then buckets at end of bucket
+   file are moved into first pages freed holding their extent, so that
+   buckets keep occupying first pages of file, and file is truncated as far
+   as moves got. Merges and moves together are limited by budget.
+
+   Parameters:
+   budget: Highest number of buckets to be merged or moved, negative for no
+   limit
+   nmoved: Number of buckets merged or moved is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::compactBuckets(int64_t budget, int64_t * nmoved)
+{
+	gridwriter writer(this);
+	gridaccess access(this, true);
+	int error = 0;
+	int status = 0;
+	int64_t nmerged = 0;
+	int64_t nbuckets = gridDirectory[0];
+	int64_t nsize = bucketSize;
+	int64_t npages = 0;
+	int64_t iter = 0;
+	int64_t miter = 0;
+	int64_t *ge = NULL;
+	int64_t *nge = NULL;
+	int64_t *gb = NULL;
+	int64_t *nb = NULL;
+	vector < int64_t * >gentries;
+	vector < int64_t * >mgentries;
+	vector < int64_t * >mbuckets;
+	vector < int64_t * >owners(nbuckets, NULL);
+	vector < pair < int64_t, int64_t > >holes;
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	*nmoved = 0;
+
+	error = getRangeBuckets(gentries, 0, 0, gridScale[1],
+				gridScale[1 + gridSize]);
+	if (error < 0) {
+		goto clean;
+	}
+
+	for (iter = 0; iter < (int64_t) gentries.size(); iter++) {
+		owners[gentries[iter][4]] = gentries[iter];
+	}
+
+	for (iter = 0; iter < (int64_t) gentries.size()
+	     && (budget < 0 || nmerged < budget); iter++) {
+		ge = gentries[iter];
+		if (owners[ge[4]] != ge) {
+			continue;
+		}
+
+		error = getMergeBuckets(mgentries, ge);
+		if (error < 0) {
+			goto fill;
+		}
+
+		if (mgentries.empty()) {
+			continue;
+		}
+
+		error = mapGridBucket(ge, &gb);
+		if (error < 0) {
+			goto fill;
+		}
+
+		/* Buckets are all mapped before any of them is changed */
+		mbuckets.assign(mgentries.size(), NULL);
+		for (miter = 0; miter < (int64_t) mgentries.size(); miter++) {
+			if (mgentries[miter][4] != ge[4]) {
+				error = mapGridBucket(mgentries[miter],
+						      &mbuckets[miter]);
+				if (error < 0) {
+					mbuckets[miter] = NULL;
+					break;
+				}
+			}
+		}
+
+		for (miter = 0; miter < (int64_t) mgentries.size(); miter++) {
+			nge = mgentries[miter];
+			nb = mbuckets[miter];
+			if (nb == NULL || error < 0) {
+				continue;
+			}
+
+			memcpy((char *)(gb + 2) + gb[0], nb + 2, nb[0]);
+			gb[0] += nb[0];
+			gb[1] += nb[1];
+
+			owners[nge[4]] = NULL;
+
+			ge[0] += nge[0];
+			ge[1] += nge[1];
+			ge[2] += nge[2];
+			ge[3] += nge[3];
+			ge[5] = min(ge[5], nge[5]);
+			ge[6] = min(ge[6], nge[6]);
+			ge[7] = max(ge[7], nge[7]);
+			ge[8] = max(ge[8], nge[8]);
+
+			nmerged += 1;
+			bucketMerges += 1;
+		}
+
+		for (miter = 0; miter < (int64_t) mbuckets.size(); miter++) {
+			if (mbuckets[miter] != NULL) {
+				unmapGridBucket(mbuckets[miter]);
+			}
+		}
+
+		unmapGridBucket(gb);
+
+		if (error < 0) {
+			goto fill;
+		}
+
+		/* Region of merged bucket is written from its lowest corner */
+		getGridEntry(ge[5], ge[6], &nge);
+		if (nge != ge) {
+			memcpy(nge, ge, GENTRY * 8);
+			owners[ge[4]] = nge;
+		}
+
+		updateBucketRegion(ge[5], ge[6]);
+	}
+
+ fill:
+	/* Pages left free by merged or grown buckets lie between buckets */
+	gentries.clear();
+	status = getRangeBuckets(gentries, 0, 0, gridScale[1],
+				 gridScale[1 + gridSize]);
+	if (status < 0) {
+		error = error ? error : status;
+		goto clean;
+	}
+
+	sort(gentries.begin(), gentries.end(), isBucketBefore);
+
+	nbuckets = 0;
+	for (iter = 0; iter < (int64_t) gentries.size(); iter++) {
+		ge = gentries[iter];
+		if (ge[4] > nbuckets) {
+			holes.push_back(make_pair(nbuckets, ge[4] - nbuckets));
+		}
+
+		nbuckets = ge[4] + getBucketPages(ge);
+	}
+
+	/* Last bucket moves into first free pages before it holding it */
+	nbuckets = 0;
+	while (!gentries.empty()
+	       && (budget < 0 || nmerged + *nmoved < budget)) {
+		ge = gentries.back();
+		npages = getBucketPages(ge);
+
+		for (iter = 0; iter < (int64_t) holes.size(); iter++) {
+			if (holes[iter].first < ge[4]
+			    && holes[iter].second >= npages) {
+				break;
+			}
+		}
+
+		if (iter == (int64_t) holes.size()
+		    || moveGridBucket(ge, holes[iter].first) < 0) {
+			break;
+		}
+
+		nbuckets = max(nbuckets, holes[iter].first + npages);
+		holes[iter].first += npages;
+		holes[iter].second -= npages;
+		gentries.pop_back();
+
+		*nmoved += 1;
+	}
+
+	if (!gentries.empty()) {
+		ge = gentries.back();
+		nbuckets = max(nbuckets, ge[4] + getBucketPages(ge));
+	}
+
+	gridDirectory[0] = nbuckets;
+	*nmoved += nmerged;
+
+	while (nsize / 2 >= max(nbuckets, (int64_t) 1) * pageSize) {
+		nsize /= 2;
+	}
+
+	if (nsize < bucketSize) {
+		if (truncate(bucketName.c_str(), nsize) == -1) {
+			if (error == 0) {
+				error = -errno;
+			}
+			goto clean;
+		}
+
+		bucketSize = nsize;
+	}
+
+ clean:
+	if (error == 0) {
+		error = logChange(LOG_COMPACT, budget, 0, 0, 0, NULL, 0);
+	}
+
+	return error;
+}
+
+/* Runs compaction and relocation of buckets periodically until stopped
+
+   Parameters:
+   budget: Highest number of buckets to be moved in each period
+   period: Length of period in milliseconds
+*/
+void gridfile::runCompactor(int64_t budget, int64_t period)
+{
+	int64_t nmoved = 0;
+	int64_t nleft = 0;
+	int64_t nrelocated = 0;
+	unique_lock < mutex > wait(compactorLock);
+
+	while (!compactorSignal.wait_for(wait, chrono::milliseconds(period),
+					 [this] { return compactorStop; })) {
+		if (compactBuckets(budget, &nmoved) < 0) {
+			continue;
+		}
+
+		/* Relocation takes what compaction left of budget, if any */
+		nleft = max(budget - nmoved, (int64_t) 0);
+		if (nleft > 0) {
+			relocateBuckets(nleft, &nrelocated);
+		}
+	}
+}
+
+/* Starts background thread compacting and relocating buckets of grid,
+   throttled to given number of bucket moves per period. Thread runs until
+   stopCompactor or unloadGrid is called.
+
+   Parameters:
+   budget: Highest number of buckets to be moved in each period
+   period: Length of period in milliseconds
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::startCompactor(int64_t budget, int64_t period)
+{
+	int error = 0;
+
+	if (budget <= 0 || period <= 0) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	if (compactor.joinable()) {
+		error = -EBUSY;
+		goto clean;
+	}
+
+	compactorStop = false;
+	compactor = thread(&gridfile::runCompactor, this, budget, period);
+
+ clean:
+	return error;
+}
+
+/* Stops background thread compacting buckets, if running
+*/
+void gridfile::stopCompactor()
+{
+	if (!compactor.joinable()) {
+		return;
+	}
+
+	compactorLock.lock();
+	compactorStop = true;
+	compactorLock.unlock();
+	compactorSignal.notify_all();
+
+	compactor.join();
+}
+
+/* Reads ahead buckets needed by request, before executor thread processes
+   requests taken before it
+
+   Parameters:
+   request: Request to be served
+*/
+void gridfile::prefetchRequest(struct gridrequest *request)
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+	gridaccess access(this, false, true);
+	int64_t lon1 = 0;
+	int64_t lat1 = 0;
+	int64_t lon2 = 0;
+	int64_t lat2 = 0;
+	int64_t iter = 0;
+	int64_t *ge = NULL;
+	vector < int64_t * >gentries;
+
+	if (access.error < 0) {
+		return;
+	}
+
+	getGridLocation(&lon1, &lat1, request->x1, request->y1);
+
+	if (request->type != REQUEST_RANGE) {
+		if (getGridEntry(lon1, lat1, &ge) == 0) {
+			prefetchBucket(ge);
+		}
+		return;
+	}
+
+	getGridLocation(&lon2, &lat2, request->x2, request->y2);
+
+	if (getRangeBuckets(gentries, lon1, lat1, lon2, lat2) < 0) {
+		return;
+	}
+
+	sort(gentries.begin(), gentries.end(), isBucketBefore);
+
+	for (iter = 0; iter < (int64_t) gentries.size() && iter < PREFETCH;
+	     iter++) {
+		prefetchBucket(gentries[iter]);
+	}
+}
+
+/* Serves request by calling matching synchronous operation
+
+   Parameters:
+   request: Request to be served
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::executeRequest(struct gridrequest *request)
+{
+	int error = 0;
+
+	switch (request->type) {
+	case REQUEST_FIND:
+		error = findRecord(request->x1, request->y1, request->records);
+		break;
+	case REQUEST_RANGE:
+		error = findRangeRecords(request->x1, request->y1, request->x2,
+					 request->y2, request->dsize,
+					 request->records);
+		break;
+	case REQUEST_INSERT:
+		error = insertRecord(request->x1, request->y1, request->record,
+				     request->rsize);
+		break;
+	default:
+		error = -EINVAL;
+	}
+
+	return error;
+}
+
+/* Serves queued requests until stopped and queue is drained. Requests are
+   taken in batches, buckets of the whole batch being read ahead before
+   first request is served, so that a single thread keeps many bucket reads
+   in flight.
+*/
+void gridfile::runExecutor()
+{
+	int64_t iter = 0;
+	vector < struct gridrequest >batch;
+	unique_lock < mutex > wait(executorLock);
+
+	while (true) {
+		executorSignal.wait(wait, [this] {
+			return executorStop || !requests.empty();
+		});
+
+		if (requests.empty()) {
+			break;
+		}
+
+		batch.clear();
+		while (!requests.empty() && batch.size() < MAXBATCH) {
+			batch.push_back(move(requests.front()));
+			requests.pop_front();
+		}
+
+		wait.unlock();
+
+		for (iter = 0; iter < (int64_t) batch.size(); iter++) {
+			prefetchRequest(&batch[iter]);
+		}
+
+		for (iter = 0; iter < (int64_t) batch.size(); iter++) {
+			batch[iter].done.set_value(executeRequest(&batch[iter]));
+		}
+
+		wait.lock();
+	}
+}
+
+/* Queues request for executor thread, starting thread if not running
+
+   Parameters:
+   request: Request to be served, moved into queue
+
+   Return:
+   Future holding result of request
+*/
+future < int > gridfile::submitRequest(struct gridrequest *request)
+{
+	future < int > done = request->done.get_future();
+	lock_guard < mutex > guard(executorLock);
+
+	if (!executor.joinable()) {
+		executorStop = false;
+		executor = thread(&gridfile::runExecutor, this);
+	}
+
+	requests.push_back(move(*request));
+	executorSignal.notify_one();
+
+	return done;
+}
+
+/* Stops executor thread, if running, once requests queued are served
+*/
+void gridfile::stopExecutor()
+{
+	if (!executor.joinable()) {
+		return;
+	}
+
+	executorLock.lock();
+	executorStop = true;
+	executorLock.unlock();
+	executorSignal.notify_all();
+
+	executor.join();
+}
+
+/* Appends change to change log, if logging. Changes made by operations
+   within operation are covered by entry of outermost one
+
+   Parameters:
+   type: Type of change
+   x: Coordinate (x) of changed record, budget of relocation or compaction
+   y: Coordinate (y) of changed record
+   nx: New coordinate (x) of moved record
+   ny: New coordinate (y) of moved record
+   record: Buffer holding record data
+   rsize: Size of record data
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::logChange(int64_t type, int64_t x, int64_t y, int64_t nx,
+			int64_t ny, void *record, int64_t rsize)
+{
+	int error = 0;
+	int64_t nwritten = 0;
+	ssize_t nbytes = 0;
+	struct timespec ts;
+	struct gridlogentry *entry = NULL;
+	vector < char >buffer(sizeof(struct gridlogentry) + rsize);
+
+	if (logFd < 0 || accessDepth > 1) {
+		goto clean;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	entry = (struct gridlogentry *)buffer.data();
+	entry->lsn = logLsn + 1;
+	entry->type = type;
+	entry->time = ts.tv_sec * 1000000000 + ts.tv_nsec;
+	entry->x = x;
+	entry->y = y;
+	entry->nx = nx;
+	entry->ny = ny;
+	entry->size = rsize;
+	if (rsize > 0) {
+		memcpy(entry + 1, record, rsize);
+	}
+
+	/* Entry is appended in one write, readers taking only whole entries */
+	while (nwritten < (int64_t) buffer.size()) {
+		nbytes = write(logFd, buffer.data() + nwritten,
+			       buffer.size() - nwritten);
+		if (nbytes < 0 && errno == EINTR) {
+			continue;
+		}
+		if (nbytes < 0) {
+			error = -errno;
+			goto clean;
+		}
+		nwritten += nbytes;
+	}
+
+	logLsn += 1;
+
+ clean:
+	return error;
+}
+
+/* Starts appending changes of grid to change log, continuing sequence of
+   entries already in log. Followers replay log from empty grid, so new log
+   is only started for grid holding no changes yet
+
+   Parameters:
+   path: Path of change log
+
+   Return:
+   Zero on success, error on failure or if grid holds changes missing from
+   new log
+*/
+int gridfile::startLog(string path)
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+	gridaccess access(this, false);
+	int error = 0;
+	int fd = -1;
+	int64_t offset = 0;
+	int64_t *ge = NULL;
+	struct gridlogentry entry;
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	if (logFd >= 0) {
+		error = -EBUSY;
+		goto clean;
+	}
+
+	fd = open(path.c_str(), O_RDONLY | O_CREAT, 0644);
+	if (fd == -1) {
+		error = -errno;
+		goto clean;
+	}
+
+	logLsn = 0;
+	while (pread(fd, &entry, sizeof(entry), offset) ==
+	       (ssize_t) sizeof(entry)) {
+		logLsn = entry.lsn;
+		offset += sizeof(entry) + entry.size;
+	}
+
+	close(fd);
+
+	/* Grid created empty has one bucket and no partitions */
+	if (logLsn == 0) {
+		error = getGridEntry(0, 0, &ge);
+		if (error == 0 && (gridDirectory[0] != 1 || gridScale[1] != 0
+				   || gridScale[1 + gridSize] != 0
+				   || ge[1] != 0)) {
+			error = -ENOTEMPTY;
+		}
+		if (error < 0) {
+			goto clean;
+		}
+	}
+
+	logFd = open(path.c_str(), O_WRONLY | O_APPEND);
+	if (logFd == -1) {
+		error = -errno;
+	}
+
+ clean:
+	return error;
+}
+
+/* Stops appending changes of grid to change log
+*/
+void gridfile::stopLog()
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+
+	if (logFd >= 0) {
+		close(logFd);
+		logFd = -1;
+	}
+}
+
+/* Fetches changes buffered in memtable for given coordinates: first record
+   inserted, if any, and number of records deleted from buckets. Record
+   stays in place while grid is held, as only flushes and deletes, which
+   hold grid, remove records from memtable
+
+   Parameters:
+   x: Coordinate (x) of record
+   y: Coordinate (y) of record
+   record: First buffered record is stored, NULL if none
+   deletes: Number of records deleted from buckets is stored
+
+   Return:
+   Zero on success, error if no change is buffered for coordinates
+*/
+int gridfile::findBufferedRecord(int64_t x, int64_t y, string ** record,
+				 int64_t * deletes)
+{
+	lock_guard < mutex > guard(memLock);
+	map < pair < int64_t, int64_t >, struct gridmementry >::iterator iter;
+
+	*record = NULL;
+	*deletes = 0;
+
+	iter = memTable.find(make_pair(x, y));
+	if (iter == memTable.end()) {
+		return -ENOENT;
+	}
+
+	if (!iter->second.records.empty()) {
+		*record = &iter->second.records.front();
+	}
+	*deletes = iter->second.deletes;
+
+	return 0;
+}
+
+/* Copies changes buffered in memtable for coordinates within range. Grid
+   is held by caller, so that no flush applies them meanwhile and copies
+   match buckets read under same hold
+
+   Parameters:
+   buffered: Changes buffered for coordinates within range are appended
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   nbytes: Number of bytes buffered records take in output is stored
+*/
+void gridfile::collectBufferedChanges(vector < struct gridmementry >&buffered,
+				      int64_t x1, int64_t y1, int64_t x2,
+				      int64_t y2, int64_t * nbytes)
+{
+	lock_guard < mutex > guard(memLock);
+	int64_t riter = 0;
+	map < pair < int64_t, int64_t >, struct gridmementry >::iterator iter;
+
+	*nbytes = 0;
+
+	for (iter = memTable.lower_bound(make_pair(x1, y1));
+	     iter != memTable.end() && iter->first.first <= x2; iter++) {
+		if (iter->first.second < y1 || iter->first.second > y2) {
+			continue;
+		}
+
+		buffered.push_back(iter->second);
+		for (riter = 0; riter < (int64_t) iter->second.records.size();
+		     riter++) {
+			*nbytes += 24 + iter->second.records[riter].size();
+		}
+	}
+}
+
+/* Merges changes buffered in memtable into entries retrieved from buckets.
+   Entries of records deleted in memtable are dropped, oldest of their
+   coordinates first as eraseRecord takes them, and buffered records are
+   appended
+
+   Parameters:
+   buffered: Changes buffered for coordinates within range
+   shape: Shape buffered records must lie in, NULL for whole range
+   start: Position of first retrieved entry in buffer
+   rrecords: Position in buffer past retrieved entries, moved to end of
+   merged entries
+   nr: Number of entries in buffer is updated
+   dsize: Number of bytes written in buffer is updated
+*/
+void gridfile::mergeBufferedChanges(vector < struct gridmementry >&buffered,
+				    struct gridshape *shape, char *start,
+				    char **rrecords, int64_t * nr,
+				    int64_t * dsize)
+{
+	int64_t iter = 0;
+	int64_t riter = 0;
+	int64_t esize = 0;
+	int64_t *entry = NULL;
+	char *be = start;
+	char *ne = start;
+	string *record = NULL;
+	struct gridmementry *me = NULL;
+	map < pair < int64_t, int64_t >, int64_t >deletes;
+	map < pair < int64_t, int64_t >, int64_t >::iterator diter;
+
+	for (iter = 0; iter < (int64_t) buffered.size(); iter++) {
+		me = &buffered[iter];
+		if (me->deletes > 0) {
+			deletes[make_pair(me->x, me->y)] = me->deletes;
+		}
+	}
+
+	/* Entries kept are moved down over those dropped */
+	if (!deletes.empty()) {
+		while (be < *rrecords) {
+			entry = (int64_t *) be;
+			esize = 24 + entry[2];
+			diter = deletes.find(make_pair(entry[0], entry[1]));
+			if (diter != deletes.end() && diter->second > 0) {
+				diter->second -= 1;
+				*nr -= 1;
+				*dsize -= esize;
+			} else {
+				memmove(ne, be, esize);
+				ne += esize;
+			}
+			be += esize;
+		}
+
+		*rrecords = ne;
+	}
+
+	for (iter = 0; iter < (int64_t) buffered.size(); iter++) {
+		me = &buffered[iter];
+		if (shape != NULL && !isShapePoint(shape, me->x, me->y)) {
+			continue;
+		}
+
+		for (riter = 0; riter < (int64_t) me->records.size(); riter++) {
+			record = &me->records[riter];
+			entry = (int64_t *) * rrecords;
+			entry[0] = me->x;
+			entry[1] = me->y;
+			entry[2] = record->size();
+			memcpy(entry + 3, record->data(), record->size());
+
+			*rrecords += 24 + record->size();
+			*dsize += 24 + record->size();
+			*nr += 1;
+		}
+	}
+}
+
+/* Buffers new record in memtable, waiting while memtable is full, or
+   stores it in buckets right away if memtable is not started. Buffered
+   records are neither logged nor seen by other processes until flushed
+
+   Parameters:
+   x: Coordinate (x) of new record
+   y: Coordinate (y) of new record
+   record: Buffer holding record data
+   rsize: Size of new record
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::bufferInsert(int64_t x, int64_t y, void *record, int64_t rsize)
+{
+	int error = 0;
+	struct gridmementry *me = NULL;
+	unique_lock < mutex > wait(memLock);
+
+	memSignal.wait(wait, [this] {
+		       return memLimit == 0 || memBytes < memLimit;
+		       });
+
+	if (memLimit == 0) {
+		wait.unlock();
+		return storeRecord(x, y, record, rsize);
+	}
+
+	error = checkRecord(x, y, rsize);
+	if (error < 0) {
+		goto clean;
+	}
+
+	me = &memTable[make_pair(x, y)];
+	me->x = x;
+	me->y = y;
+	me->records.push_back(string((char *)record, rsize));
+
+	memBytes += headerSize + rsize;
+	if (memBytes >= memLimit / 2) {
+		memSignal.notify_all();
+	}
+
+ clean:
+	return error;
+}
+
+/* Buffers delete of record in memtable, counting record of buckets to be
+   deleted if any is left and dropping first buffered record for given
+   coordinates otherwise, so that records go in same order as eraseRecord
+   takes them
+
+   Parameters:
+   x: Coordinate (x) of record to be deleted
+   y: Coordinate (y) of record to be deleted
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::bufferDelete(int64_t x, int64_t y)
+{
+	gridwriter writer(this);
+	gridaccess access(this, false, true);
+	int error = 0;
+	int64_t lon = 0;
+	int64_t lat = 0;
+	int64_t *ge = NULL;
+	int64_t *gb = NULL;
+	int64_t *be = NULL;
+	struct gridmementry *me = NULL;
+	unique_lock < mutex > memory(memLock);
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	me = &memTable[make_pair(x, y)];
+	me->x = x;
+	me->y = y;
+
+	getGridLocation(&lon, &lat, x, y);
+
+	error = getGridEntry(lon, lat, &ge);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = mapGridBucket(ge, &gb);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = findMatchingEntry(&be, gb, x, y, me->deletes);
+	unmapGridBucket(gb);
+
+	if (error == 0) {
+		me->deletes += 1;
+	} else if (!me->records.empty()) {
+		memBytes -= headerSize + me->records.front().size();
+		me->records.pop_front();
+		error = 0;
+	}
+
+ pclean:
+	if (me->deletes == 0 && me->records.empty()) {
+		memTable.erase(make_pair(x, y));
+	}
+
+ clean:
+	return error;
+}
+
+/* Ends run of records appended to mapped grid bucket, if any
+
+   Parameters:
+   gbucket: Mapped grid bucket of run, cleared
+   lon: Grid longitude of grid entry updated by run
+   lat: Grid latitude of grid entry updated by run
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::closeBucketRun(int64_t ** gbucket, int64_t lon, int64_t lat)
+{
+	if (*gbucket == NULL) {
+		return 0;
+	}
+
+	unmapGridBucket(*gbucket);
+	*gbucket = NULL;
+
+	return updateBucketRegion(lon, lat);
+}
+
+/* Flushes changes buffered in memtable to buckets, if any
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::flushMemtable()
+{
+	unique_lock < mutex > memory(memLock);
+
+	if (memTable.empty()) {
+		return 0;
+	}
+
+	memory.unlock();
+
+	return applyMemtable();
+}
+
+/* Applies changes buffered in memtable to buckets in Z-order of buckets,
+   taking memtable over so that new records are buffered meanwhile. Records
+   of one bucket are appended while bucket is mapped, bucket being split
+   as insertRecord does once full. Changes are logged as applied, changes
+   not applied on failure being put back in memtable.
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::applyMemtable()
+{
+	gridwriter writer(this);
+	gridaccess access(this, true, true);
+	int error = 0;
+	int64_t iter = 0;
+	int64_t count = 0;
+	int64_t lon = 0;
+	int64_t lat = 0;
+	int64_t rlon = 0;
+	int64_t rlat = 0;
+	int64_t esize = 0;
+	int64_t *ge = NULL;
+	int64_t *rge = NULL;
+	int64_t *gb = NULL;
+	struct gridmementry *me = NULL;
+	struct gridmementry *nme = NULL;
+	string *record = NULL;
+	map < pair < int64_t, int64_t >, struct gridmementry >table;
+	map < pair < int64_t, int64_t >, struct gridmementry >::iterator miter;
+	vector < pair < uint64_t, struct gridmementry * > >order;
+	unique_lock < mutex > memory(memLock, defer_lock);
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	memory.lock();
+	table.swap(memTable);
+	memBytes = 0;
+	memSignal.notify_all();
+	memory.unlock();
+
+	for (miter = table.begin(); miter != table.end(); miter++) {
+		me = &miter->second;
+		getGridLocation(&lon, &lat, me->x, me->y);
+
+		error = getGridEntry(lon, lat, &ge);
+		if (error < 0) {
+			goto clean;
+		}
+
+		order.push_back(make_pair(getBucketOrder(ge[5], ge[6]), me));
+	}
+
+	sort(order.begin(), order.end());
+
+	for (iter = 0; iter < (int64_t) order.size(); iter++) {
+		me = order[iter].second;
+
+		while (me->deletes > 0) {
+			error = closeBucketRun(&gb, rlon, rlat);
+			if (error < 0) {
+				goto clean;
+			}
+
+			/* Record may be gone already if deleted by other process */
+			error = eraseRecord(me->x, me->y);
+			if (error == -EINVAL) {
+				error = 0;
+				me->deletes -= 1;
+				continue;
+			}
+
+			if (error == 0) {
+				error = logChange(LOG_DELETE, me->x, me->y, 0, 0,
+						  NULL, 0);
+			}
+			if (error < 0) {
+				goto clean;
+			}
+
+			me->deletes -= 1;
+		}
+
+		while (!me->records.empty()) {
+			record = &me->records.front();
+			esize = headerSize + record->size();
+
+			getGridLocation(&lon, &lat, me->x, me->y);
+
+			error = getGridEntry(lon, lat, &ge);
+			if (error < 0) {
+				goto clean;
+			}
+
+			if (gb != NULL && (ge[4] != rge[4]
+					   || esize >
+					   getBucketCapacity(rge) - rge[0])) {
+				error = closeBucketRun(&gb, rlon, rlat);
+				if (error < 0) {
+					goto clean;
+				}
+			}
+
+			if (gb == NULL
+			    && esize <= getBucketCapacity(ge) - ge[0]) {
+				error = mapGridBucket(ge, &gb);
+				if (error < 0) {
+					goto clean;
+				}
+
+				rge = ge;
+				rlon = lon;
+				rlat = lat;
+			}
+
+			if (gb != NULL) {
+				appendBucketEntry(gb, me->x, me->y,
+						  record->size(),
+						  (void *)record->data());
+				rge[0] += esize;
+				rge[1] += 1;
+				rge[2] += me->x;
+				rge[3] += me->y;
+			} else {
+				error = storeRecord(me->x, me->y,
+						    (void *)record->data(),
+						    record->size());
+			}
+
+			if (error == 0) {
+				error = logChange(LOG_INSERT, me->x, me->y, 0, 0,
+						  (void *)record->data(),
+						  record->size());
+			}
+			if (error < 0) {
+				goto clean;
+			}
+
+			me->records.pop_front();
+		}
+	}
+
+ clean:
+	if (closeBucketRun(&gb, rlon, rlat) < 0 && error == 0) {
+		error = -EIO;
+	}
+
+	/* Changes not applied go back ahead of changes buffered meanwhile */
+	if (error < 0 && !table.empty()) {
+		memory.lock();
+		for (miter = table.begin(); miter != table.end(); miter++) {
+			me = &miter->second;
+			if (me->deletes == 0 && me->records.empty()) {
+				continue;
+			}
+
+			nme = &memTable[miter->first];
+			nme->x = me->x;
+			nme->y = me->y;
+			nme->deletes += me->deletes;
+			for (count = 0; count < (int64_t) me->records.size();
+			     count++) {
+				memBytes += headerSize + me->records[count].size();
+			}
+			nme->records.insert(nme->records.begin(),
+					    me->records.begin(),
+					    me->records.end());
+		}
+		memory.unlock();
+	}
+
+	return error;
+}
+
+/* Flushes memtable whenever it is half full, until stopped
+*/
+void gridfile::runFlusher()
+{
+	unique_lock < mutex > wait(memLock);
+
+	while (true) {
+		memSignal.wait(wait, [this] {
+			       return memStop || (memBytes > 0
+						  && memBytes >= memLimit / 2);
+			       });
+		if (memStop) {
+			break;
+		}
+
+		wait.unlock();
+		flushMemtable();
+		wait.lock();
+	}
+}
+
+/* Starts memtable buffering inserts and deletes of records in memory, up
+   to given number of bytes of records, and background thread flushing it
+   to buckets once half full. Point reads, range, shape and aggregate
+   queries of this process see buffered changes, other reads and writes
+   flush memtable first. Buffered changes
+   are lost if process ends before stopMemtable or unloadGrid is called.
+
+   Parameters:
+   limit: Highest number of bytes of buffered records, inserts waiting
+   for flush beyond it
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::startMemtable(int64_t limit)
+{
+	int error = 0;
+	lock_guard < mutex > guard(memLock);
+
+	if (limit <= 0) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	if (flusher.joinable()) {
+		error = -EBUSY;
+		goto clean;
+	}
+
+	memStop = false;
+	memLimit = limit;
+	memBytes = 0;
+	flusher = thread(&gridfile::runFlusher, this);
+
+ clean:
+	return error;
+}
+
+/* Stops memtable, if started, flushing changes still buffered
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::stopMemtable()
+{
+	if (flusher.joinable()) {
+		memLock.lock();
+		memStop = true;
+		memLimit = 0;
+		memLock.unlock();
+		memSignal.notify_all();
+
+		flusher.join();
+	}
+
+	return flushMemtable();
+}
+
+/* Retrieves record for given coordinates asynchronously, as findRecord
+
+   Parameters:
+   x: Coordinate (x) of record to be retrieved
+   y: Coordinate (y) of record to be retrieved
+   record: Buffer to hold retrieved record, set when future is ready
+
+   Return:
+   Future holding zero on success, error on failure
+*/
+future < int > gridfile::findRecordAsync(int64_t x, int64_t y, void **record)
+{
+	struct gridrequest request;
+
+	request.type = REQUEST_FIND;
+	request.x1 = x;
+	request.y1 = y;
+	request.records = record;
+
+	return submitRequest(&request);
+}
+
+/* Retrieves records within range asynchronously, as findRangeRecords
+
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   dsize: Number of bytes written in buffer is stored
+   records: Buffer to hold retrieved records, set when future is ready
+
+   Return:
+   Future holding zero on success, error on failure
+*/
+future < int > gridfile::findRangeRecordsAsync(int64_t x1, int64_t y1,
+					       int64_t x2, int64_t y2,
+					       int64_t * dsize,
+					       void **records)
+{
+	struct gridrequest request;
+
+	request.type = REQUEST_RANGE;
+	request.x1 = x1;
+	request.y1 = y1;
+	request.x2 = x2;
+	request.y2 = y2;
+	request.dsize = dsize;
+	request.records = records;
+
+	return submitRequest(&request);
+}
+
+/* Inserts new record asynchronously, as insertRecord
+
+   Parameters:
+   x: Coordinate (x) of new record
+   y: Coordinate (y) of new record
+   record: Buffer holding record data, kept until future is ready
+   rsize: Size of new record
+
+   Return:
+   Future holding zero on success, error on failure
+*/
+future < int > gridfile::insertRecordAsync(int64_t x, int64_t y,
+					   void *record, int64_t rsize)
+{
+	struct gridrequest request;
+
+	request.type = REQUEST_INSERT;
+	request.x1 = x;
+	request.y1 = y;
+	request.record = record;
+	request.rsize = rsize;
+
+	return submitRequest(&request);
+}
+
+/* Checks that record fits in bucket and matches fixed record and
+   coordinate sizes of grid
+
+   Parameters:
+   x: Coordinate (x) of record
+   y: Coordinate (y) of record
+   rsize: Size of record
+
+   Return:
+   Zero if record may be stored, error otherwise
+*/
+int gridfile::checkRecord(int64_t x, int64_t y, int64_t rsize)
+{
+	if (headerSize + rsize > pageSize - 16) {
+		return -EINVAL;
+	}
+
+	if (recordSize && rsize != recordSize) {
+		return -EINVAL;
+	}
+
+	if (coordinateSize == 4 && (x != (int32_t) x || y != (int32_t) y)) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Inserts new record in the grid, buffering it in memtable if started
+
+   Parameters:
+   x: Coordinate (x) of new record
+   y: Coordinate (y) of new record
+   record: Buffer holding record data
+   rsize: Size of new record
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::insertRecord(int64_t x, int64_t y, void *record, int64_t rsize)
+{
+	return bufferInsert(x, y, record, rsize);
+}
+
+/* Inserts new record in grid buckets
+
+   Parameters:
+   x: Coordinate (x) of new record
+   y: Coordinate (y) of new record
+   record: Buffer holding record data
+   rsize: Size of new record
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::storeRecord(int64_t x, int64_t y, void *record, int64_t rsize)
+{
+	gridwriter writer(this);
+	gridaccess access(this, true);
+	int error = 0;
+	int64_t lon = 0;
+	int64_t lat = 0;
+	int64_t *ge = NULL;
+	int64_t nbytes = 0;
+	int64_t capacity = 0;
+	int64_t esize = headerSize + rsize;
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = checkRecord(x, y, rsize);
+	if (error < 0) {
+		goto clean;
+	}
+
+	getGridLocation(&lon, &lat, x, y);
+
+	error = getGridEntry(lon, lat, &ge);
+	if (error < 0) {
+		goto clean;
+	}
+
+	nbytes = ge[0];
+	capacity = getBucketCapacity(ge) - nbytes;
+
+	if (esize > capacity) {
+		error = makeBucketRoom(lon, lat, x, y, rsize);
+		if (error < 0) {
+			goto clean;
+		}
+
+		getGridLocation(&lon, &lat, x, y);
+
+		error = getGridEntry(lon, lat, &ge);
+		if (error < 0) {
+			goto clean;
+		}
+	}
+
+	error = insertGridRecord(ge, x, y, record, rsize);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = updateBucketRegion(lon, lat);
+
+ clean:
+	if (error == 0) {
+		error = logChange(LOG_INSERT, x, y, 0, 0, record, rsize);
+	}
+
+	return error;
+}
+
+/* Retrieves record for given coordinates
+
+   Parameters:
+   x: Coordinate (x) of record to be retrieved
+   y: Coordinate (y) of record to be retrieved
+   record: Buffer to hold retrieved record
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::findRecord(int64_t x, int64_t y, void **record)
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+	gridaccess access(this, false, true);
+	int error = 0;
+	int64_t lon = 0;
+	int64_t lat = 0;
+	int64_t deletes = 0;
+	int64_t *ge = NULL;
+	int64_t *gb = NULL;
+	int64_t *be = NULL;
+	string *buffered = NULL;
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	*record = (void *)malloc(recordSize ? recordSize : pageSize);
+	if (*record == NULL) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	getGridLocation(&lon, &lat, x, y);
+
+	error = getGridEntry(lon, lat, &ge);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = mapGridBucket(ge, &gb);
+	if (error < 0) {
+		goto clean;
+	}
+
+	findBufferedRecord(x, y, &buffered, &deletes);
+
+	error = findMatchingEntry(&be, gb, x, y, deletes);
+	if (error == 0) {
+		memcpy(*record, getEntryRecord(be), getEntrySize(be));
+	} else if (buffered != NULL) {
+		memcpy(*record, buffered->data(), buffered->size());
+		error = 0;
+	}
+
+	unmapGridBucket(gb);
+
+ clean:
+	return error;
+}
+
+/* Retrieves record for given coordinates into caller buffer or arena,
+   exact size of record being stored in needed
+
+   Parameters:
+   x: Coordinate (x) of record to be retrieved
+   y: Coordinate (y) of record to be retrieved
+   output: Output to write record to
+
+   Return:
+   Zero on success, error on failure or if buffer is too small
+*/
+int gridfile::findRecordInto(int64_t x, int64_t y, struct gridbuffer *output)
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+	gridaccess access(this, false, true);
+	int error = 0;
+	int64_t lon = 0;
+	int64_t lat = 0;
+	int64_t deletes = 0;
+	int64_t rsize = 0;
+	int64_t *ge = NULL;
+	int64_t *gb = NULL;
+	int64_t *be = NULL;
+	void *data = NULL;
+	string *buffered = NULL;
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	getGridLocation(&lon, &lat, x, y);
+
+	error = getGridEntry(lon, lat, &ge);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = mapGridBucket(ge, &gb);
+	if (error < 0) {
+		goto clean;
+	}
+
+	findBufferedRecord(x, y, &buffered, &deletes);
+
+	error = findMatchingEntry(&be, gb, x, y, deletes);
+	if (error == 0) {
+		data = getEntryRecord(be);
+		rsize = getEntrySize(be);
+	} else if (buffered != NULL) {
+		data = (void *)buffered->data();
+		rsize = buffered->size();
+		error = 0;
+	} else {
+		goto pclean;
+	}
+
+	output->needed = rsize;
+
+	if (output->arena != NULL) {
+		error = output->arena->allocate(rsize, &output->data);
+		if (error < 0) {
+			goto pclean;
+		}
+		output->size = rsize;
+	} else if (rsize > output->size) {
+		error = -ENOSPC;
+		goto pclean;
+	}
+
+	memcpy(output->data, data, rsize);
+
+ pclean:
+	unmapGridBucket(gb);
+
+ clean:
+	return error;
+}
+
+/* Counts view about to be taken, so that writers of thread wait for it
+*/
+void gridfile::pinView()
+{
+	lock_guard < mutex > guard(viewLock);
+
+	pinnedViews += 1;
+}
+
+/* Unmaps bucket page of view, if any, and lets writers in once no view is
+   left
+
+   Parameters:
+   page: Bucket page of view
+*/
+void gridfile::unpinView(int64_t *page)
+{
+	lock_guard < mutex > guard(viewLock);
+
+	if (page != NULL) {
+		unmapGridBucket(page);
+		gridShared->slots[sharedSlot].active -= 1;
+	}
+
+	pinnedViews -= 1;
+	if (pinnedViews == 0) {
+		viewSignal.notify_all();
+	}
+}
+
+/* Maps bucket page holding record for given coordinates into view, page
+   being kept mapped and process kept active for writers of other processes
+   to wait for. Record still buffered in memtable is viewed in place
+
+   Parameters:
+   x: Coordinate (x) of record to be viewed
+   y: Coordinate (y) of record to be viewed
+   view: View to hold page and record
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::mapRecordView(int64_t x, int64_t y, struct gridview *view)
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+	gridaccess access(this, false, true);
+	int error = 0;
+	int64_t lon = 0;
+	int64_t lat = 0;
+	int64_t deletes = 0;
+	int64_t *ge = NULL;
+	int64_t *gb = NULL;
+	int64_t *be = NULL;
+	string *buffered = NULL;
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	getGridLocation(&lon, &lat, x, y);
+
+	error = getGridEntry(lon, lat, &ge);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = mapGridBucket(ge, &gb);
+	if (error < 0) {
+		goto clean;
+	}
+
+	findBufferedRecord(x, y, &buffered, &deletes);
+
+	error = findMatchingEntry(&be, gb, x, y, deletes);
+	if (error == 0) {
+		gridShared->slots[sharedSlot].active += 1;
+		view->grid = this;
+		view->page = gb;
+		view->data = getEntryRecord(be);
+		view->size = getEntrySize(be);
+		goto clean;
+	}
+
+	unmapGridBucket(gb);
+
+	if (buffered != NULL) {
+		view->grid = this;
+		view->data = (void *)buffered->data();
+		view->size = buffered->size();
+		error = 0;
+	}
+
+ clean:
+	return error;
+}
+
+/* Looks up record for given coordinates without copying it, view pointing
+   into mapped bucket page. Writers of grid, in this process and in others,
+   wait until view is released, so view must be released before its thread
+   writes to grid or grid is unloaded
+
+   Parameters:
+   x: Coordinate (x) of record to be looked up
+   y: Coordinate (y) of record to be looked up
+   view: View to hold record, view held before being released
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::lookupRecord(int64_t x, int64_t y, struct gridview *view)
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+	int error = 0;
+
+	view->release();
+	pinView();
+
+	error = mapRecordView(x, y, view);
+	if (error < 0) {
+		unpinView(NULL);
+	}
+
+	return error;
+}
+
+/* Deletes record for given coordinates, buffering delete in memtable if
+   started
+
+   Parameters:
+   x: Coordinate (x) pf record to be deleted
+   y: Coordinate (y) of record to be deleted
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::deleteRecord(int64_t x, int64_t y)
+{
+	unique_lock < mutex > memory(memLock);
+
+	if (memLimit == 0) {
+		memory.unlock();
+		return eraseRecord(x, y);
+	}
+
+	memory.unlock();
+
+	return bufferDelete(x, y);
+}
+
+/* Deletes record for given coordinates from grid buckets
+
+   Parameters:
+   x: Coordinate (x) of record to be deleted
+   y: Coordinate (y) of record to be deleted
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::eraseRecord(int64_t x, int64_t y)
+{
+	gridwriter writer(this);
+	gridaccess access(this, true);
+	int error = 0;
+	int64_t lon = 0;
+	int64_t lat = 0;
+	int64_t entry = 0;
+	int64_t *ge = NULL;
+	int64_t *gb = NULL;
+	int64_t *be = NULL;
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	getGridLocation(&lon, &lat, x, y);
+
+	error = getGridEntry(lon, lat, &ge);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = mapGridBucket(ge, &gb);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = findBucketEntry(&be, &entry, gb, x, y);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = removeGridRecord(ge, gb, entry);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = updateBucketRegion(lon, lat);
+
+ pclean:
+	unmapGridBucket(gb);
+
+ clean:
+	if (error == 0) {
+		error = logChange(LOG_DELETE, x, y, 0, 0, NULL, 0);
+	}
+
+	return error;
+}
+
+/* Overwrites data of record for given coordinates, in place when bucket
+   has room for new size, by reinserting record otherwise. Old record is
+   put back if reinsertion fails
+
+   Parameters:
+   x: Coordinate (x) of record to be updated
+   y: Coordinate (y) of record to be updated
+   record: Buffer holding new record data
+   rsize: Size of new record data
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::updateRecord(int64_t x, int64_t y, void *record, int64_t rsize)
+{
+	gridwriter writer(this);
+	gridaccess access(this, true);
+	int error = 0;
+	int64_t lon = 0;
+	int64_t lat = 0;
+	int64_t entry = 0;
+	int64_t osize = 0;
+	int64_t *ge = NULL;
+	int64_t *gb = NULL;
+	int64_t *be = NULL;
+	char *data = NULL;
+	char *orecord = NULL;
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = checkRecord(x, y, rsize);
+	if (error < 0) {
+		goto clean;
+	}
+
+	getGridLocation(&lon, &lat, x, y);
+
+	error = getGridEntry(lon, lat, &ge);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = mapGridBucket(ge, &gb);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = findBucketEntry(&be, &entry, gb, x, y);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	osize = getEntrySize(be);
+	data = (char *)getEntryRecord(be);
+
+	if (rsize != osize && ge[0] + rsize - osize > getBucketCapacity(ge)) {
+		orecord = (char *)malloc(osize + 1);
+		if (orecord == NULL) {
+			error = -ENOMEM;
+			goto pclean;
+		}
+
+		memcpy(orecord, data, osize);
+
+		error = removeGridRecord(ge, gb, entry);
+		if (error < 0) {
+			goto rclean;
+		}
+
+		error = updateBucketRegion(lon, lat);
+		if (error == 0) {
+			unmapGridBucket(gb);
+			gb = NULL;
+
+			error = storeRecord(x, y, record, rsize);
+		}
+
+		if (error < 0) {
+			/* Old record is put back, its bucket has room for it */
+			storeRecord(x, y, orecord, osize);
+		}
+
+		goto rclean;
+	}
+
+	if (rsize != osize) {
+		memmove(data + rsize, data + osize,
+			(char *)gb + 16 + gb[0] - (data + osize));
+		*(int64_t *) ((char *)be + 2 * coordinateSize) = rsize;
+		gb[0] += rsize - osize;
+		ge[0] += rsize - osize;
+
+		error = updateBucketRegion(lon, lat);
+	}
+
+	memcpy(data, record, rsize);
+	goto pclean;
+
+ rclean:
+	free(orecord);
+
+ pclean:
+	if (gb != NULL) {
+		unmapGridBucket(gb);
+	}
+
+ clean:
+	if (error == 0) {
+		error = logChange(LOG_UPDATE, x, y, 0, 0, record, rsize);
+	}
+
+	return error;
+}
+
+/* Moves record to new coordinates, rewriting its coordinates in place when
+   new coordinates lie in same bucket, by reinserting record otherwise
+
+   Parameters:
+   x: Coordinate (x) of record to be moved
+   y: Coordinate (y) of record to be moved
+   nx: New coordinate (x) of record
+   ny: New coordinate (y) of record
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::moveRecord(int64_t x, int64_t y, int64_t nx, int64_t ny)
+{
+	gridwriter writer(this);
+	gridaccess access(this, true);
+	int error = 0;
+	int64_t lon = 0;
+	int64_t lat = 0;
+	int64_t nlon = 0;
+	int64_t nlat = 0;
+	int64_t entry = 0;
+	int64_t rsize = 0;
+	int64_t *ge = NULL;
+	int64_t *nge = NULL;
+	int64_t *gb = NULL;
+	int64_t *be = NULL;
+	char *record = NULL;
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	if (coordinateSize == 4 && (nx != (int32_t) nx || ny != (int32_t) ny)) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	getGridLocation(&lon, &lat, x, y);
+	getGridLocation(&nlon, &nlat, nx, ny);
+
+	error = getGridEntry(lon, lat, &ge);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = getGridEntry(nlon, nlat, &nge);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = mapGridBucket(ge, &gb);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = findBucketEntry(&be, &entry, gb, x, y);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	if (nge[4] == ge[4]) {
+		setEntryCoordinates(be, nx, ny);
+		ge[2] += nx - x;
+		ge[3] += ny - y;
+
+		error = updateBucketRegion(lon, lat);
+		goto pclean;
+	}
+
+	rsize = getEntrySize(be);
+	record = (char *)malloc(rsize + 1);
+	if (record == NULL) {
+		error = -ENOMEM;
+		goto pclean;
+	}
+
+	memcpy(record, getEntryRecord(be), rsize);
+
+	error = removeGridRecord(ge, gb, entry);
+	if (error < 0) {
+		goto rclean;
+	}
+
+	error = updateBucketRegion(lon, lat);
+	if (error < 0) {
+		goto rclean;
+	}
+
+	unmapGridBucket(gb);
+	gb = NULL;
+
+	error = storeRecord(nx, ny, record, rsize);
+	if (error < 0) {
+		/* Record is put back, its bucket still has room for it */
+		storeRecord(x, y, record, rsize);
+	}
+
+ rclean:
+	free(record);
+
+ pclean:
+	if (gb != NULL) {
+		unmapGridBucket(gb);
+	}
+
+ clean:
+	if (error == 0) {
+		error = logChange(LOG_MOVE, x, y, nx, ny, NULL, 0);
+	}
+
+	return error;
+}
+
+/* Copies entries of mapped grid bucket lying within range into buffer,
+   for coordinate width and record size fixed at compile time. Entries lie
+   at constant stride and each is written at current position of buffer,
+   position advancing only past those in range, so that scan does not
+   branch on coordinates. Entries out of range are thus written too, past
+   those kept: buffer must hold room for output of every entry of bucket
+   from current position on, whether in range or not, as output bounded
+   by getBucketOutputSize over whole buckets of range does
+
+   Parameters:
+   gb: Mapped grid bucket
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   rrecords: Position in buffer, advanced past copied entries
+   nr: Number of copied entries is added
+   dsize: Number of copied bytes is added
+*/
+template < typename Coord, int64_t RSIZE >
+    void gridfile::copyFixedEntries(int64_t * gb, int64_t x1, int64_t y1,
+				    int64_t x2, int64_t y2, char **rrecords,
+				    int64_t * nr, int64_t * dsize)
+{
+	const int64_t esize = 2 * sizeof(Coord) + RSIZE;
+	int64_t nrecords = gb[1];
+	int64_t iter = 0;
+	int64_t inside = 0;
+	int64_t bx = 0;
+	int64_t by = 0;
+	int64_t *dentry = NULL;
+	char *be = (char *)gb + 16;
+
+	for (iter = 0; iter < nrecords; iter++) {
+		bx = ((Coord *) be)[0];
+		by = ((Coord *) be)[1];
+		inside = (bx >= x1) & (bx <= x2) & (by >= y1) & (by <= y2);
+
+		dentry = (int64_t *) * rrecords;
+		dentry[0] = bx;
+		dentry[1] = by;
+		dentry[2] = RSIZE;
+		memcpy(dentry + 3, be + 2 * sizeof(Coord), RSIZE);
+
+		*rrecords += inside * (24 + RSIZE);
+		*nr += inside;
+		*dsize += inside * (24 + RSIZE);
+		be += esize;
+	}
+}
+
+/* Copies entries of mapped grid bucket lying within range into buffer by
+   scan specialized on record size, for common fixed record sizes
+
+   Parameters:
+   gb: Mapped grid bucket
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   rrecords: Position in buffer, advanced past copied entries
+   nr: Number of copied entries is added
+   dsize: Number of copied bytes is added
+
+   Return:
+   One if entries were copied, zero if record size has no specialized scan
+*/
+template < typename Coord >
+    int gridfile::copySizedEntries(int64_t * gb, int64_t x1, int64_t y1,
+				   int64_t x2, int64_t y2, char **rrecords,
+				   int64_t * nr, int64_t * dsize)
+{
+	switch (recordSize) {
+	case 8:
+		copyFixedEntries < Coord, 8 > (gb, x1, y1, x2, y2, rrecords, nr,
+					       dsize);
+		return 1;
+	case 16:
+		copyFixedEntries < Coord, 16 > (gb, x1, y1, x2, y2, rrecords, nr,
+						dsize);
+		return 1;
+	case 32:
+		copyFixedEntries < Coord, 32 > (gb, x1, y1, x2, y2, rrecords, nr,
+						dsize);
+		return 1;
+	case 64:
+		copyFixedEntries < Coord, 64 > (gb, x1, y1, x2, y2, rrecords, nr,
+						dsize);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Copies entries of mapped grid bucket lying within range into buffer
+
+   Parameters:
+   gb: Mapped grid bucket
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   rrecords: Position in buffer, advanced past copied entries
+   nr: Number of copied entries is added
+   dsize: Number of copied bytes is added
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::copyRangeEntries(int64_t * gb, int64_t x1, int64_t y1,
+			       int64_t x2, int64_t y2, char **rrecords,
+			       int64_t * nr, int64_t * dsize)
+{
+	int error = 0;
+	int64_t nrecords = gb[1];
+	int64_t iter = 0;
+	int64_t *be = NULL;
+	int64_t bx = 0;
+	int64_t by = 0;
+	int64_t bs = 0;
+
+	if (coordinateSize == 4 ?
+	    copySizedEntries < int32_t > (gb, x1, y1, x2, y2, rrecords, nr,
+					  dsize) :
+	    copySizedEntries < int64_t > (gb, x1, y1, x2, y2, rrecords, nr,
+					  dsize)) {
+		goto clean;
+	}
+
+	for (iter = 0; iter < nrecords; iter++) {
+		error = getBucketEntry(&be, gb, iter);
+		if (error < 0) {
+			goto clean;
+		}
+
+		getEntryCoordinates(&bx, &by, be);
+
+		if (bx >= x1 && bx <= x2 && by >= y1 && by <= y2) {
+			*nr += 1;
+			bs = copyBucketEntry(*rrecords, be);
+			*rrecords += bs;
+			*dsize += bs;
+		}
+	}
+
+ clean:
+	return error;
+}
+
+/* Retrieves records within range by reading each bucket intersecting range
+   once
+
+   Parameters:
+   gentries: Grid entries of buckets intersecting range, in file order
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   rrecords: Position in buffer, advanced past copied entries
+   nr: Number of copied entries is added
+   dsize: Number of copied bytes is added
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::traverseRangeRecords(vector < int64_t * >&gentries,
+				   int64_t x1, int64_t y1, int64_t x2,
+				   int64_t y2, char **rrecords, int64_t * nr,
+				   int64_t * dsize)
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t *gb = NULL;
+
+	/* Next buckets are read ahead */
+	for (iter = 0; iter < (int64_t) gentries.size() && iter < PREFETCH;
+	     iter++) {
+		prefetchBucket(gentries[iter]);
+	}
+
+	for (iter = 0; iter < (int64_t) gentries.size(); iter++) {
+		if (iter + PREFETCH < (int64_t) gentries.size()) {
+			prefetchBucket(gentries[iter + PREFETCH]);
+		}
+
+		error = mapGridBucket(gentries[iter], &gb);
+		if (error < 0) {
+			goto clean;
+		}
+
+		error =
+		    copyRangeEntries(gb, x1, y1, x2, y2, rrecords, nr, dsize);
+
+		unmapGridBucket(gb);
+
+		if (error < 0) {
+			goto clean;
+		}
+	}
+
+ clean:
+	return error;
+}
+
+/* Retrieves records within range by reading bucket file sequentially,
+   bucket by bucket in order of their addresses, so that pages left free
+   between buckets and buckets outside range are skipped
+
+   Parameters:
+   gentries: Grid entries of buckets intersecting range, in file order
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   rrecords: Position in buffer, advanced past copied entries
+   nr: Number of copied entries is added
+   dsize: Number of copied bytes is added
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::scanRangeRecords(vector < int64_t * >&gentries, int64_t x1,
+			       int64_t y1, int64_t x2, int64_t y2,
+			       char **rrecords, int64_t * nr, int64_t * dsize)
+{
+	int error = 0;
+	int bfd = -1;
+	int64_t nbuckets = gridDirectory[0];
+	int64_t iter = 0;
+	char *buckets = NULL;
+
+	bfd = open(bucketName.c_str(), O_RDONLY);
+	if (bfd == -1) {
+		error = -errno;
+		goto clean;
+	}
+
+	buckets =
+	    (char *)mmap(NULL, nbuckets * pageSize, PROT_READ, MAP_SHARED, bfd,
+			 0);
+	close(bfd);
+
+	if (buckets == MAP_FAILED) {
+		error = -errno;
+		goto clean;
+	}
+
+	madvise(buckets, nbuckets * pageSize, MADV_SEQUENTIAL);
+
+	for (iter = 0; iter < (int64_t) gentries.size(); iter++) {
+		error =
+		    copyRangeEntries((int64_t *) (buckets +
+						  gentries[iter][4] *
+						  pageSize), x1, y1, x2, y2,
+				     rrecords, nr, dsize);
+		if (error < 0) {
+			break;
+		}
+	}
+
+	munmap(buckets, nbuckets * pageSize);
+
+ clean:
+	return error;
+}
+
+/* Computes fraction of coordinate interval of region lying within range,
+   open ends of outermost regions being mirrored about mean coordinate
+
+   Parameters:
+   lo: Lowest coordinate of region
+   hi: Highest coordinate of region
+   r1: Lowest coordinate of range
+   r2: Highest coordinate of range
+   mean: Mean coordinate of records of region
+
+   Return:
+   Fraction of region interval within range
+*/
+double gridfile::getOverlapFraction(double lo, double hi, double r1,
+				    double r2, double mean)
+{
+	if (lo == INT64_MIN && hi == INT64_MAX) {
+		lo = mean;
+		hi = mean;
+	} else if (lo == INT64_MIN) {
+		lo = min(2 * mean - hi, mean);
+	} else if (hi == INT64_MAX) {
+		hi = max(2 * mean - lo, mean);
+	}
+
+	lo = floor(lo);
+	hi = ceil(hi);
+
+	if (r2 < lo || r1 > hi) {
+		return 0;
+	}
+
+	return (min(hi, r2) - max(lo, r1) + 1) / (hi - lo + 1);
+}
+
+/* Estimates number of records within range from grid scale and statistics
+   of given grid entries, assuming records spread uniformly over region of
+   each bucket, and counts pages to be read for them
+
+   Parameters:
+   gentries: Grid entries of buckets intersecting range
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   nrecords: Estimated number of records is stored
+   npages: Number of pages of buckets is stored
+*/
+void gridfile::estimateBucketRecords(vector < int64_t * >&gentries,
+				     int64_t x1, int64_t y1, int64_t x2,
+				     int64_t y2, int64_t * nrecords,
+				     int64_t * npages)
 {
-	int error = 0;
-	int64_t *ge = NULL;
 	int64_t xint = gridScale[1];
 	int64_t yint = gridScale[1 + gridSize];
-	int64_t sum = 0;
-	int64_t average = 0;
-	int64_t nrecords = 0;
-	int64_t xiter = 0;
-	int64_t yiter = 0;
-	int64_t *cge = NULL;
-	int64_t *pge = NULL;
+	int64_t iter = 0;
+	int64_t *ge = NULL;
+	double xlo = 0;
+	double xhi = 0;
+	double ylo = 0;
+	double yhi = 0;
+	double estimate = 0;
+
+	*npages = 0;
+
+	for (iter = 0; iter < (int64_t) gentries.size(); iter++) {
+		ge = gentries[iter];
+		*npages += getBucketPages(ge);
+		if (ge[1] == 0) {
+			continue;
+		}
 
-	if (vertical && xint == gridSize - 1) {
-		error = -ENOMEM;
-		goto clean;
+		xlo = ge[5] > 0 ? gridScale[2 + ge[5] - 1] + 1 : INT64_MIN;
+		xhi = ge[7] < xint ? gridScale[2 + ge[7]] : INT64_MAX;
+		ylo = ge[6] > 0 ? gridScale[2 + gridSize + ge[6] - 1] + 1 :
+		    INT64_MIN;
+		yhi = ge[8] < yint ? gridScale[2 + gridSize + ge[8]] :
+		    INT64_MAX;
+
+		estimate += ge[1] *
+		    getOverlapFraction(xlo, xhi, x1, x2,
+				       (double)ge[2] / ge[1]) *
+		    getOverlapFraction(ylo, yhi, y1, y2, (double)ge[3] / ge[1]);
 	}
 
-	if (!vertical && yint == gridSize - 1) {
-		error = -ENOMEM;
+	*nrecords = (int64_t) (estimate + 0.5);
+}
+
+/* Estimates number of records within range and number of buckets and
+   pages to be read for them from grid scale and grid entry statistics,
+   assuming records spread uniformly over region of each bucket
+
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   nrecords: Estimated number of records is stored
+   nbuckets: Number of buckets intersecting range is stored
+   npages: Number of pages of buckets intersecting range is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::estimateRangeRecords(int64_t x1, int64_t y1, int64_t x2,
+				   int64_t y2, int64_t * nrecords,
+				   int64_t * nbuckets, int64_t * npages)
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+	gridaccess access(this, false);
+	int error = 0;
+	int64_t lon1 = 0;
+	int64_t lat1 = 0;
+	int64_t lon2 = 0;
+	int64_t lat2 = 0;
+	vector < int64_t * >gentries;
+
+	error = access.error;
+	if (error < 0) {
 		goto clean;
 	}
 
-	error = getGridEntry(lon, lat, &ge);
+	getGridLocation(&lon1, &lat1, x1, y1);
+	getGridLocation(&lon2, &lat2, x2, y2);
+
+	error = getRangeBuckets(gentries, lon1, lat1, lon2, lat2);
 	if (error < 0) {
 		goto clean;
 	}
 
-	nrecords = ge[1];
+	*nbuckets = gentries.size();
+	estimateBucketRecords(gentries, x1, y1, x2, y2, nrecords, npages);
 
-	if (!vertical) {
-		sum = ge[3];
-		average = (sum + y) / (nrecords + 1);
+ clean:
+	return error;
+}
 
-		error = insertGridPartition(vertical, average);
-		if (error < 0) {
-			goto clean;
-		}
+/* Provides buffer for result of read operation of at most given size: new
+   buffer if no output is given, memory of arena, caller buffer if large
+   enough or scratch buffer of grid otherwise, so that exact size of result
+   can still be reported
 
-		for (xiter = 0; xiter <= xint; xiter++) {
-			for (yiter = yint + 1; yiter > lat; yiter--) {
-				error = getGridEntry(xiter, yiter, &cge);
-				if (error < 0) {
-					goto clean;
-				}
+   Parameters:
+   output: Output of read operation, newly allocated buffer if none
+   bound: Highest number of bytes result can take
+   records: Buffer to hold result is stored
 
-				error = getGridEntry(xiter, yiter - 1, &pge);
-				if (error < 0) {
-					goto clean;
-				}
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::allocateOutput(struct gridbuffer *output, int64_t bound,
+			     void **records)
+{
+	int error = 0;
 
-				memcpy(cge, pge, 40);
-			}
+	if (output == NULL) {
+		*records = (void *)malloc(bound);
+		if (*records == NULL) {
+			error = -ENOMEM;
 		}
+	} else if (output->arena != NULL) {
+		error = output->arena->allocate(bound, records);
+	} else if (bound <= output->size) {
+		*records = output->data;
 	} else {
-		sum = ge[2];
-		average = (sum + x) / (nrecords + 1);
-
-		error = insertGridPartition(vertical, average);
-		if (error < 0) {
-			goto clean;
+		if ((int64_t) outputScratch.size() < bound) {
+			outputScratch.resize(bound);
 		}
+		*records = outputScratch.data();
+	}
 
-		for (yiter = 0; yiter <= yint; yiter++) {
-			for (xiter = xint + 1; xiter > lon; xiter--) {
-				error = getGridEntry(xiter, yiter, &cge);
-				if (error < 0) {
-					goto clean;
-				}
+	return error;
+}
 
-				error = getGridEntry(xiter - 1, yiter, &pge);
-				if (error < 0) {
-					goto clean;
-				}
+/* Completes output of read operation once size of result is known, giving
+   unused memory back to arena or copying result from scratch buffer into
+   caller buffer
 
-				memcpy(cge, pge, 40);
-			}
+   Parameters:
+   output: Output of read operation, newly allocated buffer if none
+   records: Buffer holding result
+   nbytes: Number of bytes result takes
+
+   Return:
+   Zero on success, error on failure or if caller buffer is too small
+*/
+int gridfile::finishOutput(struct gridbuffer *output, void *records,
+			   int64_t nbytes)
+{
+	int error = 0;
+
+	if (output == NULL) {
+		goto clean;
+	}
+
+	output->needed = nbytes;
+
+	if (output->arena != NULL) {
+		output->arena->shrink(records, nbytes);
+		output->data = records;
+		output->size = nbytes;
+	} else if (records != output->data) {
+		if (nbytes > output->size) {
+			error = -ENOSPC;
+			goto clean;
 		}
+		memcpy(output->data, records, nbytes);
 	}
 
  clean:
 	return error;
 }
 
-/* Updates destination entry from source entry if sharing buckets
+/* Retrieves records within range into output, bucket by bucket or by
+   scanning bucket file, whichever is estimated cheaper. Buckets of range
+   are looked up once for both estimate and retrieval, changes buffered in
+   memtable being merged into records of buckets
 
    Parameters:
-   direction: Negative for backwards, one for forwards, zero for both
-   slon: Grid longitude of source entry
-   slat: Grid latitude of source entry
-   dlon: Grid longitude of destination entry
-   dlat: Grid latitude of destination entry
-   baddr: Bucket address for checking pairing
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   output: Output to write records to, newly allocated buffer if none
+   dsize: Number of bytes written in buffer is added
+   records: Buffer to hold retrieved records
 
    Return:
    Zero on success, error on failure
 */
-
-int gridfile::updateBucket(int direction, int64_t slon, int64_t slat,
-			   int64_t dlon, int64_t dlat, int64_t baddr)
+int gridfile::findRangeOutput(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			      struct gridbuffer *output, int64_t * dsize,
+			      void **records)
 {
+	lock_guard < recursive_mutex > guard(gridLock);
+	gridaccess access(this, false, true);
 	int error = 0;
-	int compare = 0;
-	int64_t *ge = NULL;
-	int64_t *pge = NULL;
+	int64_t nr = 0;
+	int64_t nestimate = 0;
+	int64_t nbuckets = 0;
+	int64_t npages = 0;
+	int64_t rsize = 0;
+	int64_t nbuffered = 0;
+	int64_t dstart = *dsize;
+	int64_t lon1 = 0;
+	int64_t lat1 = 0;
+	int64_t lon2 = 0;
+	int64_t lat2 = 0;
+	char *rrecords = NULL;
+	vector < int64_t * >gentries;
+	vector < struct gridmementry >buffered;
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	collectBufferedChanges(buffered, x1, y1, x2, y2, &nbuffered);
 
-	error = getGridEntry(slon, slat, &ge);
+	getGridLocation(&lon1, &lat1, x1, y1);
+	getGridLocation(&lon2, &lat2, x2, y2);
+
+	error = getRangeBuckets(gentries, lon1, lat1, lon2, lat2);
 	if (error < 0) {
 		goto clean;
 	}
 
-	error = getGridEntry(dlon, dlat, &pge);
+	nbuckets = gentries.size();
+	estimateBucketRecords(gentries, x1, y1, x2, y2, &nestimate, &npages);
+
+	/* Buckets are read in file order either way */
+	sort(gentries.begin(), gentries.end(), isBucketBefore);
+
+	rsize = getBucketOutputSize(npages * pageSize - 16 * nbuckets) + 8 +
+	    nbuffered;
+	error = allocateOutput(output, rsize, records);
 	if (error < 0) {
 		goto clean;
 	}
 
-	compare = memcmp(pge, ge, 40);
+	rrecords = (char *)(*records) + 8;
+
+	if (randomCost > 0 && nbuckets * randomCost > gridDirectory[0]) {
+		error =
+		    scanRangeRecords(gentries, x1, y1, x2, y2, &rrecords, &nr,
+				     dsize);
+	} else {
+		error =
+		    traverseRangeRecords(gentries, x1, y1, x2, y2, &rrecords,
+					 &nr, dsize);
+	}
+
+	if (error == 0 && !buffered.empty()) {
+		mergeBufferedChanges(buffered, NULL, (char *)(*records) + 8,
+				     &rrecords, &nr, dsize);
+	}
+
+	((int64_t *) * records)[0] = nr;
+
+	if (error == 0) {
+		error = finishOutput(output, *records, *dsize - dstart + 8);
+	}
+
+ clean:
+	return error;
+}
+
+/* Retrieves record within specified coordinate range. Range is read by
+   visiting its grid entries, unless reading buckets of range at random is
+   estimated to cost more than reading whole bucket file sequentially.
+
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) represeting upper left corner of range
+   dsize: Number of bytes written in buffer is stored
+   records: Buffer to hold retrieved records
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::findRangeRecords(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			       int64_t * dsize, void **records)
+{
+	return findRangeOutput(x1, y1, x2, y2, NULL, dsize, records);
+}
+
+/* Retrieves records within range into caller buffer or arena, laid out as
+   by findRangeRecords
+
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   output: Output to write records to, bytes needed being stored
+
+   Return:
+   Zero on success, error on failure or if buffer is too small
+*/
+int gridfile::findRangeRecordsInto(int64_t x1, int64_t y1, int64_t x2,
+				   int64_t y2, struct gridbuffer *output)
+{
+	int64_t ds = 0;
+	void *records = NULL;
+
+	return findRangeOutput(x1, y1, x2, y2, output, &ds, &records);
+}
+
+/* Checks if segment meets rectangle, clipping segment against each side
+   of rectangle in turn
+
+   Parameters:
+   ax: Coordinate (x) of first end of segment
+   ay: Coordinate (y) of first end of segment
+   bx: Coordinate (x) of second end of segment
+   by: Coordinate (y) of second end of segment
+   xlo: Lowest coordinate (x) of rectangle
+   ylo: Lowest coordinate (y) of rectangle
+   xhi: Highest coordinate (x) of rectangle
+   yhi: Highest coordinate (y) of rectangle
+
+   Return:
+   One if segment meets rectangle, zero otherwise
+*/
+int gridfile::isSegmentMeeting(long double ax, long double ay, long double bx,
+			       long double by, long double xlo,
+			       long double ylo, long double xhi,
+			       long double yhi)
+{
+	int side = 0;
+	long double t1 = 0;
+	long double t2 = 1;
+	long double p = 0;
+	long double q = 0;
+	long double t = 0;
+
+	for (side = 0; side < 4; side++) {
+		if (side == 0) {
+			p = ax - bx;
+			q = ax - xlo;
+		} else if (side == 1) {
+			p = bx - ax;
+			q = xhi - ax;
+		} else if (side == 2) {
+			p = ay - by;
+			q = ay - ylo;
+		} else {
+			p = by - ay;
+			q = yhi - ay;
+		}
+
+		if (p == 0) {
+			if (q < 0) {
+				return 0;
+			}
+			continue;
+		}
+
+		t = q / p;
+		if (p < 0) {
+			t1 = max(t1, t);
+		} else {
+			t2 = min(t2, t);
+		}
+
+		if (t1 > t2) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Checks if coordinates lie within query shape, polygon edges included
+
+   Parameters:
+   shape: Query shape
+   x: Coordinate (x)
+   y: Coordinate (y)
+
+   Return:
+   One if coordinates lie within shape, zero otherwise
+*/
+int gridfile::isShapePoint(struct gridshape *shape, long double x,
+			   long double y)
+{
+	int inside = 0;
+	int64_t iter = 0;
+	int64_t prev = 0;
+	long double dx = x - shape->x;
+	long double dy = y - shape->y;
+	long double xi = 0;
+	long double yi = 0;
+	long double xj = 0;
+	long double yj = 0;
+
+	if (!shape->nvertices) {
+		return dx * dx + dy * dy <=
+		    (long double)shape->radius * shape->radius;
+	}
+
+	for (iter = 0; iter < shape->nvertices; iter++) {
+		prev = iter ? iter - 1 : shape->nvertices - 1;
+		xi = shape->xs[iter];
+		yi = shape->ys[iter];
+		xj = shape->xs[prev];
+		yj = shape->ys[prev];
+
+		if ((xj - xi) * (y - yi) == (yj - yi) * (x - xi)
+		    && x >= min(xi, xj) && x <= max(xi, xj)
+		    && y >= min(yi, yj) && y <= max(yi, yj)) {
+			return 1;
+		}
 
-	if (compare != 0 && baddr == pge[4]) {
-		memcpy(pge, ge, 40);
-		error = updatePairedBuckets(direction, dlon, dlat, baddr);
-		if (error < 0) {
-			goto clean;
+		if ((yi > y) != (yj > y)
+		    && x < xi + (y - yi) * (xj - xi) / (yj - yi)) {
+			inside = !inside;
 		}
 	}
 
- clean:
-	return error;
+	return inside;
 }
 
-/* Updates paired buckets in given direction with statistics and address
+/* Classifies rectangle as lying inside, outside or on boundary of query
+   shape
 
    Parameters:
-   direction: Negative for backwards, positive for forwards, zero for both
-   lon: Grid longitude
-   lat: Grid latitude
-   baddr: Bucket address for checking pairing
+   shape: Query shape
+   xlo: Lowest coordinate (x) of rectangle
+   ylo: Lowest coordinate (y) of rectangle
+   xhi: Highest coordinate (x) of rectangle
+   yhi: Highest coordinate (y) of rectangle
 
    Return:
-   Zero on success, error on failure
+   REGION_INSIDE, REGION_OUTSIDE or REGION_BOUNDARY
 */
-
-int gridfile::updatePairedBuckets(int direction, int64_t lon, int64_t lat,
-				  int64_t baddr)
+int gridfile::classifyShapeRegion(struct gridshape *shape, long double xlo,
+				  long double ylo, long double xhi,
+				  long double yhi)
 {
-	int error = 0;
-	int64_t xint = gridScale[1];
-	int64_t yint = gridScale[1 + gridSize];
-
-	if (direction >= 0) {
-		if (lon < xint) {
-			error =
-			    updateBucket(direction, lon, lat, lon + 1, lat,
-					 baddr);
-			if (error < 0) {
-				goto clean;
-			}
+	int64_t iter = 0;
+	int64_t prev = 0;
+	long double r = shape->radius;
+	long double nx = 0;
+	long double ny = 0;
+	long double fx = 0;
+	long double fy = 0;
+
+	if (!shape->nvertices) {
+		nx = max(max(xlo - shape->x, shape->x - xhi), (long double)0);
+		ny = max(max(ylo - shape->y, shape->y - yhi), (long double)0);
+		if (nx * nx + ny * ny > r * r) {
+			return REGION_OUTSIDE;
 		}
 
-		if (lat < yint) {
-			error =
-			    updateBucket(direction, lon, lat, lon, lat + 1,
-					 baddr);
-			if (error < 0) {
-				goto clean;
-			}
+		fx = max(shape->x - xlo, xhi - shape->x);
+		fy = max(shape->y - ylo, yhi - shape->y);
+		if (fx * fx + fy * fy <= r * r) {
+			return REGION_INSIDE;
 		}
-	}
 
-	if (direction <= 0) {
-		if (lon > 0) {
-			error =
-			    updateBucket(direction, lon, lat, lon - 1, lat,
-					 baddr);
-			if (error < 0) {
-				goto clean;
-			}
-		}
+		return REGION_BOUNDARY;
+	}
 
-		if (lat > 0) {
-			error =
-			    updateBucket(direction, lon, lat, lon, lat - 1,
-					 baddr);
-			if (error < 0) {
-				goto clean;
-			}
+	/* Rectangle met by no edge lies wholly inside or outside polygon */
+	for (iter = 0; iter < shape->nvertices; iter++) {
+		prev = iter ? iter - 1 : shape->nvertices - 1;
+		if (isSegmentMeeting(shape->xs[prev], shape->ys[prev],
+				     shape->xs[iter], shape->ys[iter], xlo, ylo,
+				     xhi, yhi)) {
+			return REGION_BOUNDARY;
 		}
 	}
 
- clean:
-	return error;
+	return isShapePoint(shape, xlo, ylo) ? REGION_INSIDE : REGION_OUTSIDE;
 }
 
-/* Divides entries of paired buckets into individual bcukets
+/* Retrieves records within query shape. Buckets intersecting bounding box
+   of shape are classified by their regions, buckets inside shape are
+   copied whole, buckets outside skipped and only entries of buckets on
+   boundary are tested against shape.
 
-   Paramters:
-   vertical: Zero for latitude wise, one for longitude wise
-   slon: Source bucket grid longitude
-   slat: Source bucket grid latitude
-   dlon: Destination bucket grid longitude
-   dlat: Destination bucket grid latitude
+   Parameters:
+   shape: Query shape
+   x1: Coordinate (x) representing lower left corner of bounding box
+   y1: Coordinate (y) representing lower left corner of bounding box
+   x2: Coordinate (x) representing upper right corner of bounding box
+   y2: Coordinate (y) representing upper right corner of bounding box
+   output: Output to write records to, newly allocated buffer if none
+   dsize: Number of bytes written in buffer is stored
+   records: Buffer to hold retrieved records
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::splitBucket(int vertical, int64_t slon, int64_t slat,
-			  int64_t dlon, int64_t dlat)
+int gridfile::findShapeRecords(struct gridshape *shape, int64_t x1,
+			       int64_t y1, int64_t x2, int64_t y2,
+			       struct gridbuffer *output, int64_t * dsize,
+			       void **records)
 {
+	gridaccess access(this, false, true);
 	int error = 0;
-	int64_t *sge = NULL;
-	int64_t *dge = NULL;
-	int64_t *sb = NULL;
-	int64_t *db = NULL;
+	int region = 0;
 	int64_t xint = gridScale[1];
 	int64_t yint = gridScale[1 + gridSize];
-	int64_t avgx = 0;
-	int64_t avgy = 0;
+	int64_t lon1 = 0;
+	int64_t lat1 = 0;
+	int64_t lon2 = 0;
+	int64_t lat2 = 0;
+	int64_t giter = 0;
 	int64_t iter = 0;
-	int64_t *cbe = NULL;
-	int64_t ssx = 0;
-	int64_t ssy = 0;
-	int64_t dsx = 0;
-	int64_t dsy = 0;
-	int64_t sn = 0;
-	int64_t dn = 0;
-	int64_t sbytes = 0;
-	int64_t dbytes = 0;
-
-	if (slon > xint || slat > yint || dlon > xint || dlat > yint) {
-		error = -EINVAL;
-		goto clean;
-	}
-
-	error = getGridEntry(slon, slat, &sge);
+	int64_t nr = 0;
+	int64_t bx = 0;
+	int64_t by = 0;
+	int64_t bs = 0;
+	int64_t capacity = 0;
+	int64_t nbuffered = 0;
+	int64_t *ge = NULL;
+	int64_t *gb = NULL;
+	char *be = NULL;
+	char *rrecords = NULL;
+	long double xlo = 0;
+	long double ylo = 0;
+	long double xhi = 0;
+	long double yhi = 0;
+	vector < int64_t * >gentries;
+	vector < struct gridmementry >buffered;
+
+	error = access.error;
 	if (error < 0) {
 		goto clean;
 	}
 
-	error == getGridEntry(dlon, dlat, &dge);
-	if (error < 0) {
-		goto clean;
-	}
+	*dsize = 0;
 
-	dge[0] = 0;
-	dge[1] = 0;
-	dge[2] = 0;
-	dge[3] = 0;
-	dge[4] = gridDirectory[0];
-	gridDirectory[0] += 1;
+	collectBufferedChanges(buffered, x1, y1, x2, y2, &nbuffered);
 
-	error = getGridPartitions(&avgx, &avgy, dlon, dlat);
+	getGridLocation(&lon1, &lat1, x1, y1);
+	getGridLocation(&lon2, &lat2, x2, y2);
+
+	error = getRangeBuckets(gentries, lon1, lat1, lon2, lat2);
 	if (error < 0) {
 		goto clean;
 	}
 
-	error = mapGridBucket(sge, &sb);
-	if (error < 0) {
-		goto clean;
+	sort(gentries.begin(), gentries.end(), isBucketBefore);
+
+	for (giter = 0; giter < (int64_t) gentries.size(); giter++) {
+		capacity += getBucketCapacity(gentries[giter]);
 	}
 
-	error = mapGridBucket(dge, &db);
+	error = allocateOutput(output,
+			       getBucketOutputSize(capacity) + 8 + nbuffered,
+			       records);
 	if (error < 0) {
-		unmapGridBucket(sge);
 		goto clean;
 	}
 
-	sbytes = sge[0];
-	sn = sge[1];
-	ssx = sge[2];
-	ssy = sge[3];
-
-	dbytes = dge[0];
-	dn = dge[1];
-	dsx = dge[2];
-	dsy = dge[3];
-
-	if (vertical) {
-		while (iter < sn) {
-			error = getBucketEntry(&cbe, sb, iter);
-			if (error < 0) {
-				goto pclean;
-			}
+	rrecords = (char *)(*records) + 8;
 
-			if (cbe[0] > avgx) {
-				appendBucketEntry(db, cbe[0], cbe[1], cbe[2],
-						  cbe + 3);
+	for (giter = 0; giter < (int64_t) gentries.size(); giter++) {
+		ge = gentries[giter];
 
-				sbytes -= (24 + cbe[2]);
-				dbytes += (24 + cbe[2]);
-				sn -= 1;
-				dn += 1;
-				ssx -= cbe[0];
-				ssy -= cbe[1];
-				dsx += cbe[0];
-				dsy += cbe[1];
+		xlo = ge[5] > 0 ? gridScale[2 + ge[5] - 1] + 1 : INT64_MIN;
+		xhi = ge[7] < xint ? gridScale[2 + ge[7]] : INT64_MAX;
+		ylo = ge[6] > 0 ? gridScale[2 + gridSize + ge[6] - 1] + 1 :
+		    INT64_MIN;
+		yhi = ge[8] < yint ? gridScale[2 + gridSize + ge[8]] :
+		    INT64_MAX;
 
-				error = deleteBucketEntry(sb, iter);
-				if (error < 0) {
-					goto pclean;
-				}
-			} else {
-				iter++;
-			}
+		region = classifyShapeRegion(shape, xlo, ylo, xhi, yhi);
+		if (region == REGION_OUTSIDE) {
+			continue;
 		}
-	} else {
-		while (iter < sn) {
-			error = getBucketEntry(&cbe, sb, iter);
-			if (error < 0) {
-				goto pclean;
-			}
 
-			if (cbe[1] > avgy) {
-				appendBucketEntry(db, cbe[0], cbe[1], cbe[2],
-						  cbe + 3);
+		error = mapGridBucket(ge, &gb);
+		if (error < 0) {
+			break;
+		}
 
-				sbytes -= (24 + cbe[2]);
-				dbytes += (24 + cbe[2]);
-				sn -= 1;
-				dn += 1;
-				ssx -= cbe[0];
-				ssy -= cbe[1];
-				dsx += cbe[0];
-				dsy += cbe[1];
+		be = (char *)(gb + 2);
+		for (iter = 0; iter < gb[1]; iter++) {
+			getEntryCoordinates(&bx, &by, (int64_t *) be);
 
-				error = deleteBucketEntry(sb, iter);
-				if (error < 0) {
-					goto pclean;
-				}
-			} else {
-				iter++;
+			if (region == REGION_INSIDE
+			    || isShapePoint(shape, bx, by)) {
+				bs = copyBucketEntry(rrecords, (int64_t *) be);
+				rrecords += bs;
+				*dsize += bs;
+				nr += 1;
 			}
-		}
-	}
 
-	sge[0] = sbytes;
-	sge[1] = sn;
-	sge[2] = ssx;
-	sge[3] = ssy;
+			be += headerSize + getEntrySize((int64_t *) be);
+		}
 
-	dge[0] = dbytes;
-	dge[1] = dn;
-	dge[2] = dsx;
-	dge[3] = dsy;
+		unmapGridBucket(gb);
+	}
 
-	error = updatePairedBuckets(1, dlon, dlat, sge[4]);
-	if (error < 0) {
-		goto pclean;
+	if (error == 0 && !buffered.empty()) {
+		mergeBufferedChanges(buffered, shape, (char *)(*records) + 8,
+				     &rrecords, &nr, dsize);
 	}
 
-	error = updatePairedBuckets(0, slon, slat, sge[4]);
+	((int64_t *) * records)[0] = nr;
 
- pclean:
-	unmapGridBucket(sb);
-	unmapGridBucket(db);
+	if (error == 0) {
+		error = finishOutput(output, *records, *dsize + 8);
+	}
 
  clean:
 	return error;
 }
 
-/* Checks if entries share buckets
+/* Retrieves records within circle, boundary included, into output
 
    Parameters:
-   isPaired: Zero if unpaired, one if paired is stored
-   slon: Source grid longitude
-   slat: Source grid latitude
-   dlon: Destination grid longitude
-   dlat: Destination grid latitude
+   x: Coordinate (x) of centre of circle
+   y: Coordinate (y) of centre of circle
+   radius: Radius of circle
+   output: Output to write records to, newly allocated buffer if none
+   dsize: Number of bytes written in buffer is stored
+   records: Buffer to hold retrieved records
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::checkPairedBucket(int *isPaired, int64_t slon, int64_t slat,
-				int64_t dlon, int64_t dlat)
+int gridfile::findCircleOutput(int64_t x, int64_t y, int64_t radius,
+			       struct gridbuffer *output, int64_t * dsize,
+			       void **records)
 {
-	int error = 0;
-	int64_t *ge = NULL;
-	int64_t *pge = NULL;
+	lock_guard < recursive_mutex > guard(gridLock);
+	struct gridshape shape;
 
-	error = getGridEntry(slon, slat, &ge);
-	if (error < 0) {
-		goto clean;
+	if (radius < 0) {
+		return -EINVAL;
 	}
 
-	error = getGridEntry(dlon, dlat, &pge);
-	if (error < 0) {
-		goto clean;
-	}
+	shape.x = x;
+	shape.y = y;
+	shape.radius = radius;
+	shape.nvertices = 0;
+	shape.xs = NULL;
+	shape.ys = NULL;
+
+	return findShapeRecords(&shape,
+				x >= INT64_MIN + radius ? x - radius :
+				INT64_MIN,
+				y >= INT64_MIN + radius ? y - radius :
+				INT64_MIN,
+				x <= INT64_MAX - radius ? x + radius :
+				INT64_MAX,
+				y <= INT64_MAX - radius ? y + radius :
+				INT64_MAX, output, dsize, records);
+}
 
-	if (ge[4] == pge[4]) {
-		*isPaired = 1;
-	}
+/* Retrieves records within circle, boundary included
 
- clean:
-	return error;
+   Parameters:
+   x: Coordinate (x) of centre of circle
+   y: Coordinate (y) of centre of circle
+   radius: Radius of circle
+   dsize: Number of bytes written in buffer is stored
+   records: Buffer to hold retrieved records
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::findCircleRecords(int64_t x, int64_t y, int64_t radius,
+				int64_t * dsize, void **records)
+{
+	return findCircleOutput(x, y, radius, NULL, dsize, records);
 }
 
-/* Checks if paired bucket for given bucket exists
+/* Retrieves records within circle into caller buffer or arena
 
    Parameters:
-   direction: Negative for backwards, positive for forwards, zero for both
-   isPaired: Zero if unpaired, one if paired is stored
-   vertical: Zero if latitude wise, one if longitude wise is stored
-   forward: Zero if backward, one if forward is stored
-   lon: Grid longitude of given bucket
-   lat: Grid latitude of given bucket
+   x: Coordinate (x) of centre of circle
+   y: Coordinate (y) of centre of circle
+   radius: Radius of circle
+   output: Output to write records to, bytes needed being stored
 
    Return:
-   Zero on success, error on failure
+   Zero on success, error on failure or if buffer is too small
 */
-int gridfile::hasPairedBucket(int direction, int *isPaired, int *vertical,
-			      int *forward, int64_t lon, int64_t lat)
+int gridfile::findCircleRecordsInto(int64_t x, int64_t y, int64_t radius,
+				    struct gridbuffer *output)
 {
-	int error = 0;
-	*isPaired = 0;
-	*vertical = 0;
-	*forward = 0;
-	int64_t xint = gridScale[1];
-	int64_t yint = gridScale[1 + gridSize];
+	int64_t ds = 0;
+	void *records = NULL;
 
-	if (direction <= 0) {
-		if (lon > 0) {
-			error =
-			    checkPairedBucket(isPaired, lon, lat, lon - 1, lat);
-			if (error < 0) {
-				goto clean;
-			}
+	return findCircleOutput(x, y, radius, output, &ds, &records);
+}
 
-			if (*isPaired) {
-				*vertical = 1;
-				goto clean;
-			}
-		}
+/* Retrieves records within simple polygon, edges included, into output
 
-		if (lat > 0) {
-			error =
-			    checkPairedBucket(isPaired, lon, lat, lon, lat - 1);
-			if (error < 0) {
-				goto clean;
-			}
+   Parameters:
+   xs: Coordinates (x) of vertices of polygon, in order along its edges
+   ys: Coordinates (y) of vertices of polygon, in order along its edges
+   nvertices: Number of vertices of polygon
+   output: Output to write records to, newly allocated buffer if none
+   dsize: Number of bytes written in buffer is stored
+   records: Buffer to hold retrieved records
 
-			if (*isPaired) {
-				goto clean;
-			}
-		}
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::findPolygonOutput(int64_t * xs, int64_t * ys,
+				int64_t nvertices, struct gridbuffer *output,
+				int64_t * dsize, void **records)
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+	struct gridshape shape;
+
+	if (nvertices < 3) {
+		return -EINVAL;
 	}
 
-	if (direction >= 0) {
-		*forward = 1;
-		if (lon < xint) {
-			error =
-			    checkPairedBucket(isPaired, lon, lat, lon + 1, lat);
-			if (error < 0) {
-				goto clean;
-			}
+	shape.x = 0;
+	shape.y = 0;
+	shape.radius = 0;
+	shape.nvertices = nvertices;
+	shape.xs = xs;
+	shape.ys = ys;
+
+	return findShapeRecords(&shape, *min_element(xs, xs + nvertices),
+				*min_element(ys, ys + nvertices),
+				*max_element(xs, xs + nvertices),
+				*max_element(ys, ys + nvertices), output,
+				dsize, records);
+}
 
-			if (*isPaired) {
-				*vertical = 1;
-				goto clean;
-			}
-		}
+/* Retrieves records within simple polygon, edges included
 
-		if (lat < yint) {
-			error =
-			    checkPairedBucket(isPaired, lon, lat, lon, lat + 1);
-			if (error < 0) {
-				goto clean;
-			}
+   Parameters:
+   xs: Coordinates (x) of vertices of polygon, in order along its edges
+   ys: Coordinates (y) of vertices of polygon, in order along its edges
+   nvertices: Number of vertices of polygon
+   dsize: Number of bytes written in buffer is stored
+   records: Buffer to hold retrieved records
 
-			if (*isPaired) {
-				goto clean;
-			}
-		}
-	}
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::findPolygonRecords(int64_t * xs, int64_t * ys,
+				 int64_t nvertices, int64_t * dsize,
+				 void **records)
+{
+	return findPolygonOutput(xs, ys, nvertices, NULL, dsize, records);
+}
 
- clean:
-	return error;
+/* Retrieves records within simple polygon into caller buffer or arena
+
+   Parameters:
+   xs: Coordinates (x) of vertices of polygon, in order along its edges
+   ys: Coordinates (y) of vertices of polygon, in order along its edges
+   nvertices: Number of vertices of polygon
+   output: Output to write records to, bytes needed being stored
+
+   Return:
+   Zero on success, error on failure or if buffer is too small
+*/
+int gridfile::findPolygonRecordsInto(int64_t * xs, int64_t * ys,
+				     int64_t nvertices,
+				     struct gridbuffer *output)
+{
+	int64_t ds = 0;
+	void *records = NULL;
+
+	return findPolygonOutput(xs, ys, nvertices, output, &ds, &records);
 }
 
-/* Inserts new record in the grid
+/* Computes split, merge and growth counts, number of buckets, pages and
+   records and bucket fill
 
    Parameters:
-   x: Coordinate (x) of new record
-   y: Coordinate (y) of new record
-   record: Buffer holding record data
-   rsize: Size of new record
+   stats: Grid statistics are stored
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::insertRecord(int64_t x, int64_t y, void *record, int64_t rsize)
+int gridfile::getGridStats(struct gridstats *stats)
 {
+	lock_guard < recursive_mutex > guard(gridLock);
+	gridaccess access(this, false);
 	int error = 0;
-	int64_t lon = 0;
-	int64_t lat = 0;
-	int64_t *ge = NULL;
-	int64_t nbytes = 0;
-	int64_t nrecords = 0;
-	int64_t capacity = 0;
-	int64_t esize = 24 + rsize;
-	int isPaired = -1;
-	int vertical = -1;
-	int forward = -1;
-	int split;
 	int64_t xint = gridScale[1];
 	int64_t yint = gridScale[1 + gridSize];
-	split = xint == yint ? 1 : 0;
-
-	getGridLocation(&lon, &lat, x, y);
+	int64_t xiter = 0;
+	int64_t yiter = 0;
+	int64_t nbytes = 0;
+	int64_t capacity = 0;
+	int64_t *ge = NULL;
+	vector < char >seen(gridDirectory[0], 0);
 
-	error = getGridEntry(lon, lat, &ge);
+	error = access.error;
 	if (error < 0) {
 		goto clean;
 	}
 
-	nbytes = ge[0];
-	nrecords = ge[1];
-	capacity = pageSize - 16 - nbytes;
-
-	if (esize <= capacity) {
-		error = insertGridRecord(ge, x, y, record, rsize);
-		if (error < 0) {
-			goto clean;
-		}
-
-		error = updatePairedBuckets(0, lon, lat, ge[4]);
-		if (error < 0) {
-			goto clean;
-		}
-	} else {
-		error =
-		    hasPairedBucket(0, &isPaired, &vertical, &forward, lon,
-				    lat);
-		if (error < 0) {
-			goto clean;
-		}
-
-		if (isPaired) {
-			if (vertical) {
-				if (forward) {
-					error =
-					    splitBucket(vertical, lon, lat,
-							lon + 1, lat);
-				} else {
-					error =
-					    splitBucket(vertical, lon - 1, lat,
-							lon, lat);
-				}
-			} else {
-				if (forward) {
-					error =
-					    splitBucket(vertical, lon, lat, lon,
-							lat + 1);
-				} else {
-					error =
-					    splitBucket(vertical, lon, lat - 1,
-							lon, lat);
-				}
-			}
+	stats->gridSplits = gridSplits;
+	stats->bucketSplits = bucketSplits;
+	stats->bucketMerges = bucketMerges;
+	stats->bucketGrowths = bucketGrowths;
+	stats->buckets = 0;
+	stats->pages = gridDirectory[0];
+	stats->records = 0;
+	stats->fill = 0;
 
+	for (xiter = 0; xiter <= xint; xiter++) {
+		for (yiter = 0; yiter <= yint; yiter++) {
+			error = getGridEntry(xiter, yiter, &ge);
 			if (error < 0) {
 				goto clean;
 			}
-		} else {
-			error = splitGrid(split, lon, lat, x, y);
-			if (error < 0) {
-				goto clean;
+
+			if (seen[ge[4]]) {
+				continue;
 			}
-		}
 
-		error = insertRecord(x, y, record, rsize);
+			seen[ge[4]] = 1;
+			nbytes += ge[0];
+			capacity += getBucketCapacity(ge);
+			stats->buckets += 1;
+			stats->records += ge[1];
+		}
 	}
 
+	stats->fill = (double)nbytes / capacity;
+
  clean:
 	return error;
 }
 
-/* Retrieves record for given coordinates
+/* Writes frozen copy of grid to single read-only file, served by
+   frozengrid. Buckets are packed back to back in Z-order of their regions,
+   without slack of pages, each grid entry keeping only the index of its
+   bucket. File is written aside and renamed into place once complete.
 
    Parameters:
-   x: Coordinate (x) of record to be retrieved
-   y: Coordinate (y) of record to be retrieved
-   record: Buffer to hold retrieved record
+   path: Name of frozen grid file
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::findRecord(int64_t x, int64_t y, void **record)
+int gridfile::freezeGrid(string path)
 {
+	lock_guard < recursive_mutex > guard(gridLock);
+	gridaccess access(this, false);
 	int error = 0;
-	int found = 0;
-	int64_t lon = 0;
-	int64_t lat = 0;
+	int64_t xint = gridScale[1];
+	int64_t yint = gridScale[1 + gridSize];
+	int64_t xiter = 0;
+	int64_t yiter = 0;
+	int64_t iter = 0;
+	int64_t offset = 0;
 	int64_t *ge = NULL;
 	int64_t *gb = NULL;
-	int64_t nrecords = 0;
-	int64_t iter = 0;
-	int64_t *be = NULL;
-	int64_t bex = 0;
-	int64_t bey = 0;
-	int64_t rsize = 0;
+	FILE *f = NULL;
+	string tname = path + ".tmp";
+	struct gridfrozen header;
+	vector < int64_t * >gentries;
+	vector < pair < uint64_t, int64_t * > >order;
+	vector < int64_t > index(gridDirectory[0], 0);
+	vector < int64_t > buckets;
+	vector < uint32_t > cells;
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
 
-	*record = (void *)malloc(pageSize);
-	if (*record == NULL) {
-		error = -ENOMEM;
+	error = getRangeBuckets(gentries, 0, 0, xint, yint);
+	if (error < 0) {
 		goto clean;
 	}
 
-	getGridLocation(&lon, &lat, x, y);
+	for (iter = 0; iter < (int64_t) gentries.size(); iter++) {
+		ge = gentries[iter];
+		order.push_back(make_pair(getBucketOrder(ge[5], ge[6]), ge));
+	}
 
-	error = getGridEntry(lon, lat, &ge);
-	if (error < 0) {
-		goto clean;
+	sort(order.begin(), order.end());
+
+	memset(&header, 0, sizeof(header));
+	header.magic = FROZEN_MAGIC;
+	header.recordSize = recordSize;
+	header.coordinateSize = coordinateSize;
+	header.xparts = xint;
+	header.yparts = yint;
+	header.buckets = order.size();
+
+	for (iter = 0; iter < (int64_t) order.size(); iter++) {
+		ge = order[iter].second;
+		index[ge[4]] = iter;
+		buckets.push_back(offset);
+		buckets.push_back(ge[1]);
+		buckets.insert(buckets.end(), ge + 5, ge + 9);
+		offset += ge[0];
+		header.records += ge[1];
 	}
+	header.dataSize = offset;
 
-	error = mapGridBucket(ge, &gb);
-	if (error < 0) {
+	for (xiter = 0; xiter <= xint; xiter++) {
+		for (yiter = 0; yiter <= yint; yiter++) {
+			error = getGridEntry(xiter, yiter, &ge);
+			if (error < 0) {
+				goto clean;
+			}
+
+			cells.push_back(index[ge[4]]);
+		}
+	}
+
+	if (cells.size() % 2) {
+		cells.push_back(0);
+	}
+
+	f = fopen(tname.c_str(), "w");
+	if (f == NULL) {
+		error = -errno;
 		goto clean;
 	}
 
-	nrecords = gb[1];
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(gridScale + 2, 8, xint, f);
+	fwrite(gridScale + 2 + gridSize, 8, yint, f);
+	fwrite(cells.data(), 4, cells.size(), f);
+	fwrite(buckets.data(), 8, buckets.size(), f);
 
-	for (iter = 0; iter < nrecords; iter++) {
-		error = getBucketEntry(&be, gb, iter);
+	for (iter = 0; iter < (int64_t) order.size(); iter++) {
+		ge = order[iter].second;
+
+		error = mapGridBucket(ge, &gb);
 		if (error < 0) {
 			goto pclean;
 		}
 
-		bex = be[0];
-		bey = be[1];
-		rsize = be[2];
+		fwrite(gb + 2, 1, ge[0], f);
+		unmapGridBucket(gb);
+	}
 
-		if (bex == x && bey == y) {
-			found = 1;
-			memcpy(*record, be + 3, rsize);
-			break;
-		}
+	if (fflush(f) != 0 || ferror(f) || fsync(fileno(f)) < 0) {
+		error = -EIO;
 	}
 
  pclean:
-	unmapGridBucket(gb);
+	fclose(f);
 
- clean:
-	if (!found) {
-		error = -EINVAL;
+	if (error == 0 && rename(tname.c_str(), path.c_str()) < 0) {
+		error = -errno;
 	}
 
+	if (error < 0) {
+		unlink(tname.c_str());
+	}
+
+ clean:
 	return error;
 }
 
-/* Deletes record for given coordinates
+/* Computes lower bound of squared distance from given coordinates to any
+   coordinates of grid entry
 
    Parameters:
-   x: Coordinate (x) pf record to be deleted
-   y: Coordinate (y) of record to be deleted
+   lon: Grid longitude of entry
+   lat: Grid latitude of entry
+   x: Coordinate (x)
+   y: Coordinate (y)
+
+   Return:
+   Squared distance from coordinates to region of entry
+*/
+double gridfile::getGridDistance(int64_t lon, int64_t lat, int64_t x,
+				 int64_t y)
+{
+	int64_t xint = gridScale[1];
+	int64_t yint = gridScale[1 + gridSize];
+	double dx = 0;
+	double dy = 0;
+
+	if (lon > 0 && x <= gridScale[2 + lon - 1]) {
+		dx = (double)gridScale[2 + lon - 1] + 1 - x;
+	} else if (lon < xint && x > gridScale[2 + lon]) {
+		dx = (double)x - gridScale[2 + lon];
+	}
+
+	if (lat > 0 && y <= gridScale[2 + gridSize + lat - 1]) {
+		dy = (double)gridScale[2 + gridSize + lat - 1] + 1 - y;
+	} else if (lat < yint && y > gridScale[2 + gridSize + lat]) {
+		dy = (double)y - gridScale[2 + gridSize + lat];
+	}
+
+	return dx * dx + dy * dy;
+}
+
+/* Retrieves k records closest to given coordinates. Grid entries are
+   visited in order of their distance from coordinates, expanding from
+   entry holding coordinates to its neighbours, until no entry left can
+   hold a record closer than k-th closest record found. Records are
+   written to output.
+
+   Parameters:
+   x: Coordinate (x) of query
+   y: Coordinate (y) of query
+   k: Number of records to be retrieved
+   output: Output to write records to, newly allocated buffer if none
+   dsize: Number of bytes written in buffer is stored
+   records: Buffer to hold number of retrieved records followed by records
+   in increasing order of distance
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::deleteRecord(int64_t x, int64_t y)
+int gridfile::findNearestOutput(int64_t x, int64_t y, int64_t k,
+				struct gridbuffer *output, int64_t * dsize,
+				void **records)
 {
+	lock_guard < recursive_mutex > guard(gridLock);
+	gridaccess access(this, false);
 	int error = 0;
-	int found = 0;
+	int64_t xint = gridScale[1];
+	int64_t yint = gridScale[1 + gridSize];
 	int64_t lon = 0;
 	int64_t lat = 0;
+	int64_t nlon = 0;
+	int64_t nlat = 0;
+	int64_t iter = 0;
+	int64_t bx = 0;
+	int64_t by = 0;
+	int64_t rsize = 8;
 	int64_t *ge = NULL;
-	int64_t sx = 0;
-	int64_t sy = 0;
 	int64_t *gb = NULL;
-	int64_t nrecords = 0;
-	int64_t iter = 0;
 	int64_t *be = NULL;
-	int64_t bex = 0;
-	int64_t bey = 0;
-	int64_t rsize = 0;
-
-	getGridLocation(&lon, &lat, x, y);
-
-	error = getGridEntry(lon, lat, &ge);
+	char *rrecords = NULL;
+	double distance = 0;
+	int64_t neighbours[4][2] = { {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+	vector < char >vcells((xint + 1) * (yint + 1), 0);
+	vector < char >vbuckets(gridDirectory[0], 0);
+	priority_queue < pair < double, pair < int64_t, int64_t > >,
+	    vector < pair < double, pair < int64_t, int64_t > > >,
+	    greater < pair < double, pair < int64_t, int64_t > > > >cells;
+	priority_queue < pair < double, string > >nearest;
+	vector < pair < double, string > >found;
+
+	error = access.error;
 	if (error < 0) {
 		goto clean;
 	}
 
-	sx = ge[2];
-	sy = ge[3];
-
-	error = mapGridBucket(ge, &gb);
-	if (error < 0) {
+	if (k <= 0) {
+		error = -EINVAL;
 		goto clean;
 	}
 
-	nrecords = gb[1];
+	getGridLocation(&lon, &lat, x, y);
+	cells.push(make_pair(0.0, make_pair(lon, lat)));
+	vcells[lon * (yint + 1) + lat] = 1;
 
-	for (iter = 0; iter < nrecords; iter++) {
-		error = getBucketEntry(&be, gb, iter);
+	while (!cells.empty()) {
+		distance = cells.top().first;
+		lon = cells.top().second.first;
+		lat = cells.top().second.second;
+		cells.pop();
+
+		if ((int64_t) nearest.size() == k
+		    && distance > nearest.top().first) {
+			break;
+		}
+
+		for (iter = 0; iter < 4; iter++) {
+			nlon = lon + neighbours[iter][0];
+			nlat = lat + neighbours[iter][1];
+
+			if (nlon < 0 || nlon > xint || nlat < 0 || nlat > yint
+			    || vcells[nlon * (yint + 1) + nlat]) {
+				continue;
+			}
+
+			vcells[nlon * (yint + 1) + nlat] = 1;
+			cells.push(make_pair(getGridDistance(nlon, nlat, x, y),
+					     make_pair(nlon, nlat)));
+		}
+
+		error = getGridEntry(lon, lat, &ge);
 		if (error < 0) {
-			goto pclean;
+			goto clean;
 		}
 
-		bex = be[0];
-		bey = be[1];
-		rsize = be[2];
+		if (vbuckets[ge[4]]) {
+			continue;
+		}
 
-		if (bex == x && bey == y) {
-			found = 1;
-			error = deleteBucketEntry(gb, iter);
-			ge[0] -= (24 + rsize);
-			ge[1] -= 1;
-			ge[2] = sx - bex;
-			ge[3] = sy - bey;
-			break;
+		vbuckets[ge[4]] = 1;
+
+		error = mapGridBucket(ge, &gb);
+		if (error < 0) {
+			goto clean;
+		}
+
+		for (iter = 0; iter < gb[1]; iter++) {
+			error = getBucketEntry(&be, gb, iter);
+			if (error < 0) {
+				unmapGridBucket(gb);
+				goto clean;
+			}
+
+			getEntryCoordinates(&bx, &by, be);
+			distance = ((double)bx - x) * ((double)bx - x) +
+			    ((double)by - y) * ((double)by - y);
+
+			if ((int64_t) nearest.size() == k
+			    && distance >= nearest.top().first) {
+				continue;
+			}
+
+			nearest.push(make_pair(distance,
+					       string((char *)be,
+						      headerSize +
+						      getEntrySize(be))));
+			if ((int64_t) nearest.size() > k) {
+				nearest.pop();
+			}
 		}
+
+		unmapGridBucket(gb);
 	}
 
-	if (found) {
-		error = updatePairedBuckets(0, lon, lat, ge[4]);
+	while (!nearest.empty()) {
+		found.push_back(nearest.top());
+		rsize += 24 + getEntrySize((int64_t *) found.back().second.data());
+		nearest.pop();
 	}
 
- pclean:
-	unmapGridBucket(gb);
+	error = allocateOutput(output, rsize, records);
+	if (error < 0) {
+		goto clean;
+	}
 
- clean:
-	if (!found) {
-		error = -EINVAL;
+	((int64_t *) * records)[0] = found.size();
+	rrecords = (char *)(*records) + 8;
+
+	for (iter = found.size() - 1; iter >= 0; iter--) {
+		bx = copyBucketEntry(rrecords,
+				     (int64_t *) found[iter].second.data());
+		rrecords += bx;
+		*dsize += bx;
 	}
 
+	error = finishOutput(output, *records, rsize);
+
+ clean:
 	return error;
 }
 
-/* Retrieves record within specified coordinate range
+/* Retrieves k records closest to given coordinates
+
+   Parameters:
+   x: Coordinate (x) of query
+   y: Coordinate (y) of query
+   k: Number of records to be retrieved
+   dsize: Number of bytes written in buffer is stored
+   records: Buffer to hold number of retrieved records followed by records
+   in increasing order of distance
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::findNearestRecords(int64_t x, int64_t y, int64_t k,
+				 int64_t * dsize, void **records)
+{
+	return findNearestOutput(x, y, k, NULL, dsize, records);
+}
+
+/* Retrieves k records closest to given coordinates into caller buffer or
+   arena
 
    Parameters:
+   x: Coordinate (x) of query
+   y: Coordinate (y) of query
+   k: Number of records to be retrieved
+   output: Output to write records to, bytes needed being stored
+
+   Return:
+   Zero on success, error on failure or if buffer is too small
+*/
+int gridfile::findNearestRecordsInto(int64_t x, int64_t y, int64_t k,
+				     struct gridbuffer *output)
+{
+	int64_t ds = 0;
+	void *records = NULL;
+
+	return findNearestOutput(x, y, k, output, &ds, &records);
+}
+
+/* Checks if all coordinates of region of grid entries lie within range
+
+   Parameters:
+   lon1: Lowest grid longitude of region
+   lat1: Lowest grid latitude of region
+   lon2: Highest grid longitude of region
+   lat2: Highest grid latitude of region
    x1: Coordinate (x) representing lower left corner of range
    y1: Coordinate (y) representing lower left corner of range
    x2: Coordinate (x) representing upper right corner of range
-   y2: Coordinate (y) represeting upper left corner of range
-   dsize: Number of bytes written in buffer is stored
-   records: Buffer to hold retrieved records
+   y2: Coordinate (y) representing upper right corner of range
+
+   Return:
+   One if region is covered by range, zero otherwise
+*/
+int gridfile::isRegionCovered(int64_t lon1, int64_t lat1, int64_t lon2,
+			      int64_t lat2, int64_t x1, int64_t y1,
+			      int64_t x2, int64_t y2)
+{
+	int64_t xint = gridScale[1];
+	int64_t yint = gridScale[1 + gridSize];
+	int64_t xlo = lon1 > 0 ? gridScale[2 + lon1 - 1] + 1 : INT64_MIN;
+	int64_t xhi = lon2 < xint ? gridScale[2 + lon2] : INT64_MAX;
+	int64_t ylo =
+	    lat1 > 0 ? gridScale[2 + gridSize + lat1 - 1] + 1 : INT64_MIN;
+	int64_t yhi = lat2 < yint ? gridScale[2 + gridSize + lat2] : INT64_MAX;
+
+	return x1 <= xlo && xhi <= x2 && y1 <= ylo && yhi <= y2;
+}
+
+/* Aggregates count and coordinate sums of records within range. Buckets
+   whose region is covered by range are answered from grid entry
+   statistics, only buckets on boundary of range are read. Changes buffered
+   in memtable are added, their deletes being of records of buckets.
+
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   count: Number of records is stored
+   sx: Sum of coordinates (x) of records is stored
+   sy: Sum of coordinates (y) of records is stored
 
    Return:
    Zero on success, error on failure
 */
-int gridfile::findRangeRecords(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
-			       int64_t * dsize, void **records)
+int gridfile::aggregateRange(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			     int64_t * count, int64_t * sx, int64_t * sy)
 {
+	gridaccess access(this, false, true);
 	int error = 0;
 	int64_t lon1 = 0;
 	int64_t lat1 = 0;
 	int64_t lon2 = 0;
 	int64_t lat2 = 0;
+	int64_t giter = 0;
 	int64_t iter = 0;
-	int64_t xiter = 0;
-	int64_t yiter = 0;
+	int64_t bx = 0;
+	int64_t by = 0;
+	int64_t nr = 0;
+	int64_t nbuffered = 0;
 	int64_t *ge = NULL;
 	int64_t *gb = NULL;
 	int64_t *be = NULL;
-	int64_t nrecords = 0;
-	int64_t nr = 0;
-	int64_t bx = 0;
-	int64_t by = 0;
-	int64_t bs = 0;
-	int64_t rsize = 0;
-	char *rrecords = NULL;
-	int isPaired = 0;
-	int vertical = -1;
-	int forward = -1;
+	vector < int64_t * >gentries;
+	vector < struct gridmementry >buffered;
+
+	error = access.error;
+	if (error < 0) {
+		goto clean;
+	}
+
+	*count = 0;
+	*sx = 0;
+	*sy = 0;
+
+	collectBufferedChanges(buffered, x1, y1, x2, y2, &nbuffered);
+
+	for (iter = 0; iter < (int64_t) buffered.size(); iter++) {
+		nr = buffered[iter].records.size() - buffered[iter].deletes;
+		*count += nr;
+		*sx += buffered[iter].x * nr;
+		*sy += buffered[iter].y * nr;
+	}
 
 	getGridLocation(&lon1, &lat1, x1, y1);
 	getGridLocation(&lon2, &lat2, x2, y2);
 
-	rsize = (lon2 - lon1 + 1) * (lat2 - lat1 + 1) * pageSize;
-	*records = (void *)malloc(rsize);
-	if (*records == NULL) {
-		error = -ENOMEM;
+	error = getRangeBuckets(gentries, lon1, lat1, lon2, lat2);
+	if (error < 0) {
 		goto clean;
 	}
 
-	rrecords = (char *)(*records) + 8;
+	sort(gentries.begin(), gentries.end(), isBucketBefore);
 
-	for (xiter = lon1; xiter <= lon2; xiter++) {
-		for (yiter = lat1; yiter <= lat2; yiter++) {
-			error = getGridEntry(xiter, yiter, &ge);
-			if (error < 0) {
-				goto clean;
-			}
+	for (giter = 0; giter < (int64_t) gentries.size(); giter++) {
+		ge = gentries[giter];
 
-			error =
-			    hasPairedBucket(-1, &isPaired, &vertical, &forward,
-					    xiter, yiter);
+		if (isRegionCovered(ge[5], ge[6], ge[7], ge[8], x1, y1, x2,
+				    y2)) {
+			*count += ge[1];
+			*sx += ge[2];
+			*sy += ge[3];
+			continue;
+		}
+
+		error = mapGridBucket(ge, &gb);
+		if (error < 0) {
+			goto clean;
+		}
+
+		for (iter = 0; iter < gb[1]; iter++) {
+			error = getBucketEntry(&be, gb, iter);
 			if (error < 0) {
+				unmapGridBucket(gb);
 				goto clean;
 			}
 
-			if (isPaired
-			    && !((xiter == lon1 && vertical)
-				 || (yiter == lat1 && !vertical))) {
-				continue;
-			}
+			getEntryCoordinates(&bx, &by, be);
 
-			error = mapGridBucket(ge, &gb);
-			if (error < 0) {
-				goto clean;
+			if (bx >= x1 && bx <= x2 && by >= y1 && by <= y2) {
+				*count += 1;
+				*sx += bx;
+				*sy += by;
 			}
+		}
 
-			nrecords = gb[1];
+		unmapGridBucket(gb);
+	}
 
-			for (iter = 0; iter < nrecords; iter++) {
-				error = getBucketEntry(&be, gb, iter);
-				if (error < 0) {
-					unmapGridBucket(gb);
-					goto clean;
-				}
+ clean:
+	return error;
+}
 
-				bx = be[0];
-				by = be[1];
-				bs = be[2];
+/* Counts records within specified coordinate range
 
-				if (bx >= x1 && bx <= x2 && by >= y1
-				    && by <= y2) {
-					nr += 1;
-					memcpy(rrecords, be, 24 + bs);
-					rrecords += (24 + bs);
-					*dsize += (24 + bs);
-				}
-			}
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   count: Number of records is stored
 
-			unmapGridBucket(gb);
-		}
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::countInRange(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			   int64_t * count)
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+	int64_t sx = 0;
+	int64_t sy = 0;
+
+	return aggregateRange(x1, y1, x2, y2, count, &sx, &sy);
+}
+
+/* Sums coordinates of records within specified coordinate range
+
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   sx: Sum of coordinates (x) of records is stored
+   sy: Sum of coordinates (y) of records is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::sumInRange(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			 int64_t * sx, int64_t * sy)
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+	int64_t count = 0;
+
+	return aggregateRange(x1, y1, x2, y2, &count, sx, sy);
+}
+
+/* Computes centroid of records within specified coordinate range
+
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   cx: Mean coordinate (x) of records is stored
+   cy: Mean coordinate (y) of records is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfile::centroidInRange(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			      double *cx, double *cy)
+{
+	lock_guard < recursive_mutex > guard(gridLock);
+	int error = 0;
+	int64_t count = 0;
+	int64_t sx = 0;
+	int64_t sy = 0;
+
+	error = aggregateRange(x1, y1, x2, y2, &count, &sx, &sy);
+	if (error < 0) {
+		goto clean;
 	}
 
-	((int64_t *) * records)[0] = nr;
+	if (count == 0) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	*cx = (double)sx / count;
+	*cy = (double)sy / count;
 
  clean:
 	return error;
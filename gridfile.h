@@ -8,70 +8,530 @@
 #include <unistd.h>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <atomic>
+#include <map>
+#include <pthread.h>
 
 using namespace std;
 
+#define SPLIT_MEAN 0
+#define SPLIT_QUANTILE 1
+
+#define MAXPROCESSES 64
+#define WAIT_MIN 1000
+#define WAIT_MAX 64000
+
+#define ARENA_CHUNK (1 << 20)
+
+#define LOG_INSERT 1
+#define LOG_DELETE 2
+#define LOG_UPDATE 3
+#define LOG_MOVE 4
+#define LOG_RELOCATE 5
+#define LOG_COMPACT 6
+
+#define FROZEN_MAGIC 0x314e5a4f52464447
+#define FROZEN_BUCKET 6
+
+#define META_MAGIC 0x4154454d44495247
+#define META_VERSION 2
+
 struct gridconfig {
 	int64_t size;
 	int64_t psize;
 	string name;
+	int64_t fsize = 0;
+	int64_t csize = 8;
+	int split = SPLIT_QUANTILE;
+	double quantile = 0.5;
+	double rcost = 4;
+	int64_t pages = 8;
+};
+
+struct gridstats {
+	int64_t gridSplits;
+	int64_t bucketSplits;
+	int64_t bucketMerges;
+	int64_t bucketGrowths;
+	int64_t buckets;
+	int64_t pages;
+	int64_t records;
+	double fill;
+};
+
+struct gridshape {
+	int64_t x;
+	int64_t y;
+	int64_t radius;
+	int64_t nvertices;
+	int64_t *xs;
+	int64_t *ys;
+};
+
+struct gridrequest {
+	int type;
+	int64_t x1 = 0;
+	int64_t y1 = 0;
+	int64_t x2 = 0;
+	int64_t y2 = 0;
+	void *record = NULL;
+	int64_t rsize = 0;
+	int64_t *dsize = NULL;
+	void **records = NULL;
+	promise < int > done;
+};
+
+/* Arena handing out memory for results of read operations by bumping
+   offset within chunks it keeps, all results being released at once by
+   reset while chunks are kept for reuse
+*/
+struct gridarena {
+ private:
+	vector < char *>chunks;
+	vector < int64_t > sizes;
+	int64_t chunk = 0;
+	int64_t used = 0;
+	int64_t last = 0;
+
+ public:
+	~gridarena();
+	int allocate(int64_t size, void **addr);
+	void shrink(void *addr, int64_t size);
+	void reset();
+};
+
+/* Output of read operation, written to caller buffer data of given size or,
+   if arena is given, to memory taken from arena, data and size then being
+   stored. Bytes taken by result are stored in needed, also when buffer is
+   too small for result so that caller can grow it and retry
+*/
+struct gridbuffer {
+	void *data = NULL;
+	int64_t size = 0;
+	struct gridarena *arena = NULL;
+	int64_t needed = 0;
+};
+
+/* Entry of change log, followed by size bytes of record. Splits are not
+   logged as replaying changes in order splits buckets and grid alike
+*/
+struct gridlogentry {
+	int64_t lsn;
+	int64_t type;
+	int64_t time;
+	int64_t x;
+	int64_t y;
+	int64_t nx;
+	int64_t ny;
+	int64_t size;
+};
+
+/* Metadata of grid kept in file of its own, so that grid is opened by
+   name. Sizes of grid files are not kept, being read from the files and
+   the coordination segment, which are current also after a crash
+*/
+struct gridmeta {
+	int64_t magic;
+	int64_t version;
+	int64_t pageSize;
+	int64_t recordSize;
+	int64_t coordinateSize;
+	int64_t splitPolicy;
+	double splitQuantile;
+	double randomCost;
+	int64_t gridSplits;
+	int64_t bucketSplits;
+	int64_t bucketMerges;
+	int64_t bucketPages;
+	int64_t bucketGrowths;
+};
+
+/* Header of frozen grid file. It is followed by partitions of scale (x,
+   then y), index of bucket of each grid entry as 32 bit word, padded to 8
+   bytes, offset into packed entries, number of records and region of each
+   bucket (FROZEN_BUCKET words), and bucket entries packed back to back
+*/
+struct gridfrozen {
+	int64_t magic;
+	int64_t recordSize;
+	int64_t coordinateSize;
+	int64_t xparts;
+	int64_t yparts;
+	int64_t buckets;
+	int64_t records;
+	int64_t dataSize;
+};
+
+/* Slot of process sharing grid, active while process reads grid
+*/
+struct gridslot {
+	atomic < int64_t > pid;
+	atomic < int64_t > active;
+};
+
+/* Coordination segment shared by processes of grid: writers are serialized
+   by robust lock and, while writing, keep readers of other processes out.
+   Epoch is advanced by every write so that processes pick up grid and
+   bucket file sizes changed by other processes before using their maps.
+   Readers waiting for writing to end and writers waiting for readers to
+   leave sleep on futexes of writer and reader signals
+*/
+struct gridshared {
+	pthread_mutex_t writerLock;
+	atomic < int64_t > writing;
+	atomic < int32_t > writerSignal;
+	atomic < int32_t > readerSignal;
+	atomic < int64_t > epoch;
+	atomic < int64_t > gridSize;
+	atomic < int64_t > bucketSize;
+	struct gridslot slots[MAXPROCESSES];
+};
+
+/* Access of process to shared grid for the duration of an operation.
+   Changes buffered in memtable are flushed to buckets first unless the
+   operation reads them itself
+*/
+struct gridaccess {
+	struct gridfile *grid;
+	bool exclusive;
+	int error;
+
+	gridaccess(struct gridfile *agrid, bool aexclusive, bool abuffered =
+		   false);
+	~gridaccess();
+};
+
+/* Changes buffered for coordinates: deletes of records in buckets, applied
+   first, and records inserted
+*/
+struct gridmementry {
+	int64_t x = 0;
+	int64_t y = 0;
+	int64_t deletes = 0;
+	deque < string > records;
+};
+
+/* Exclusive hold of grid by writing thread, taken once views of process
+   are released so that no view sees its record change
+*/
+struct gridwriter {
+	struct gridfile *grid;
+	bool outermost;
+
+	gridwriter(struct gridfile *wgrid);
+	~gridwriter();
+};
+
+/* View of record inside mapped bucket page, keeping page mapped and its
+   record unchanged until view is released or destroyed. Views are moved,
+   not copied, and must be released before their thread writes to grid
+*/
+struct gridview {
+	friend struct gridfile;
+
+ private:
+	struct gridfile *grid = NULL;
+	int64_t *page = NULL;
+	void *data = NULL;
+	int64_t size = 0;
+
+ public:
+	gridview() = default;
+	gridview(const gridview &) = delete;
+	gridview & operator=(const gridview &) = delete;
+	gridview(gridview && view);
+	gridview & operator=(gridview && view);
+	~gridview();
+	const void *getData();
+	int64_t getSize();
+	void release();
 };
 
 struct gridfile {
+	friend struct gridaccess;
+	friend struct gridwriter;
+	friend struct gridview;
+
  private:
 	int64_t gridSize;
 	int64_t pageSize;
 	int64_t scaleSize;
 	int64_t directorySize;
 	int64_t bucketSize;
+	int64_t recordSize;
+	int64_t coordinateSize;
+	int64_t headerSize;
+	int splitPolicy;
+	double splitQuantile;
+	double randomCost;
+	int64_t gridSplits;
+	int64_t bucketSplits;
+	int64_t bucketMerges;
+	int64_t bucketPages;
+	int64_t bucketGrowths;
 	string gridName;
 	string scaleName;
 	string directoryName;
 	string bucketName;
+	string sharedName;
+	string metaName;
 	int64_t *gridScale;
 	int64_t *gridDirectory;
+	mutex mappingLock;
+	map < int64_t *, int64_t >bucketMappings;
+	recursive_mutex gridLock;
+	mutex compactorLock;
+	condition_variable compactorSignal;
+	thread compactor;
+	bool compactorStop;
+	int bucketFd;
+	mutex executorLock;
+	condition_variable executorSignal;
+	deque < struct gridrequest > requests;
+	thread executor;
+	bool executorStop;
+	struct gridshared *gridShared;
+	int64_t sharedEpoch;
+	int64_t sharedSlot;
+	int64_t accessDepth;
+	int logFd;
+	int64_t logLsn;
+	vector < char >outputScratch;
+	mutex viewLock;
+	condition_variable viewSignal;
+	int64_t pinnedViews;
+	atomic < thread::id > writerThread;
+	mutex memLock;
+	condition_variable memSignal;
+	map < pair < int64_t, int64_t >, struct gridmementry >memTable;
+	int64_t memBytes;
+	int64_t memLimit;
+	bool memStop;
+	thread flusher;
 
+	int setGridConfig(struct gridconfig *configuration);
 	int createFile(int64_t size, string fname, const char *mode);
+	int createGridShared();
+	int writeGridMeta();
+	int readGridMeta(string name, struct gridconfig *configuration,
+			 struct gridmeta *meta);
+	int mapGridShared();
+	void unmapGridShared();
+	int refreshGrid();
+	int recoverGrowth(string name, int64_t * size);
+	void recoverWriter();
+	void waitReaders();
+	int enterGrid(bool exclusive);
+	void leaveGrid(bool exclusive);
+	void pinView();
+	void unpinView(int64_t * page);
+	int mapRecordView(int64_t x, int64_t y, struct gridview *view);
+	int checkRecord(int64_t x, int64_t y, int64_t rsize);
+	int storeRecord(int64_t x, int64_t y, void *record, int64_t rsize);
+	int eraseRecord(int64_t x, int64_t y);
+	int bufferInsert(int64_t x, int64_t y, void *record, int64_t rsize);
+	int bufferDelete(int64_t x, int64_t y);
+	void collectBufferedChanges(vector < struct gridmementry >&buffered,
+				    int64_t x1, int64_t y1, int64_t x2,
+				    int64_t y2, int64_t * nbytes);
+	void mergeBufferedChanges(vector < struct gridmementry >&buffered,
+				  struct gridshape *shape, char *start,
+				  char **rrecords, int64_t * nr,
+				  int64_t * dsize);
+	int findBufferedRecord(int64_t x, int64_t y, string ** record,
+			       int64_t * deletes);
+	int findMatchingEntry(int64_t ** bentry, int64_t * gbucket, int64_t x,
+			      int64_t y, int64_t skip);
+	int closeBucketRun(int64_t ** gbucket, int64_t lon, int64_t lat);
+	int flushMemtable();
+	int applyMemtable();
+	void runFlusher();
+	int logChange(int64_t type, int64_t x, int64_t y, int64_t nx,
+		      int64_t ny, void *record, int64_t rsize);
+	int mapFile(int64_t size, string fname, int64_t ** addr);
 	int mapGridScale();
 	void unmapGridScale();
 	int mapGridDirectory();
 	void unmapGridDirectory();
 	void getGridLocation(int64_t * lon, int64_t * lat, int64_t x,
 			     int64_t y);
-	int insertGridPartition(int lon, int64_t partition);
+	int insertGridPartition(int lon, int64_t partition,
+				int64_t * ipartition);
 	int getGridPartitions(int64_t * x, int64_t * y, int64_t lon,
 			      int64_t lat);
 	int getGridEntry(int64_t lon, int64_t lat, int64_t ** gentry);
+	int growGrid();
+	int allocateGridBucket(int64_t * baddr, int64_t npages);
 	int mapGridBucket(int64_t * gentry, int64_t ** gbucket);
 	void unmapGridBucket(int64_t * gbucket);
+	int64_t getBucketPages(int64_t * gentry);
+	int64_t getBucketCapacity(int64_t * gentry);
+	int64_t getExtentOrder(int64_t nbytes);
+	void getEntryCoordinates(int64_t * x, int64_t * y, int64_t * bentry);
+	void setEntryCoordinates(int64_t * bentry, int64_t x, int64_t y);
+	int64_t getEntrySize(int64_t * bentry);
+	void *getEntryRecord(int64_t * bentry);
+	int64_t copyBucketEntry(char *dest, int64_t * bentry);
+	int64_t getBucketOutputSize(int64_t capacity);
 	void appendBucketEntry(int64_t * gbucket, int64_t x, int64_t y,
 			       int64_t rsize, void *record);
 	int getBucketEntry(int64_t ** bentry, int64_t * gbucket, int64_t entry);
+	int findBucketEntry(int64_t ** bentry, int64_t * entry,
+			    int64_t * gbucket, int64_t x, int64_t y);
 	int deleteBucketEntry(int64_t * gbucket, int64_t entry);
 	int insertGridRecord(int64_t * gentry, int64_t x, int64_t y,
 			     void *record, int64_t rsize);
-	int splitGrid(int vertical, int64_t lon, int64_t lat, int64_t x,
-		      int64_t y);
-	int updateBucket(int direction, int64_t slon, int64_t slat,
-			 int64_t dlon, int64_t dlat, int64_t baddr);
-	int updatePairedBuckets(int direction, int64_t lon, int64_t lat,
-				int64_t baddr);
-	int splitBucket(int vertical, int64_t slon, int64_t slat, int64_t dlon,
-			int64_t dlat);
-	int checkPairedBucket(int *isPaired, int64_t slon, int64_t slat,
-			      int64_t dlon, int64_t dlat);
-	int hasPairedBucket(int direction, int *isPaired, int *vertical,
-			    int *forward, int64_t lon, int64_t lat);
+	int removeGridRecord(int64_t * gentry, int64_t * gbucket,
+			     int64_t entry);
+	int getSplitPartition(int *vertical, int64_t * partition,
+			      vector < int64_t > &xs, vector < int64_t > &ys);
+	void getRegionPartition(int *vertical, int64_t * ipart,
+				vector < int64_t > &xs, vector < int64_t > &ys,
+				int64_t lon1, int64_t lat1, int64_t lon2,
+				int64_t lat2);
+	int splitGrid(int vertical, int64_t partition);
+	int getBucketRegion(int64_t * lon1, int64_t * lat1, int64_t * lon2,
+			    int64_t * lat2, int64_t lon, int64_t lat);
+	int updateBucketRegion(int64_t lon, int64_t lat);
+	int getSplitPart(int nsplits, int *svertical, int64_t * spartition,
+			 int *supper, int64_t x, int64_t y);
+	int splitBucket(int64_t lon, int64_t lat, int64_t x, int64_t y,
+			int64_t rsize);
+	int growBucket(int64_t lon, int64_t lat);
+	int isBucketDense(int64_t lon, int64_t lat, int64_t x, int64_t y,
+			  int64_t rsize);
+	int makeBucketRoom(int64_t lon, int64_t lat, int64_t x, int64_t y,
+			   int64_t rsize);
+	int moveGridBucket(int64_t * gentry, int64_t baddr);
+	int getRangeBuckets(vector < int64_t * >&gentries, int64_t lon1,
+			    int64_t lat1, int64_t lon2, int64_t lat2);
+	uint64_t getBucketOrder(int64_t lon, int64_t lat);
+	int getMergeBuckets(vector < int64_t * >&mgentries, int64_t * gentry);
+	void runCompactor(int64_t budget, int64_t period);
+	void prefetchBucket(int64_t * gentry);
+	void prefetchRequest(struct gridrequest *request);
+	int executeRequest(struct gridrequest *request);
+	void runExecutor();
+	future < int > submitRequest(struct gridrequest *request);
+	int isSegmentMeeting(long double ax, long double ay, long double bx,
+			     long double by, long double xlo, long double ylo,
+			     long double xhi, long double yhi);
+	int isShapePoint(struct gridshape *shape, long double x,
+			 long double y);
+	int classifyShapeRegion(struct gridshape *shape, long double xlo,
+				long double ylo, long double xhi,
+				long double yhi);
+	int allocateOutput(struct gridbuffer *output, int64_t bound,
+			   void **records);
+	int finishOutput(struct gridbuffer *output, void *records,
+			 int64_t nbytes);
+	int findShapeRecords(struct gridshape *shape, int64_t x1, int64_t y1,
+			     int64_t x2, int64_t y2, struct gridbuffer *output,
+			     int64_t * dsize, void **records);
+	int findRangeOutput(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			    struct gridbuffer *output, int64_t * dsize,
+			    void **records);
+	int findCircleOutput(int64_t x, int64_t y, int64_t radius,
+			     struct gridbuffer *output, int64_t * dsize,
+			     void **records);
+	int findPolygonOutput(int64_t * xs, int64_t * ys, int64_t nvertices,
+			      struct gridbuffer *output, int64_t * dsize,
+			      void **records);
+	int findNearestOutput(int64_t x, int64_t y, int64_t k,
+			      struct gridbuffer *output, int64_t * dsize,
+			      void **records);
+	double getGridDistance(int64_t lon, int64_t lat, int64_t x, int64_t y);
+	int isRegionCovered(int64_t lon1, int64_t lat1, int64_t lon2,
+			    int64_t lat2, int64_t x1, int64_t y1, int64_t x2,
+			    int64_t y2);
+	template < typename Coord, int64_t RSIZE >
+	    void copyFixedEntries(int64_t * gb, int64_t x1, int64_t y1,
+				  int64_t x2, int64_t y2, char **rrecords,
+				  int64_t * nr, int64_t * dsize);
+	template < typename Coord >
+	    int copySizedEntries(int64_t * gb, int64_t x1, int64_t y1,
+				 int64_t x2, int64_t y2, char **rrecords,
+				 int64_t * nr, int64_t * dsize);
+	int copyRangeEntries(int64_t * gb, int64_t x1, int64_t y1, int64_t x2,
+			     int64_t y2, char **rrecords, int64_t * nr,
+			     int64_t * dsize);
+	int traverseRangeRecords(vector < int64_t * >&gentries, int64_t x1,
+				 int64_t y1, int64_t x2, int64_t y2,
+				 char **rrecords, int64_t * nr,
+				 int64_t * dsize);
+	int scanRangeRecords(vector < int64_t * >&gentries, int64_t x1,
+			     int64_t y1, int64_t x2, int64_t y2,
+			     char **rrecords, int64_t * nr, int64_t * dsize);
+	double getOverlapFraction(double lo, double hi, double r1, double r2,
+				  double mean);
+	void estimateBucketRecords(vector < int64_t * >&gentries, int64_t x1,
+				   int64_t y1, int64_t x2, int64_t y2,
+				   int64_t * nrecords, int64_t * npages);
+	int aggregateRange(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			   int64_t * count, int64_t * sx, int64_t * sy);
 
  public:
 	int createGrid(struct gridconfig *configuration);
+	int attachGrid(struct gridconfig *configuration);
+	int openGrid(string name);
 	int loadGrid();
 	void unloadGrid();
 	int insertRecord(int64_t x, int64_t y, void *record, int64_t rsize);
 	int findRecord(int64_t x, int64_t y, void **record);
 	int deleteRecord(int64_t x, int64_t y);
+	int updateRecord(int64_t x, int64_t y, void *record, int64_t rsize);
+	int moveRecord(int64_t x, int64_t y, int64_t nx, int64_t ny);
+	int estimateRangeRecords(int64_t x1, int64_t y1, int64_t x2,
+				 int64_t y2, int64_t * nrecords,
+				 int64_t * nbuckets, int64_t * npages);
 	int findRangeRecords(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
 			     int64_t * dsize, void **records);
+	int findCircleRecords(int64_t x, int64_t y, int64_t radius,
+			      int64_t * dsize, void **records);
+	int findPolygonRecords(int64_t * xs, int64_t * ys, int64_t nvertices,
+			       int64_t * dsize, void **records);
+	int findNearestRecords(int64_t x, int64_t y, int64_t k, int64_t * dsize,
+			       void **records);
+	int findRecordInto(int64_t x, int64_t y, struct gridbuffer *output);
+	int lookupRecord(int64_t x, int64_t y, struct gridview *view);
+	int findRangeRecordsInto(int64_t x1, int64_t y1, int64_t x2,
+				 int64_t y2, struct gridbuffer *output);
+	int findCircleRecordsInto(int64_t x, int64_t y, int64_t radius,
+				  struct gridbuffer *output);
+	int findPolygonRecordsInto(int64_t * xs, int64_t * ys,
+				   int64_t nvertices,
+				   struct gridbuffer *output);
+	int findNearestRecordsInto(int64_t x, int64_t y, int64_t k,
+				   struct gridbuffer *output);
+	int countInRange(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			 int64_t * count);
+	int sumInRange(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+		       int64_t * sx, int64_t * sy);
+	int centroidInRange(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			    double *cx, double *cy);
+	int getGridStats(struct gridstats *stats);
+	int freezeGrid(string path);
+	int relocateBuckets(int64_t budget, int64_t * nmoved);
+	int compactBuckets(int64_t budget, int64_t * nmoved);
+	int startCompactor(int64_t budget, int64_t period);
+	void stopCompactor();
+	future < int > findRecordAsync(int64_t x, int64_t y, void **record);
+	future < int > findRangeRecordsAsync(int64_t x1, int64_t y1, int64_t x2,
+					     int64_t y2, int64_t * dsize,
+					     void **records);
+	future < int > insertRecordAsync(int64_t x, int64_t y, void *record,
+					 int64_t rsize);
+	void stopExecutor();
+	int startLog(string path);
+	void stopLog();
+	int startMemtable(int64_t limit);
+	int stopMemtable();
 };
 
 #endif
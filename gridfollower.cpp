@@ -0,0 +1,385 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "gridfollower.h"
+
+/* Entries applied at most before applier thread checks for stop */
+#define MAXAPPLY 4096
+
+/* Reads whole entry of change log at given offset
+
+   Parameters:
+   entry: Entry is stored
+   record: Buffer holding record of entry is stored, to be released by
+   caller
+   offset: Offset of entry in change log
+
+   Return:
+   Zero on success, error on failure or if no whole entry is there yet
+*/
+int gridfollower::readEntry(struct gridlogentry *entry, char **record,
+			    int64_t offset)
+{
+	int error = 0;
+
+	*record = NULL;
+
+	if (pread(logFd, entry, sizeof(*entry), offset) !=
+	    (ssize_t) sizeof(*entry)) {
+		error = -EAGAIN;
+		goto clean;
+	}
+
+	*record = (char *)malloc(entry->size ? entry->size : 1);
+	if (*record == NULL) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	if (pread(logFd, *record, entry->size, offset + sizeof(*entry)) !=
+	    (ssize_t) entry->size) {
+		error = -EAGAIN;
+		free(*record);
+		*record = NULL;
+	}
+
+ clean:
+	return error;
+}
+
+/* Applies change of writer to grid of follower
+
+   Parameters:
+   entry: Entry of change log
+   record: Buffer holding record of entry
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfollower::applyEntry(struct gridlogentry *entry, char *record)
+{
+	int error = 0;
+	int64_t nmoved = 0;
+
+	if (entry->lsn != appliedLsn + 1) {
+		error = -EPROTO;
+		goto clean;
+	}
+
+	switch (entry->type) {
+	case LOG_INSERT:
+		error = grid.insertRecord(entry->x, entry->y, record,
+					  entry->size);
+		break;
+	case LOG_DELETE:
+		error = grid.deleteRecord(entry->x, entry->y);
+		break;
+	case LOG_UPDATE:
+		error = grid.updateRecord(entry->x, entry->y, record,
+					  entry->size);
+		break;
+	case LOG_MOVE:
+		error = grid.moveRecord(entry->x, entry->y, entry->nx,
+					entry->ny);
+		break;
+	case LOG_RELOCATE:
+		error = grid.relocateBuckets(entry->x, &nmoved);
+		break;
+	case LOG_COMPACT:
+		error = grid.compactBuckets(entry->x, &nmoved);
+		break;
+	default:
+		error = -EPROTO;
+	}
+
+ clean:
+	return error;
+}
+
+/* Applies whole entries of change log found past those already applied,
+   up to MAXAPPLY of them
+
+   Parameters:
+   napplied: Number of applied entries is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfollower::applyEntries(int64_t * napplied)
+{
+	int error = 0;
+	char *record = NULL;
+	struct gridlogentry entry;
+
+	*napplied = 0;
+
+	while (*napplied < MAXAPPLY) {
+		error = readEntry(&entry, &record, logOffset);
+		if (error == -EAGAIN) {
+			error = 0;
+			break;
+		}
+		if (error < 0) {
+			goto clean;
+		}
+
+		error = applyEntry(&entry, record);
+		free(record);
+		if (error < 0) {
+			goto clean;
+		}
+
+		logOffset += sizeof(entry) + entry.size;
+		appliedLsn = entry.lsn;
+		*napplied += 1;
+	}
+
+ clean:
+	return error;
+}
+
+/* Applies change log as it grows until stopped or an entry fails
+
+   Parameters:
+   period: Length of period in milliseconds between looks at change log
+   once caught up
+*/
+void gridfollower::runApplier(int64_t period)
+{
+	int error = 0;
+	int64_t napplied = 0;
+	unique_lock < mutex > wait(applierLock);
+
+	while (!applierStop) {
+		error = applyEntries(&napplied);
+		if (error < 0) {
+			applierError = error;
+			break;
+		}
+
+		if (napplied == MAXAPPLY) {
+			continue;
+		}
+
+		applierSignal.wait_for(wait, chrono::milliseconds(period),
+				       [this] { return applierStop.load(); });
+	}
+}
+
+/* Creates grid of follower and starts following change log of writer from
+   its first entry
+
+   Parameters:
+   configuration: Configuration of writer grid, name being that of follower
+   grid, in directory of its own
+   path: Path of change log of writer
+   period: Length of period in milliseconds between looks at change log
+   once caught up, changes being applied by catchUp only if zero
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfollower::startFollower(struct gridconfig *configuration,
+				string path, int64_t period)
+{
+	int error = 0;
+
+	if (period < 0) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	error = grid.createGrid(configuration);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = grid.loadGrid();
+	if (error < 0) {
+		goto clean;
+	}
+
+	logName = path;
+	logFd = open(logName.c_str(), O_RDONLY | O_CREAT, 0644);
+	if (logFd == -1) {
+		error = -errno;
+		grid.unloadGrid();
+		goto clean;
+	}
+
+	logOffset = 0;
+	appliedLsn = 0;
+	applierError = 0;
+	applierStop = false;
+
+	if (period > 0) {
+		applier = thread(&gridfollower::runApplier, this, period);
+	}
+
+ clean:
+	return error;
+}
+
+/* Stops applying change log and unloads grid of follower
+*/
+void gridfollower::stopFollower()
+{
+	if (applier.joinable()) {
+		applierStop = true;
+		applierLock.lock();
+		applierLock.unlock();
+		applierSignal.notify_all();
+		applier.join();
+	}
+
+	grid.unloadGrid();
+	close(logFd);
+	logFd = -1;
+}
+
+/* Applies whole entries of change log written so far, failure stopping
+   follower as it stops applier thread
+
+   Parameters:
+   napplied: Number of applied entries is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfollower::catchUp(int64_t * napplied)
+{
+	lock_guard < mutex > guard(applierLock);
+	int error = applierError;
+	int64_t nbatch = 0;
+
+	*napplied = 0;
+
+	while (error == 0) {
+		error = applyEntries(&nbatch);
+		*napplied += nbatch;
+		if (nbatch < MAXAPPLY) {
+			break;
+		}
+	}
+
+	if (error < 0) {
+		applierError = error;
+	}
+
+	return error;
+}
+
+/* Reports how far follower is behind writer. Lag keeps being reported
+   once applying change log failed, so that follower stopped by failure is
+   seen falling behind as well as failing
+
+   Parameters:
+   nentries: Number of whole entries not yet applied is stored
+   nbytes: Number of bytes of change log not yet applied is stored
+   seconds: Age of oldest change not yet applied is stored, zero if caught
+   up
+
+   Return:
+   Zero on success, error on failure or error entry failed with if applying
+   change log stopped
+*/
+int gridfollower::getLag(int64_t * nentries, int64_t * nbytes,
+			 double *seconds)
+{
+	int error = 0;
+	int64_t offset = logOffset;
+	struct stat st;
+	struct timespec ts;
+	struct gridlogentry entry;
+
+	*nentries = 0;
+	*nbytes = 0;
+	*seconds = 0;
+
+	if (fstat(logFd, &st) == -1) {
+		error = -errno;
+		goto clean;
+	}
+
+	*nbytes = st.st_size - offset;
+
+	while (pread(logFd, &entry, sizeof(entry), offset) ==
+	       (ssize_t) sizeof(entry)) {
+		if (*nentries == 0) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			*seconds = (ts.tv_sec * 1000000000 + ts.tv_nsec -
+				    entry.time) / 1e9;
+		}
+		*nentries += 1;
+		offset += sizeof(entry) + entry.size;
+	}
+
+	error = applierError;
+
+ clean:
+	return error;
+}
+
+/* Fetches sequence number of last applied entry of change log
+
+   Return:
+   Sequence number of last applied entry, zero if none
+*/
+int64_t gridfollower::getAppliedLsn()
+{
+	return appliedLsn;
+}
+
+/* Retrieves record for given coordinates from follower grid
+
+   Parameters:
+   x: Coordinate (x) of record to be retrieved
+   y: Coordinate (y) of record to be retrieved
+   record: Buffer to hold retrieved record
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfollower::findRecord(int64_t x, int64_t y, void **record)
+{
+	return grid.findRecord(x, y, record);
+}
+
+/* Retrieves records within range from follower grid
+
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   dsize: Number of bytes written in buffer is stored
+   records: Buffer to hold retrieved records
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfollower::findRangeRecords(int64_t x1, int64_t y1, int64_t x2,
+				   int64_t y2, int64_t * dsize,
+				   void **records)
+{
+	return grid.findRangeRecords(x1, y1, x2, y2, dsize, records);
+}
+
+/* Counts records within range of follower grid
+
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   count: Number of records is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridfollower::countInRange(int64_t x1, int64_t y1, int64_t x2,
+			       int64_t y2, int64_t * count)
+{
+	return grid.countInRange(x1, y1, x2, y2, count);
+}
@@ -0,0 +1,50 @@
+#ifndef GRIDFOLLOWER_HPP
+#define GRIDFOLLOWER_HPP
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "gridfile.h"
+
+using namespace std;
+
+/* Read-only copy of grid kept in files of its own by applying change log of
+   writer. Changes are applied by background thread one at a time, so that
+   lookups and range queries are served between them while follower is
+   catching up
+*/
+struct gridfollower {
+ private:
+	struct gridfile grid;
+	string logName;
+	int logFd = -1;
+	atomic < int64_t > logOffset;
+	atomic < int64_t > appliedLsn;
+	mutex applierLock;
+	condition_variable applierSignal;
+	thread applier;
+	atomic < bool > applierStop;
+	atomic < int > applierError;
+
+	int readEntry(struct gridlogentry *entry, char **record,
+		      int64_t offset);
+	int applyEntry(struct gridlogentry *entry, char *record);
+	int applyEntries(int64_t * napplied);
+	void runApplier(int64_t period);
+
+ public:
+	int startFollower(struct gridconfig *configuration, string path,
+			  int64_t period);
+	void stopFollower();
+	int catchUp(int64_t * napplied);
+	int getLag(int64_t * nentries, int64_t * nbytes, double *seconds);
+	int64_t getAppliedLsn();
+	int findRecord(int64_t x, int64_t y, void **record);
+	int findRangeRecords(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			     int64_t * dsize, void **records);
+	int countInRange(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			 int64_t * count);
+};
+
+#endif
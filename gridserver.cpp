@@ -0,0 +1,752 @@
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "gridserver.h"
+
+#define FLUSH_BYTES 65536
+#define STREAM_BYTES 65536
+#define MAXRECORD (1 << 24)
+#define POLL_PERIOD 100
+
+/* Reads given number of bytes from socket
+
+   Parameters:
+   fd: Socket to read from
+   buffer: Buffer to hold bytes
+   size: Number of bytes to read
+
+   Return:
+   Zero on success, error on failure or when peer closed socket
+*/
+int readFull(int fd, void *buffer, int64_t size)
+{
+	int error = 0;
+	int64_t nread = 0;
+	ssize_t nbytes = 0;
+
+	while (nread < size) {
+		nbytes = read(fd, (char *)buffer + nread, size - nread);
+		if (nbytes < 0 && errno == EINTR) {
+			continue;
+		}
+		if (nbytes < 0) {
+			error = -errno;
+			goto clean;
+		}
+		if (nbytes == 0) {
+			error = -EPIPE;
+			goto clean;
+		}
+		nread += nbytes;
+	}
+
+ clean:
+	return error;
+}
+
+/* Writes given number of bytes to socket, a closed peer failing the write
+   rather than raising signal
+
+   Parameters:
+   fd: Socket to write to
+   buffer: Buffer holding bytes
+   size: Number of bytes to write
+
+   Return:
+   Zero on success, error on failure
+*/
+int writeFull(int fd, void *buffer, int64_t size)
+{
+	int error = 0;
+	int64_t nwritten = 0;
+	ssize_t nbytes = 0;
+
+	while (nwritten < size) {
+		nbytes = send(fd, (char *)buffer + nwritten, size - nwritten,
+			      MSG_NOSIGNAL);
+		if (nbytes < 0 && errno == EINTR) {
+			continue;
+		}
+		if (nbytes < 0) {
+			error = -errno;
+			goto clean;
+		}
+		nwritten += nbytes;
+	}
+
+ clean:
+	return error;
+}
+
+/* Creates socket listening on given path, replacing stale socket left by
+   previous server
+
+   Parameters:
+   path: Path of socket
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridserver::listenUnix(string path)
+{
+	int error = 0;
+	struct sockaddr_un address;
+	struct stat st;
+
+	if (path.size() >= sizeof(address.sun_path)) {
+		error = -ENAMETOOLONG;
+		goto clean;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path.c_str());
+
+	unixFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (unixFd < 0) {
+		error = -errno;
+		goto clean;
+	}
+
+	/* Socket left by earlier server is replaced, other files are kept */
+	if (lstat(path.c_str(), &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			error = -EEXIST;
+			goto clean;
+		}
+
+		unlink(path.c_str());
+	}
+
+	if (bind(unixFd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		error = -errno;
+		goto clean;
+	}
+
+	if (listen(unixFd, SOMAXCONN) < 0) {
+		error = -errno;
+		goto clean;
+	}
+
+	socketName = path;
+
+ clean:
+	return error;
+}
+
+/* Creates socket listening on given port of localhost
+
+   Parameters:
+   port: Port to listen on
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridserver::listenTcp(int64_t port)
+{
+	int error = 0;
+	int reuse = 1;
+	struct sockaddr_in address;
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	tcpFd = socket(AF_INET, SOCK_STREAM, 0);
+	if (tcpFd < 0) {
+		error = -errno;
+		goto clean;
+	}
+
+	setsockopt(tcpFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	if (bind(tcpFd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		error = -errno;
+		goto clean;
+	}
+
+	if (listen(tcpFd, SOMAXCONN) < 0) {
+		error = -errno;
+		goto clean;
+	}
+
+ clean:
+	return error;
+}
+
+/* Writes out replies gathered so far
+
+   Parameters:
+   fd: Socket of connection
+   replies: Buffer of gathered replies, emptied
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridserver::flushReplies(int fd, vector < char >&replies)
+{
+	int error = 0;
+
+	if (replies.size() > 0) {
+		error = writeFull(fd, replies.data(), replies.size());
+		replies.clear();
+	}
+
+	return error;
+}
+
+/* Gathers reply, writing out gathered replies once enough of them are
+   buffered
+
+   Parameters:
+   fd: Socket of connection
+   replies: Buffer of gathered replies
+   reply: Reply to gather
+   payload: Buffer holding payload of reply
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridserver::appendReply(int fd, vector < char >&replies,
+			    struct gridreply *reply, void *payload)
+{
+	int error = 0;
+
+	replies.insert(replies.end(), (char *)reply,
+		       (char *)reply + sizeof(struct gridreply));
+	replies.insert(replies.end(), (char *)payload,
+		       (char *)payload + reply->size);
+
+	if (replies.size() >= FLUSH_BYTES) {
+		error = flushReplies(fd, replies);
+	}
+
+	return error;
+}
+
+/* Replies to range request with records in range, streamed in replies of at
+   most STREAM_BYTES of entries each so that client works through first
+   entries while later ones are still being sent
+
+   Parameters:
+   fd: Socket of connection
+   replies: Buffer of gathered replies
+   message: Range request
+
+   Return:
+   Zero on success, error on failure of connection
+*/
+int gridserver::streamRange(int fd, vector < char >&replies,
+			    struct gridmessage *message)
+{
+	int error = 0;
+	int64_t ds = 0;
+	int64_t nr = 0;
+	int64_t iter = 0;
+	int64_t esize = 0;
+	void *records = NULL;
+	char *be = NULL;
+	char *chunk = NULL;
+	struct gridreply reply;
+
+	reply.tag = message->tag;
+	reply.more = 0;
+	reply.count = 0;
+	reply.size = 0;
+
+	reply.status =
+	    grid->findRangeRecords(message->x1, message->y1, message->x2,
+				   message->y2, &ds, &records);
+	if (reply.status < 0) {
+		error = appendReply(fd, replies, &reply, NULL);
+		goto clean;
+	}
+
+	nr = ((int64_t *) records)[0];
+	be = (char *)records + 8;
+	chunk = be;
+
+	for (iter = 0; iter < nr; iter++) {
+		esize = 24 + ((int64_t *) be)[2];
+		if (reply.count > 0 && reply.size + esize > STREAM_BYTES) {
+			reply.more = 1;
+			error = appendReply(fd, replies, &reply, chunk);
+			if (error < 0) {
+				goto clean;
+			}
+			chunk = be;
+			reply.count = 0;
+			reply.size = 0;
+		}
+		reply.count += 1;
+		reply.size += esize;
+		be += esize;
+	}
+
+	reply.more = 0;
+	error = appendReply(fd, replies, &reply, chunk);
+
+ clean:
+	free(records);
+
+	return error;
+}
+
+/* Executes request and gathers its reply. Failure of grid operation is
+   replied to client and does not end connection
+
+   Parameters:
+   fd: Socket of connection
+   replies: Buffer of gathered replies
+   message: Request to execute
+   record: Buffer holding record of request
+   arena: Arena found records are written to until replies are flushed
+
+   Return:
+   Zero on success, error on failure of connection
+*/
+int gridserver::executeMessage(int fd, vector < char >&replies,
+			       struct gridmessage *message, void *record,
+			       struct gridarena *arena)
+{
+	int error = 0;
+	void *payload = NULL;
+	struct gridreply reply;
+	struct gridbuffer output;
+
+	reply.tag = message->tag;
+	reply.status = 0;
+	reply.more = 0;
+	reply.count = 0;
+	reply.size = 0;
+
+	switch (message->type) {
+	case MESSAGE_INSERT:
+		reply.status =
+		    grid->insertRecord(message->x1, message->y1, record,
+				       message->size);
+		break;
+	case MESSAGE_FIND:
+		output.arena = arena;
+		reply.status =
+		    grid->findRecordInto(message->x1, message->y1, &output);
+		/* Missing record is replied as not found */
+		if (reply.status == -EINVAL) {
+			reply.status = -ENOENT;
+		}
+		if (reply.status < 0) {
+			break;
+		}
+		reply.count = 1;
+		reply.size = output.size;
+		payload = output.data;
+		break;
+	case MESSAGE_RANGE:
+		error = streamRange(fd, replies, message);
+		goto clean;
+	case MESSAGE_DELETE:
+		reply.status = grid->deleteRecord(message->x1, message->y1);
+		break;
+	default:
+		reply.status = -EINVAL;
+		break;
+	}
+
+	error = appendReply(fd, replies, &reply, payload);
+
+ clean:
+	return error;
+}
+
+/* Serves connection until client closes it or server stops, executing
+   batches of requests in order and writing out replies of each batch
+
+   Parameters:
+   connection: Connection to serve
+*/
+void gridserver::serveConnection(struct gridconnection *connection)
+{
+	int error = 0;
+	int fd = connection->fd;
+	int64_t nmessages = 0;
+	int64_t iter = 0;
+	void *record = NULL;
+	struct gridmessage message;
+	struct gridarena arena;
+	vector < char >replies;
+
+	while (error == 0 && !serverStop) {
+		error = readFull(fd, &nmessages, 8);
+		if (error < 0) {
+			break;
+		}
+
+		for (iter = 0; iter < nmessages && error == 0; iter++) {
+			error = readFull(fd, &message, sizeof(message));
+			if (error < 0) {
+				break;
+			}
+
+			if (message.size < 0 || message.size > MAXRECORD) {
+				error = -EINVAL;
+				break;
+			}
+
+			record = malloc(message.size ? message.size : 1);
+			if (record == NULL) {
+				error = -ENOMEM;
+				break;
+			}
+
+			error = readFull(fd, record, message.size);
+			if (error == 0) {
+				error =
+				    executeMessage(fd, replies, &message,
+						   record, &arena);
+			}
+
+			free(record);
+		}
+
+		if (error == 0) {
+			error = flushReplies(fd, replies);
+		}
+
+		arena.reset();
+	}
+
+	connection->done = true;
+}
+
+/* Accepts pending connection and starts thread serving it
+
+   Parameters:
+   fd: Listening socket
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridserver::acceptConnection(int fd)
+{
+	int error = 0;
+	int nodelay = 1;
+	int cfd = -1;
+	struct gridconnection *connection = NULL;
+
+	cfd = accept(fd, NULL, NULL);
+	if (cfd < 0) {
+		error = errno == EINTR || errno == ECONNABORTED ? 0 : -errno;
+		goto clean;
+	}
+
+	if (fd == tcpFd) {
+		setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+			   sizeof(nodelay));
+	}
+
+	connection = new gridconnection;
+	connection->fd = cfd;
+	connection->done = false;
+	connection->worker =
+	    thread(&gridserver::serveConnection, this, connection);
+	connections.push_back(connection);
+
+ clean:
+	return error;
+}
+
+/* Joins threads of connections whose clients went away and closes their
+   sockets
+
+   Parameters:
+   all: All connections are shut down and reaped
+*/
+void gridserver::reapConnections(bool all)
+{
+	int64_t iter = 0;
+	int64_t nlive = 0;
+	struct gridconnection *connection = NULL;
+
+	for (iter = 0; iter < (int64_t) connections.size(); iter++) {
+		connection = connections[iter];
+		if (all) {
+			shutdown(connection->fd, SHUT_RDWR);
+		} else if (!connection->done) {
+			connections[nlive] = connection;
+			nlive += 1;
+			continue;
+		}
+
+		connection->worker.join();
+		close(connection->fd);
+		delete connection;
+	}
+
+	connections.resize(nlive);
+}
+
+/* Starts listening for clients of grid
+
+   Parameters:
+   sgrid: Loaded grid to serve
+   path: Path of Unix domain socket
+   port: Port of localhost to listen on as well, none if zero
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridserver::startServer(struct gridfile *sgrid, string path,
+			    int64_t port)
+{
+	int error = 0;
+
+	grid = sgrid;
+	serverStop = false;
+
+	error = listenUnix(path);
+	if (error < 0) {
+		goto clean;
+	}
+
+	if (port > 0) {
+		error = listenTcp(port);
+	}
+
+ clean:
+	if (error < 0) {
+		stopServer();
+		runServer();
+	}
+
+	return error;
+}
+
+/* Accepts and serves clients until server is stopped, then closes all
+   connections
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridserver::runServer()
+{
+	int error = 0;
+	int iter = 0;
+	int nfds = 0;
+	struct pollfd fds[2];
+
+	while (!serverStop) {
+		nfds = 0;
+		if (unixFd >= 0) {
+			fds[nfds].fd = unixFd;
+			fds[nfds].events = POLLIN;
+			nfds++;
+		}
+		if (tcpFd >= 0) {
+			fds[nfds].fd = tcpFd;
+			fds[nfds].events = POLLIN;
+			nfds++;
+		}
+
+		if (poll(fds, nfds, POLL_PERIOD) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			error = -errno;
+			break;
+		}
+
+		for (iter = 0; iter < nfds && error == 0; iter++) {
+			if (fds[iter].revents & POLLIN) {
+				error = acceptConnection(fds[iter].fd);
+			}
+		}
+		if (error < 0) {
+			break;
+		}
+
+		reapConnections(false);
+	}
+
+	reapConnections(true);
+
+	if (unixFd >= 0) {
+		close(unixFd);
+		unlink(socketName.c_str());
+		unixFd = -1;
+	}
+
+	if (tcpFd >= 0) {
+		close(tcpFd);
+		tcpFd = -1;
+	}
+
+	return error;
+}
+
+/* Makes running server return, safe to call from signal handler
+*/
+void gridserver::stopServer()
+{
+	serverStop = true;
+}
+
+/* Connects to server over Unix domain socket
+
+   Parameters:
+   path: Path of socket
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridclient::connectUnix(string path)
+{
+	int error = 0;
+	struct sockaddr_un address;
+
+	if (path.size() >= sizeof(address.sun_path)) {
+		error = -ENAMETOOLONG;
+		goto clean;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path.c_str());
+
+	clientFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (clientFd < 0) {
+		error = -errno;
+		goto clean;
+	}
+
+	if (connect(clientFd, (struct sockaddr *)&address, sizeof(address)) <
+	    0) {
+		error = -errno;
+		disconnect();
+	}
+
+ clean:
+	return error;
+}
+
+/* Connects to server over TCP socket of localhost
+
+   Parameters:
+   port: Port server listens on
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridclient::connectTcp(int64_t port)
+{
+	int error = 0;
+	int nodelay = 1;
+	struct sockaddr_in address;
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	clientFd = socket(AF_INET, SOCK_STREAM, 0);
+	if (clientFd < 0) {
+		error = -errno;
+		goto clean;
+	}
+
+	if (connect(clientFd, (struct sockaddr *)&address, sizeof(address)) <
+	    0) {
+		error = -errno;
+		disconnect();
+		goto clean;
+	}
+
+	setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+		   sizeof(nodelay));
+
+ clean:
+	return error;
+}
+
+/* Sends batch of requests in one write, replies being received later so
+   that several batches may be in flight
+
+   Parameters:
+   messages: Requests of batch
+   records: Records of requests, each one holding size bytes of its request
+   nmessages: Number of requests
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridclient::sendBatch(struct gridmessage *messages, void **records,
+			  int64_t nmessages)
+{
+	int64_t iter = 0;
+	vector < char >batch;
+
+	batch.insert(batch.end(), (char *)&nmessages, (char *)&nmessages + 8);
+
+	for (iter = 0; iter < nmessages; iter++) {
+		batch.insert(batch.end(), (char *)&messages[iter],
+			     (char *)&messages[iter] +
+			     sizeof(struct gridmessage));
+		batch.insert(batch.end(), (char *)records[iter],
+			     (char *)records[iter] + messages[iter].size);
+	}
+
+	return writeFull(clientFd, batch.data(), batch.size());
+}
+
+/* Receives next reply
+
+   Parameters:
+   reply: Reply is stored
+   payload: Buffer holding payload of reply is stored, to be released by
+   caller
+
+   Return:
+   Zero on success, error on failure
+*/
+int gridclient::receiveReply(struct gridreply *reply, void **payload)
+{
+	int error = 0;
+
+	*payload = NULL;
+
+	error = readFull(clientFd, reply, sizeof(struct gridreply));
+	if (error < 0) {
+		goto clean;
+	}
+
+	if (reply->size < 0) {
+		error = -EPROTO;
+		goto clean;
+	}
+
+	*payload = malloc(reply->size ? reply->size : 1);
+	if (*payload == NULL) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	error = readFull(clientFd, *payload, reply->size);
+
+ clean:
+	return error;
+}
+
+/* Closes connection to server
+*/
+void gridclient::disconnect()
+{
+	if (clientFd >= 0) {
+		close(clientFd);
+		clientFd = -1;
+	}
+}
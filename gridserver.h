@@ -0,0 +1,103 @@
+#ifndef GRIDSERVER_HPP
+#define GRIDSERVER_HPP
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "gridfile.h"
+
+using namespace std;
+
+#define MESSAGE_INSERT 1
+#define MESSAGE_FIND 2
+#define MESSAGE_RANGE 3
+#define MESSAGE_DELETE 4
+
+/* Request of batch sent to server, followed by size bytes of record for
+   insertion. Batch is sent as number of requests followed by requests, all
+   words in host order as server runs on same host
+*/
+struct gridmessage {
+	int64_t type;
+	int64_t tag;
+	int64_t x1;
+	int64_t y1;
+	int64_t x2;
+	int64_t y2;
+	int64_t size;
+};
+
+/* Reply to request, followed by size bytes of payload. Find replies carry
+   record, range replies carry entries laid out as range queries return
+   them (x, y, record size, record) and are streamed in several replies of
+   count entries, all but last one having more set
+*/
+struct gridreply {
+	int64_t tag;
+	int64_t status;
+	int64_t more;
+	int64_t count;
+	int64_t size;
+};
+
+/* Connection served by thread of its own, done once client went away
+*/
+struct gridconnection {
+	int fd;
+	atomic < bool > done;
+	thread worker;
+};
+
+/* Server sharing one grid file among processes of the host over Unix domain
+   socket and, optionally, TCP socket bound to localhost. Each connection is
+   served by thread of its own, reading batches of requests and writing
+   replies in request order, so that clients may pipeline batches
+*/
+struct gridserver {
+ private:
+	struct gridfile *grid;
+	string socketName;
+	int unixFd = -1;
+	int tcpFd = -1;
+	atomic < bool > serverStop;
+	vector < struct gridconnection *>connections;
+
+	int listenUnix(string path);
+	int listenTcp(int64_t port);
+	int flushReplies(int fd, vector < char >&replies);
+	int appendReply(int fd, vector < char >&replies, struct gridreply *reply,
+			void *payload);
+	int streamRange(int fd, vector < char >&replies,
+			struct gridmessage *message);
+	int executeMessage(int fd, vector < char >&replies,
+			   struct gridmessage *message, void *record,
+			   struct gridarena *arena);
+	void serveConnection(struct gridconnection *connection);
+	int acceptConnection(int fd);
+	void reapConnections(bool all);
+
+ public:
+	int startServer(struct gridfile *sgrid, string path, int64_t port);
+	int runServer();
+	void stopServer();
+};
+
+/* Client of grid server
+*/
+struct gridclient {
+ private:
+	int clientFd = -1;
+
+ public:
+	int connectUnix(string path);
+	int connectTcp(int64_t port);
+	int sendBatch(struct gridmessage *messages, void **records,
+		      int64_t nmessages);
+	int receiveReply(struct gridreply *reply, void **payload);
+	void disconnect();
+};
+
+int readFull(int fd, void *buffer, int64_t size);
+int writeFull(int fd, void *buffer, int64_t size);
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include "gridfile.h"
+#include "gridserver.h"
+
+#define SIZE 1000
+#define PSIZE 4096
+#define NAME "dbserver"
+#define SOCKET "gridsocket"
+
+struct gridserver vserver;
+
+/* Stops server on interrupt or termination
+*/
+void handleSignal(int)
+{
+	vserver.stopServer();
+}
+
+/* Serves new grid over Unix domain socket given as first argument and, when
+   given as second argument, over TCP port of localhost
+*/
+int main(int argc, char **argv)
+{
+	int error = 0;
+	int64_t port = 0;
+	char *end = NULL;
+	string path = SOCKET;
+	struct gridconfig vconfig;
+	struct gridfile vgrid;
+
+	if (argc > 1) {
+		path = argv[1];
+	}
+	if (argc > 2) {
+		errno = 0;
+		port = strtol(argv[2], &end, 10);
+		if (errno != 0 || end == argv[2] || *end != '\0' || port < 1
+		    || port > 65535) {
+			error = -EINVAL;
+			goto clean;
+		}
+	}
+
+	vconfig.size = SIZE;
+	vconfig.psize = PSIZE;
+	vconfig.name = NAME;
+
+	error = vgrid.createGrid(&vconfig);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = vgrid.loadGrid();
+	if (error < 0) {
+		goto clean;
+	}
+
+	signal(SIGINT, handleSignal);
+	signal(SIGTERM, handleSignal);
+
+	error = vserver.startServer(&vgrid, path, port);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	printf("Serving %s", path.c_str());
+	if (port > 0) {
+		printf(" and localhost:%ld", port);
+	}
+	printf("\n");
+	fflush(stdout);
+
+	error = vserver.runServer();
+
+ pclean:
+	vgrid.unloadGrid();
+
+ clean:
+	printf("Error: %d\n", error);
+	return error;
+}
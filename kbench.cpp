@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include "gridfile.h"
+#include "kgridfile.h"
+#include "datagenerator.h"
+
+#define SIZE 64
+#define PSIZE 4096
+#define NRECORDS 500000
+#define DOMAIN 1000000
+#define NQUERIES 100
+#define QSIZE 100000
+#define TWINDOW 50000
+
+/* Fetches monotonic time in seconds
+*/
+double getTime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Generates random point and record, storing coordinates of all dimensions
+   in the record so that lower dimensional grids can post-filter on them
+*/
+void getRandomPoint(int64_t * point, int64_t * rsize, void **record)
+{
+	int64_t iter = 0;
+
+	for (iter = 0; iter < 4; iter++) {
+		point[iter] = rand() % DOMAIN;
+	}
+
+	*rsize = 4 * 8;
+	*record = (void *)malloc(*rsize);
+	memcpy(*record, point, *rsize);
+}
+
+/* Counts retrieved records of D dimensional range whose point lies in time
+   window, time being third coordinate held in record
+*/
+int64_t countWindow(void *records, int D, int64_t t1, int64_t t2)
+{
+	int64_t nr = ((int64_t *) records)[0];
+	int64_t count = 0;
+	int64_t iter = 0;
+	char *be = (char *)records + 8;
+	int64_t *ce = NULL;
+	int64_t *point = NULL;
+
+	for (iter = 0; iter < nr; iter++) {
+		ce = (int64_t *) be;
+		point = ce + D + 1;
+		if (point[2] >= t1 && point[2] <= t2) {
+			count++;
+		}
+		be += (D + 1) * 8 + ce[D];
+	}
+
+	return count;
+}
+
+int main()
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t point[4];
+	int64_t lo[4];
+	int64_t hi[4];
+	int64_t rsize = 0;
+	int64_t ds = 0;
+	int64_t found2 = 0;
+	int64_t found3 = 0;
+	int64_t found4 = 0;
+	void *record = NULL;
+	void *records = NULL;
+	struct gridconfig vconfig;
+	struct gridfile vgrid;
+	kgridfile < 3 > tgrid;
+	kgridfile < 4 > qgrid;
+	double start = 0;
+
+	vconfig.psize = PSIZE;
+
+	vconfig.size = SIZE * SIZE;
+	vconfig.name = "db2";
+	error = vgrid.createGrid(&vconfig);
+	if (error < 0) {
+		goto clean;
+	}
+
+	vconfig.size = SIZE;
+	vconfig.name = "db3";
+	error = tgrid.createGrid(&vconfig);
+	if (error < 0) {
+		goto clean;
+	}
+
+	vconfig.size = SIZE / 2;
+	vconfig.name = "db4";
+	error = qgrid.createGrid(&vconfig);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = vgrid.loadGrid();
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = tgrid.loadGrid();
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = qgrid.loadGrid();
+	if (error < 0) {
+		goto clean;
+	}
+
+	srand(1);
+	start = getTime();
+	for (iter = 0; iter < NRECORDS; iter++) {
+		getRandomPoint(point, &rsize, &record);
+		error = vgrid.insertRecord(point[0], point[1], record, rsize);
+		free(record);
+		if (error < 0) {
+			goto pclean;
+		}
+	}
+	printf("2-D insert: %.2f s\n", getTime() - start);
+
+	srand(1);
+	start = getTime();
+	for (iter = 0; iter < NRECORDS; iter++) {
+		getRandomPoint(point, &rsize, &record);
+		error = tgrid.insertRecord(point, record, rsize);
+		free(record);
+		if (error < 0) {
+			goto pclean;
+		}
+	}
+	printf("3-D insert: %.2f s\n", getTime() - start);
+
+	srand(1);
+	start = getTime();
+	for (iter = 0; iter < NRECORDS; iter++) {
+		getRandomPoint(point, &rsize, &record);
+		error = qgrid.insertRecord(point, record, rsize);
+		free(record);
+		if (error < 0) {
+			goto pclean;
+		}
+	}
+	printf("4-D insert: %.2f s\n", getTime() - start);
+
+	srand(2);
+	start = getTime();
+	for (iter = 0; iter < NQUERIES; iter++) {
+		getRandomPoint(point, &rsize, &record);
+		free(record);
+		ds = 0;
+		error =
+		    vgrid.findRangeRecords(point[0], point[1], point[0] + QSIZE,
+					   point[1] + QSIZE, &ds, &records);
+		if (error < 0) {
+			goto pclean;
+		}
+		found2 += countWindow(records, 2, point[2], point[2] + TWINDOW);
+		free(records);
+	}
+	printf("2-D range with time post-filter: %.4f s, %ld records\n",
+	       getTime() - start, found2);
+
+	srand(2);
+	start = getTime();
+	for (iter = 0; iter < NQUERIES; iter++) {
+		getRandomPoint(point, &rsize, &record);
+		free(record);
+		memcpy(lo, point, sizeof(lo));
+		memcpy(hi, point, sizeof(hi));
+		hi[0] += QSIZE;
+		hi[1] += QSIZE;
+		hi[2] += TWINDOW;
+		ds = 0;
+		error = tgrid.findRangeRecords(lo, hi, &ds, &records);
+		if (error < 0) {
+			goto pclean;
+		}
+		found3 += ((int64_t *) records)[0];
+		free(records);
+	}
+	printf("3-D range: %.4f s, %ld records\n", getTime() - start, found3);
+
+	srand(2);
+	start = getTime();
+	for (iter = 0; iter < NQUERIES; iter++) {
+		getRandomPoint(point, &rsize, &record);
+		free(record);
+		memcpy(lo, point, sizeof(lo));
+		memcpy(hi, point, sizeof(hi));
+		hi[0] += QSIZE;
+		hi[1] += QSIZE;
+		hi[2] += TWINDOW;
+		lo[3] = 0;
+		hi[3] = DOMAIN;
+		ds = 0;
+		error = qgrid.findRangeRecords(lo, hi, &ds, &records);
+		if (error < 0) {
+			goto pclean;
+		}
+		found4 += countWindow(records, 4, point[2], point[2] + TWINDOW);
+		free(records);
+	}
+	printf("4-D range: %.4f s, %ld records\n", getTime() - start, found4);
+
+ pclean:
+	vgrid.unloadGrid();
+	tgrid.unloadGrid();
+	qgrid.unloadGrid();
+
+ clean:
+	printf("Error: %d\n", error);
+	return error;
+}
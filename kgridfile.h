@@ -0,0 +1,969 @@
+#ifndef KGRIDFILE_HPP
+#define KGRIDFILE_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
+#include "gridfile.h"
+
+using namespace std;
+
+/* Grid file over D dimensional integer points
+
+   Grid scale holds grid size followed by, for each dimension, number of
+   partitions and partitions. Grid directory holds number of buckets
+   followed by bucket address of every cell, cell (c0, ..., cD-1) being at
+   offset c0 + c1 * size + ... + cD-1 * size^(D-1). Cells sharing a bucket
+   always form a box. Bucket entries are D coordinates, record size and
+   record.
+*/
+template < int D > struct kgridfile {
+	static_assert(D >= 1, "Grid must have at least one dimension");
+
+ private:
+	int64_t gridSize;
+	int64_t pageSize;
+	int64_t scaleSize;
+	int64_t directorySize;
+	int64_t bucketSize;
+	int64_t cellCount;
+	string gridName;
+	string scaleName;
+	string directoryName;
+	string bucketName;
+	int64_t *gridScale;
+	int64_t *gridDirectory;
+
+	int createFile(int64_t size, string fname);
+	int mapFile(int64_t size, string fname, int64_t ** addr);
+	int64_t *getGridPartitions(int axis);
+	void getGridLocation(int64_t * cell, const int64_t * point);
+	int64_t getCellOffset(const int64_t * cell);
+	int getNextCell(int64_t * cell, const int64_t * lo, const int64_t * hi);
+	int insertGridPartition(int axis, int64_t partition);
+	void getBucketRegion(int64_t * lo, int64_t * hi, const int64_t * cell);
+	int mapGridBucket(int64_t baddr, int64_t ** gbucket);
+	void unmapGridBucket(int64_t * gbucket);
+	int64_t getEntrySize(int64_t * bentry);
+	void appendBucketEntry(int64_t * gbucket, const int64_t * point,
+			       int64_t rsize, void *record);
+	int splitBucket(const int64_t * lo, const int64_t * hi);
+	int splitGrid(const int64_t * cell, const int64_t * point);
+
+ public:
+	int createGrid(struct gridconfig *configuration);
+	int loadGrid();
+	void unloadGrid();
+	int insertRecord(const int64_t * point, void *record, int64_t rsize);
+	int findRecord(const int64_t * point, void **record);
+	int deleteRecord(const int64_t * point);
+	int findRangeRecords(const int64_t * lo, const int64_t * hi,
+			     int64_t * dsize, void **records);
+};
+
+/* Creates zero filled file of given size
+
+   Parameters:
+   size: Required size of new file
+   fname: Name of new file as per convention
+
+   Return:
+   Zero on success, error on failure
+*/
+template < int D > int kgridfile < D >::createFile(int64_t size, string fname)
+{
+	int error = 0;
+	int fd = -1;
+
+	fd = open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		error = -errno;
+		goto clean;
+	}
+
+	if (ftruncate(fd, size) == -1) {
+		error = -errno;
+	}
+
+	close(fd);
+
+ clean:
+	return error;
+}
+
+/* Maps file of given size into memory
+
+   Parameters:
+   size: Size of file
+   fname: Name of file
+   addr: Mapped address is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+template < int D >
+    int kgridfile < D >::mapFile(int64_t size, string fname, int64_t ** addr)
+{
+	int error = 0;
+	int fd = -1;
+	void *maddr = NULL;
+
+	fd = open(fname.c_str(), O_RDWR);
+	if (fd == -1) {
+		error = -errno;
+		goto clean;
+	}
+
+	maddr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (maddr == MAP_FAILED) {
+		error = -errno;
+	} else {
+		*addr = (int64_t *) maddr;
+	}
+
+	close(fd);
+
+ clean:
+	return error;
+}
+
+/* Creates grid files and initializes grid parameters
+
+   Parameters:
+   configuration: Enlists grid size per dimension, page size and grid name
+
+   Return:
+   Zero on success, error on failure
+*/
+template < int D >
+    int kgridfile < D >::createGrid(struct gridconfig *configuration)
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t *saddr = NULL;
+	int64_t *daddr = NULL;
+
+	gridSize = configuration->size;
+	pageSize = configuration->psize;
+	cellCount = 1;
+	for (iter = 0; iter < D; iter++) {
+		cellCount *= gridSize;
+	}
+	scaleSize = (D * gridSize + 1) * 8;
+	directorySize = (cellCount + 1) * 8;
+	bucketSize = cellCount * pageSize;
+	gridName = configuration->name;
+	scaleName = gridName + "scale";
+	directoryName = gridName + "directory";
+	bucketName = gridName + "buckets";
+	gridScale = NULL;
+	gridDirectory = NULL;
+
+	error = createFile(scaleSize, scaleName);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = mapFile(8, scaleName, &saddr);
+	if (error < 0) {
+		goto clean;
+	}
+
+	*saddr = gridSize;
+	munmap(saddr, 8);
+
+	error = createFile(directorySize, directoryName);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = mapFile(8, directoryName, &daddr);
+	if (error < 0) {
+		goto clean;
+	}
+
+	*daddr = 1;
+	munmap(daddr, 8);
+
+	error = createFile(bucketSize, bucketName);
+
+ clean:
+	return error;
+}
+
+/* Maps grid scale file and grid directory file into memory
+
+   Return:
+   Zero on success, error on failure
+*/
+template < int D > int kgridfile < D >::loadGrid()
+{
+	int error = 0;
+
+	error = mapFile(scaleSize, scaleName, &gridScale);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = mapFile(directorySize, directoryName, &gridDirectory);
+	if (error < 0) {
+		munmap(gridScale, scaleSize);
+		gridScale = NULL;
+	}
+
+ clean:
+	return error;
+}
+
+/* Unmaps grid scale file and grid directory file from memory
+*/
+template < int D > void kgridfile < D >::unloadGrid()
+{
+	munmap(gridScale, scaleSize);
+	munmap(gridDirectory, directorySize);
+	gridScale = NULL;
+	gridDirectory = NULL;
+}
+
+/* Fetches partitions of given dimension from grid scale
+
+   Parameters:
+   axis: Dimension of partitions
+
+   Return:
+   Pointer to number of partitions, followed by partitions
+*/
+template < int D > int64_t * kgridfile < D >::getGridPartitions(int axis)
+{
+	return gridScale + 1 + axis * gridSize;
+}
+
+/* Fetches grid cell for given point from grid scale
+
+   Parameters:
+   cell: Grid cell index of each dimension is stored
+   point: Coordinates of point
+*/
+template < int D >
+    void kgridfile < D >::getGridLocation(int64_t * cell,
+					  const int64_t * point)
+{
+	int axis = 0;
+	int64_t *parts = NULL;
+
+	for (axis = 0; axis < D; axis++) {
+		parts = getGridPartitions(axis);
+		cell[axis] =
+		    lower_bound(parts + 1, parts + 1 + parts[0],
+				point[axis]) - (parts + 1);
+	}
+}
+
+/* Computes offset of grid cell in grid directory
+
+   Parameters:
+   cell: Grid cell index of each dimension
+
+   Return:
+   Offset of cell bucket address in grid directory
+*/
+template < int D > int64_t kgridfile < D >::getCellOffset(const int64_t * cell)
+{
+	int axis = 0;
+	int64_t offset = 0;
+
+	for (axis = D - 1; axis >= 0; axis--) {
+		offset = offset * gridSize + cell[axis];
+	}
+
+	return offset + 1;
+}
+
+/* Advances grid cell to next cell of box in increasing offset order
+
+   Parameters:
+   cell: Grid cell to be advanced
+   lo: Lowest grid cell of box
+   hi: Highest grid cell of box
+
+   Return:
+   One if cell was advanced, zero if box is exhausted
+*/
+template < int D >
+    int kgridfile < D >::getNextCell(int64_t * cell, const int64_t * lo,
+				     const int64_t * hi)
+{
+	int axis = 0;
+
+	for (axis = 0; axis < D; axis++) {
+		if (cell[axis] < hi[axis]) {
+			cell[axis] += 1;
+			return 1;
+		}
+
+		cell[axis] = lo[axis];
+	}
+
+	return 0;
+}
+
+/* Inserts new partition in grid scale, duplicating split grid cells
+
+   Parameters:
+   axis: Dimension of partition
+   partition: Value of partition to be inserted
+
+   Return:
+   Zero on success, error on failure
+*/
+template < int D >
+    int kgridfile < D >::insertGridPartition(int axis, int64_t partition)
+{
+	int error = 0;
+	int caxis = 0;
+	int64_t *parts = getGridPartitions(axis);
+	int64_t ints = parts[0];
+	int64_t ipart = 0;
+	int64_t iter = 0;
+	int64_t stride = 1;
+	int64_t lo[D];
+	int64_t hi[D];
+	int64_t cell[D];
+	int64_t cells = 0;
+
+	if (ints >= gridSize - 1) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	ipart = lower_bound(parts + 1, parts + 1 + ints, partition) - (parts + 1);
+	if (ipart < ints && parts[1 + ipart] == partition) {
+		error = -EEXIST;
+		goto clean;
+	}
+
+	for (iter = ints; iter > ipart; iter--) {
+		parts[1 + iter] = parts[iter];
+	}
+
+	parts[1 + ipart] = partition;
+	parts[0] += 1;
+
+	for (iter = 0; iter < axis; iter++) {
+		stride *= gridSize;
+	}
+
+	for (iter = 0; iter < D; iter++) {
+		lo[iter] = 0;
+		hi[iter] = getGridPartitions(iter)[0];
+		cell[iter] = hi[iter];
+	}
+
+	lo[axis] = ipart + 1;
+	cell[axis] = hi[axis];
+
+	/* Cells are visited in decreasing offset order so that every cell
+	   is copied from its lower neighbour before that one is overwritten */
+	cells = 1;
+	for (iter = 0; iter < D; iter++) {
+		cells *= hi[iter] - lo[iter] + 1;
+	}
+
+	for (iter = 0; iter < cells; iter++) {
+		gridDirectory[getCellOffset(cell)] =
+		    gridDirectory[getCellOffset(cell) - stride];
+
+		for (caxis = 0; caxis < D; caxis++) {
+			if (cell[caxis] > lo[caxis]) {
+				cell[caxis] -= 1;
+				break;
+			}
+
+			cell[caxis] = hi[caxis];
+		}
+	}
+
+ clean:
+	return error;
+}
+
+/* Fetches box of grid cells sharing bucket with given cell
+
+   Parameters:
+   lo: Lowest grid cell of box is stored
+   hi: Highest grid cell of box is stored
+   cell: Grid cell
+*/
+template < int D >
+    void kgridfile < D >::getBucketRegion(int64_t * lo, int64_t * hi,
+					  const int64_t * cell)
+{
+	int axis = 0;
+	int64_t baddr = gridDirectory[getCellOffset(cell)];
+	int64_t ccell[D];
+
+	for (axis = 0; axis < D; axis++) {
+		memcpy(ccell, cell, sizeof(ccell));
+
+		while (ccell[axis] > 0) {
+			ccell[axis] -= 1;
+			if (gridDirectory[getCellOffset(ccell)] != baddr) {
+				ccell[axis] += 1;
+				break;
+			}
+		}
+
+		lo[axis] = ccell[axis];
+
+		memcpy(ccell, cell, sizeof(ccell));
+
+		while (ccell[axis] < getGridPartitions(axis)[0]) {
+			ccell[axis] += 1;
+			if (gridDirectory[getCellOffset(ccell)] != baddr) {
+				ccell[axis] -= 1;
+				break;
+			}
+		}
+
+		hi[axis] = ccell[axis];
+	}
+}
+
+/* Maps grid bucket into memory
+
+   Parameters:
+   baddr: Address of bucket to be mapped
+   gbucket: Mapped grid bucket is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+template < int D >
+    int kgridfile < D >::mapGridBucket(int64_t baddr, int64_t ** gbucket)
+{
+	int error = 0;
+	int bfd = -1;
+	void *maddr = NULL;
+
+	bfd = open(bucketName.c_str(), O_RDWR);
+	if (bfd == -1) {
+		error = -errno;
+		goto clean;
+	}
+
+	maddr = mmap(NULL, pageSize, PROT_READ | PROT_WRITE, MAP_SHARED, bfd,
+		     baddr * pageSize);
+	if (maddr == MAP_FAILED) {
+		error = -errno;
+	} else {
+		*gbucket = (int64_t *) maddr;
+	}
+
+	close(bfd);
+
+ clean:
+	return error;
+}
+
+/* Unmaps grid bucket from memory
+
+   Parameters:
+   gbucket: Grid bucket to be unmapped
+*/
+template < int D > void kgridfile < D >::unmapGridBucket(int64_t * gbucket)
+{
+	munmap(gbucket, pageSize);
+}
+
+/* Computes size of bucket entry
+
+   Parameters:
+   bentry: Bucket entry
+
+   Return:
+   Size of coordinates, record size and record of entry
+*/
+template < int D > int64_t kgridfile < D >::getEntrySize(int64_t * bentry)
+{
+	return (D + 1) * 8 + bentry[D];
+}
+
+/* Appends coordinates, record size and record at end of the bucket
+
+   Parameters:
+   gbucket: Bucket in which entry must be appended
+   point: Coordinates of new record
+   rsize: Size of record data
+   record: Buffer holding record data
+*/
+template < int D >
+    void kgridfile < D >::appendBucketEntry(int64_t * gbucket,
+					    const int64_t * point,
+					    int64_t rsize, void *record)
+{
+	int64_t *bentry = (int64_t *) ((char *)gbucket + 16 + gbucket[0]);
+
+	memcpy(bentry, point, D * 8);
+	bentry[D] = rsize;
+	memcpy(bentry + D + 1, record, rsize);
+
+	gbucket[0] += getEntrySize(bentry);
+	gbucket[1] += 1;
+}
+
+/* Divides bucket shared by box of grid cells into two buckets, halving the
+   box along its longest dimension
+
+   Parameters:
+   lo: Lowest grid cell of box
+   hi: Highest grid cell of box
+
+   Return:
+   Zero on success, error on failure
+*/
+template < int D >
+    int kgridfile < D >::splitBucket(const int64_t * lo, const int64_t * hi)
+{
+	int error = 0;
+	int axis = 0;
+	int saxis = 0;
+	int64_t mid = 0;
+	int64_t partition = 0;
+	int64_t baddr = gridDirectory[getCellOffset(lo)];
+	int64_t naddr = 0;
+	int64_t *sb = NULL;
+	int64_t *db = NULL;
+	int64_t *be = NULL;
+	char *kept = NULL;
+	int64_t nrecords = 0;
+	int64_t iter = 0;
+	int64_t esize = 0;
+	int64_t cell[D];
+	int64_t slo[D];
+
+	for (axis = 1; axis < D; axis++) {
+		if (hi[axis] - lo[axis] > hi[saxis] - lo[saxis]) {
+			saxis = axis;
+		}
+	}
+
+	mid = (lo[saxis] + hi[saxis]) / 2;
+	partition = getGridPartitions(saxis)[1 + mid];
+	naddr = gridDirectory[0];
+
+	error = mapGridBucket(baddr, &sb);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = mapGridBucket(naddr, &db);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	gridDirectory[0] += 1;
+	db[0] = 0;
+	db[1] = 0;
+
+	nrecords = sb[1];
+	be = sb + 2;
+	kept = (char *)(sb + 2);
+	sb[0] = 0;
+	sb[1] = 0;
+
+	for (iter = 0; iter < nrecords; iter++) {
+		esize = getEntrySize(be);
+
+		if (be[saxis] > partition) {
+			appendBucketEntry(db, be, be[D], be + D + 1);
+		} else {
+			memmove(kept, be, esize);
+			kept += esize;
+			sb[0] += esize;
+			sb[1] += 1;
+		}
+
+		be = (int64_t *) ((char *)be + esize);
+	}
+
+	memcpy(slo, lo, sizeof(slo));
+	slo[saxis] = mid + 1;
+	memcpy(cell, slo, sizeof(cell));
+
+	do {
+		gridDirectory[getCellOffset(cell)] = naddr;
+	} while (getNextCell(cell, slo, hi));
+
+	unmapGridBucket(db);
+
+ pclean:
+	unmapGridBucket(sb);
+
+ clean:
+	return error;
+}
+
+/* Splits grid cell holding unshared bucket by inserting partition at the
+   median of the dimension with largest spread of bucket entries
+
+   Parameters:
+   cell: Grid cell to be split
+   point: Coordinates of new record
+
+   Return:
+   Zero on success, error on failure
+*/
+template < int D >
+    int kgridfile < D >::splitGrid(const int64_t * cell, const int64_t * point)
+{
+	int error = 0;
+	int axis = 0;
+	int saxis = -1;
+	int64_t *gb = NULL;
+	int64_t *be = NULL;
+	int64_t iter = 0;
+	int64_t nrecords = 0;
+	int64_t spread = 0;
+	int64_t partition = 0;
+	int64_t cmin = 0;
+	int64_t cmax = 0;
+	vector < int64_t > coords;
+	vector < int64_t >::iterator median;
+
+	error = mapGridBucket(gridDirectory[getCellOffset(cell)], &gb);
+	if (error < 0) {
+		goto clean;
+	}
+
+	nrecords = gb[1];
+
+	for (axis = 0; axis < D; axis++) {
+		coords.clear();
+		coords.push_back(point[axis]);
+
+		be = gb + 2;
+		for (iter = 0; iter < nrecords; iter++) {
+			coords.push_back(be[axis]);
+			be = (int64_t *) ((char *)be + getEntrySize(be));
+		}
+
+		cmin = *min_element(coords.begin(), coords.end());
+		cmax = *max_element(coords.begin(), coords.end());
+		if (cmax - cmin <= spread) {
+			continue;
+		}
+
+		spread = cmax - cmin;
+		saxis = axis;
+
+		median = coords.begin() + (coords.size() - 1) / 2;
+		nth_element(coords.begin(), median, coords.end());
+		partition = *median;
+
+		/* Median equal to maximum would leave upper cell empty */
+		if (partition == cmax) {
+			partition = cmin;
+			for (iter = 0; iter < (int64_t) coords.size(); iter++) {
+				if (coords[iter] < cmax
+				    && coords[iter] > partition) {
+					partition = coords[iter];
+				}
+			}
+		}
+	}
+
+	unmapGridBucket(gb);
+
+	if (saxis < 0) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	error = insertGridPartition(saxis, partition);
+
+ clean:
+	return error;
+}
+
+/* Inserts new record in the grid
+
+   Parameters:
+   point: Coordinates of new record
+   record: Buffer holding record data
+   rsize: Size of new record
+
+   Return:
+   Zero on success, error on failure
+*/
+template < int D >
+    int kgridfile < D >::insertRecord(const int64_t * point, void *record,
+				      int64_t rsize)
+{
+	int error = 0;
+	int axis = 0;
+	int shared = 0;
+	int64_t *gb = NULL;
+	int64_t esize = (D + 1) * 8 + rsize;
+	int64_t capacity = 0;
+	int64_t cell[D];
+	int64_t lo[D];
+	int64_t hi[D];
+
+	if (esize > pageSize - 16) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	while (1) {
+		getGridLocation(cell, point);
+
+		error = mapGridBucket(gridDirectory[getCellOffset(cell)], &gb);
+		if (error < 0) {
+			goto clean;
+		}
+
+		capacity = pageSize - 16 - gb[0];
+		if (esize <= capacity) {
+			appendBucketEntry(gb, point, rsize, record);
+			unmapGridBucket(gb);
+			goto clean;
+		}
+
+		unmapGridBucket(gb);
+
+		getBucketRegion(lo, hi, cell);
+
+		shared = 0;
+		for (axis = 0; axis < D; axis++) {
+			if (hi[axis] > lo[axis]) {
+				shared = 1;
+			}
+		}
+
+		if (shared) {
+			error = splitBucket(lo, hi);
+		} else {
+			error = splitGrid(cell, point);
+		}
+
+		if (error < 0) {
+			goto clean;
+		}
+	}
+
+ clean:
+	return error;
+}
+
+/* Retrieves record for given point
+
+   Parameters:
+   point: Coordinates of record to be retrieved
+   record: Buffer to hold retrieved record
+
+   Return:
+   Zero on success, error on failure
+*/
+template < int D >
+    int kgridfile < D >::findRecord(const int64_t * point, void **record)
+{
+	int error = 0;
+	int found = 0;
+	int64_t *gb = NULL;
+	int64_t *be = NULL;
+	int64_t iter = 0;
+	int64_t cell[D];
+
+	getGridLocation(cell, point);
+
+	error = mapGridBucket(gridDirectory[getCellOffset(cell)], &gb);
+	if (error < 0) {
+		goto clean;
+	}
+
+	be = gb + 2;
+	for (iter = 0; iter < gb[1]; iter++) {
+		if (memcmp(be, point, D * 8) == 0) {
+			*record = (void *)malloc(be[D]);
+			if (*record == NULL) {
+				error = -ENOMEM;
+				break;
+			}
+
+			memcpy(*record, be + D + 1, be[D]);
+			found = 1;
+			break;
+		}
+
+		be = (int64_t *) ((char *)be + getEntrySize(be));
+	}
+
+	unmapGridBucket(gb);
+
+	if (!found && error == 0) {
+		error = -EINVAL;
+	}
+
+ clean:
+	return error;
+}
+
+/* Deletes record for given point
+
+   Parameters:
+   point: Coordinates of record to be deleted
+
+   Return:
+   Zero on success, error on failure
+*/
+template < int D > int kgridfile < D >::deleteRecord(const int64_t * point)
+{
+	int error = 0;
+	int found = 0;
+	int64_t *gb = NULL;
+	int64_t *be = NULL;
+	int64_t iter = 0;
+	int64_t esize = 0;
+	int64_t cell[D];
+
+	getGridLocation(cell, point);
+
+	error = mapGridBucket(gridDirectory[getCellOffset(cell)], &gb);
+	if (error < 0) {
+		goto clean;
+	}
+
+	be = gb + 2;
+	for (iter = 0; iter < gb[1]; iter++) {
+		esize = getEntrySize(be);
+
+		if (memcmp(be, point, D * 8) == 0) {
+			memmove(be, (char *)be + esize,
+				(char *)(gb + 2) + gb[0] - ((char *)be + esize));
+			gb[0] -= esize;
+			gb[1] -= 1;
+			found = 1;
+			break;
+		}
+
+		be = (int64_t *) ((char *)be + esize);
+	}
+
+	unmapGridBucket(gb);
+
+	if (!found) {
+		error = -EINVAL;
+	}
+
+ clean:
+	return error;
+}
+
+/* Retrieves records within box given by lowest and highest corner
+
+   Parameters:
+   lo: Coordinates of lowest corner of box
+   hi: Coordinates of highest corner of box
+   dsize: Number of bytes written in buffer is stored
+   records: Buffer to hold number of retrieved records followed by records
+
+   Return:
+   Zero on success, error on failure
+*/
+template < int D >
+    int kgridfile < D >::findRangeRecords(const int64_t * lo,
+					  const int64_t * hi, int64_t * dsize,
+					  void **records)
+{
+	int error = 0;
+	int axis = 0;
+	int first = 0;
+	int inside = 0;
+	int64_t baddr = 0;
+	int64_t stride = 0;
+	int64_t cells = 1;
+	int64_t nr = 0;
+	int64_t iter = 0;
+	int64_t esize = 0;
+	int64_t *gb = NULL;
+	int64_t *be = NULL;
+	char *rrecords = NULL;
+	int64_t clo[D];
+	int64_t chi[D];
+	int64_t cell[D];
+
+	getGridLocation(clo, lo);
+	getGridLocation(chi, hi);
+
+	for (axis = 0; axis < D; axis++) {
+		cells *= chi[axis] - clo[axis] + 1;
+	}
+
+	*records = (void *)malloc(cells * pageSize + 8);
+	if (*records == NULL) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	rrecords = (char *)(*records) + 8;
+	memcpy(cell, clo, sizeof(cell));
+
+	do {
+		baddr = gridDirectory[getCellOffset(cell)];
+
+		/* Bucket is read from its lowest cell within the box only */
+		first = 1;
+		stride = 1;
+		for (axis = 0; axis < D; axis++) {
+			if (cell[axis] > clo[axis]
+			    && gridDirectory[getCellOffset(cell) - stride] ==
+			    baddr) {
+				first = 0;
+				break;
+			}
+
+			stride *= gridSize;
+		}
+
+		if (!first) {
+			continue;
+		}
+
+		error = mapGridBucket(baddr, &gb);
+		if (error < 0) {
+			goto clean;
+		}
+
+		be = gb + 2;
+		for (iter = 0; iter < gb[1]; iter++) {
+			esize = getEntrySize(be);
+
+			inside = 1;
+			for (axis = 0; axis < D; axis++) {
+				if (be[axis] < lo[axis] || be[axis] > hi[axis]) {
+					inside = 0;
+				}
+			}
+
+			if (inside) {
+				memcpy(rrecords, be, esize);
+				rrecords += esize;
+				*dsize += esize;
+				nr += 1;
+			}
+
+			be = (int64_t *) ((char *)be + esize);
+		}
+
+		unmapGridBucket(gb);
+	} while (getNextCell(cell, clo, chi));
+
+	((int64_t *) * records)[0] = nr;
+
+ clean:
+	return error;
+}
+
+#endif
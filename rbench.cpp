@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "gridfile.h"
+#include "gridfollower.h"
+#include "datagenerator.h"
+
+#define SIZE 64
+#define PSIZE 4096
+#define NAME "dbwriter"
+#define LOG "dblog"
+#define FOLLOWER "dbfollower/db"
+#define NRECORDS 500000
+#define NDELETES 50000
+#define QSIZE (INT_MAX / 100)
+#define PERIOD 10
+#define REPORT 0.5
+
+/* Fetches monotonic time in seconds
+*/
+double getTime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Follows change log of writer, serving range queries while catching up and
+   reporting lag, until writer is done and follower caught up. Count of
+   writer records is then read from pipe and compared
+
+   Parameters:
+   fd: Read end of pipe from writer
+
+   Return:
+   Zero on success, error on failure
+*/
+int runFollower(int fd)
+{
+	int error = 0;
+	int64_t nqueries = 0;
+	int64_t nentries = 0;
+	int64_t nbytes = 0;
+	int64_t ds = 0;
+	int64_t x = 0;
+	int64_t y = 0;
+	int64_t wcount = -1;
+	int64_t fcount = 0;
+	double seconds = 0;
+	double start = getTime();
+	double report = start;
+	void *records = NULL;
+	struct gridconfig vconfig;
+	struct gridfollower vfollower;
+
+	vconfig.size = SIZE;
+	vconfig.psize = PSIZE;
+	vconfig.name = FOLLOWER;
+
+	mkdir("dbfollower", 0755);
+
+	error = vfollower.startFollower(&vconfig, LOG, PERIOD);
+	if (error < 0) {
+		goto clean;
+	}
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	while (true) {
+		x = rand();
+		y = rand();
+		ds = 0;
+		error =
+		    vfollower.findRangeRecords(x, y, x + QSIZE, y + QSIZE, &ds,
+					       &records);
+		if (error < 0) {
+			goto pclean;
+		}
+		free(records);
+		nqueries++;
+
+		if (getTime() - report < REPORT) {
+			continue;
+		}
+
+		error = vfollower.getLag(&nentries, &nbytes, &seconds);
+		if (error < 0) {
+			goto pclean;
+		}
+
+		printf("Follower at %ld: lag %ld entries, %ld bytes, %.3f s, "
+		       "%.0f queries/s\n", vfollower.getAppliedLsn(), nentries,
+		       nbytes, seconds, nqueries / (getTime() - report));
+		fflush(stdout);
+
+		report = getTime();
+		nqueries = 0;
+
+		if (wcount < 0 && read(fd, &wcount, 8) != 8) {
+			wcount = -1;
+		}
+		if (wcount >= 0 && nentries == 0) {
+			break;
+		}
+	}
+
+	error = vfollower.countInRange(INT64_MIN, INT64_MIN, INT64_MAX,
+				       INT64_MAX, &fcount);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	printf("Writer records: %ld, follower records: %ld, %.2f s\n", wcount,
+	       fcount, getTime() - start);
+
+	if (wcount != fcount) {
+		error = -EPROTO;
+	}
+
+ pclean:
+	vfollower.stopFollower();
+
+ clean:
+	return error;
+}
+
+/* Inserts and deletes records in writer grid, logging changes, then passes
+   count of records to follower
+
+   Parameters:
+   fd: Write end of pipe to follower
+
+   Return:
+   Zero on success, error on failure
+*/
+int runWriter(int fd)
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t x = 0;
+	int64_t y = 0;
+	int64_t rsize = 0;
+	int64_t count = 0;
+	int64_t nmoved = 0;
+	double start = getTime();
+	void *record = NULL;
+	struct gridconfig vconfig;
+	struct gridfile vgrid;
+	vector < int64_t > xs;
+	vector < int64_t > ys;
+
+	vconfig.size = SIZE;
+	vconfig.psize = PSIZE;
+	vconfig.name = NAME;
+
+	error = vgrid.createGrid(&vconfig);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = vgrid.loadGrid();
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = vgrid.startLog(LOG);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	for (iter = 0; iter < NRECORDS; iter++) {
+		getRandomRecord(&x, &y, &rsize, &record);
+
+		error = vgrid.insertRecord(x, y, record, rsize);
+		free(record);
+		if (error < 0) {
+			goto pclean;
+		}
+
+		xs.push_back(x);
+		ys.push_back(y);
+	}
+
+	for (iter = 0; iter < NDELETES; iter++) {
+		error = vgrid.deleteRecord(xs[iter], ys[iter]);
+		if (error < 0) {
+			goto pclean;
+		}
+	}
+
+	error = vgrid.compactBuckets(-1, &nmoved);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = vgrid.countInRange(INT64_MIN, INT64_MIN, INT64_MAX, INT64_MAX,
+				   &count);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	printf("Writer done: %.2f s\n", getTime() - start);
+	fflush(stdout);
+
+	if (write(fd, &count, 8) != 8) {
+		error = -errno;
+	}
+
+ pclean:
+	vgrid.unloadGrid();
+
+ clean:
+	return error;
+}
+
+int main()
+{
+	int error = 0;
+	int status = 0;
+	int fds[2];
+	pid_t follower = 0;
+
+	unlink(LOG);
+
+	if (pipe(fds) == -1) {
+		error = -errno;
+		goto clean;
+	}
+
+	follower = fork();
+	if (follower == -1) {
+		error = -errno;
+		goto clean;
+	}
+
+	if (follower == 0) {
+		close(fds[1]);
+		error = runFollower(fds[0]);
+		printf("Follower error: %d\n", error);
+		fflush(stdout);
+		_exit(error < 0);
+	}
+
+	close(fds[0]);
+	error = runWriter(fds[1]);
+	close(fds[1]);
+
+	waitpid(follower, &status, 0);
+	if (error == 0 && WEXITSTATUS(status) != 0) {
+		error = -EPROTO;
+	}
+
+ clean:
+	printf("Error: %d\n", error);
+	return error;
+}
@@ -0,0 +1,163 @@
+#ifndef RECORDGRID_HPP
+#define RECORDGRID_HPP
+
+#include <errno.h>
+#include <limits>
+#include <type_traits>
+#include "gridfile.h"
+
+using namespace std;
+
+/* Grid file specialized for records of one fixed size type
+
+   Entries are stored without size header at a fixed stride, so bucket
+   entries are located by index arithmetic and copied as plain bytes.
+   Coordinates are stored with the width of Coord, which may be int32_t,
+   int64_t, float or double. Floating point coordinates are stored as
+   order preserving integer keys, so point and range queries behave as on
+   the original values while directory sums are taken over the keys.
+*/
+template < typename Record, typename Coord = int64_t > struct recordgrid {
+	static_assert(is_trivially_copyable < Record >::value,
+		      "Record must be trivially copyable");
+	static_assert(sizeof(Coord) == 4 || sizeof(Coord) == 8,
+		      "Coord must be 32 or 64 bits wide");
+	static_assert(is_integral < Coord >::value
+		      || is_floating_point < Coord >::value,
+		      "Coord must be an integral or floating point type");
+
+	typedef typename conditional < sizeof(Coord) == 4, int32_t,
+	    int64_t >::type key;
+
+	static constexpr int64_t recordSize = sizeof(Record);
+	static constexpr int64_t coordinateSize = sizeof(Coord);
+	static constexpr int64_t entrySize = 2 * sizeof(Coord) + sizeof(Record);
+
+	/* Computes number of records fitting in one bucket
+
+	   Parameters:
+	   psize: Page size of grid
+
+	   Return:
+	   Number of records per bucket
+	 */
+	static constexpr int64_t pageCapacity(int64_t psize) {
+		return (psize - 16) / entrySize;
+	}
+
+	/* Converts coordinate into order preserving integer key
+
+	   Parameters:
+	   c: Coordinate to be converted
+
+	   Return:
+	   Key stored in grid for coordinate
+	 */
+	static int64_t getCoordinateKey(Coord c) {
+		key k = 0;
+
+		if constexpr(is_floating_point < Coord >::value) {
+			memcpy(&k, &c, sizeof(k));
+			if (k < 0) {
+				k ^= numeric_limits < key >::max();
+			}
+		} else {
+			k = c;
+		}
+
+		return k;
+	}
+
+	/* Converts integer key stored in grid back into coordinate
+
+	   Parameters:
+	   k: Key stored in grid
+
+	   Return:
+	   Coordinate for key
+	 */
+	static Coord getCoordinate(int64_t k) {
+		key ck = k;
+		Coord c = 0;
+
+		if constexpr(is_floating_point < Coord >::value) {
+			if (ck < 0) {
+				ck ^= numeric_limits < key >::max();
+			}
+			memcpy(&c, &ck, sizeof(c));
+		} else {
+			c = ck;
+		}
+
+		return c;
+	}
+
+	struct gridfile grid;
+
+	int createGrid(struct gridconfig *configuration) {
+		configuration->fsize = recordSize;
+		configuration->csize = coordinateSize;
+		return grid.createGrid(configuration);
+	}
+
+	int loadGrid() {
+		return grid.loadGrid();
+	}
+
+	void unloadGrid() {
+		grid.unloadGrid();
+	}
+
+	int insertRecord(Coord x, Coord y, const Record & record) {
+		return grid.insertRecord(getCoordinateKey(x),
+					 getCoordinateKey(y), (void *)&record,
+					 recordSize);
+	}
+
+	int findRecord(Coord x, Coord y, Record * record) {
+		int error = 0;
+		void *found = NULL;
+
+		error =
+		    grid.findRecord(getCoordinateKey(x), getCoordinateKey(y),
+				    &found);
+		if (error == 0) {
+			memcpy((void *)record, found, recordSize);
+		}
+
+		free(found);
+
+		return error;
+	}
+
+	int deleteRecord(Coord x, Coord y) {
+		return grid.deleteRecord(getCoordinateKey(x),
+					 getCoordinateKey(y));
+	}
+
+	int updateRecord(Coord x, Coord y, const Record & record) {
+		return grid.updateRecord(getCoordinateKey(x),
+					 getCoordinateKey(y), (void *)&record,
+					 recordSize);
+	}
+
+	int moveRecord(Coord x, Coord y, Coord nx, Coord ny) {
+		return grid.moveRecord(getCoordinateKey(x), getCoordinateKey(y),
+				       getCoordinateKey(nx),
+				       getCoordinateKey(ny));
+	}
+
+	/* Retrieves records within range, coordinates of retrieved entries
+	   are keys to be converted with getCoordinate
+	 */
+	int findRangeRecords(Coord x1, Coord y1, Coord x2, Coord y2,
+			     int64_t * dsize, void **records) {
+		return grid.findRangeRecords(getCoordinateKey(x1),
+					     getCoordinateKey(y1),
+					     getCoordinateKey(x2),
+					     getCoordinateKey(y2), dsize,
+					     records);
+	}
+};
+
+#endif
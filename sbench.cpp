@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <thread>
+#include "gridfile.h"
+#include "shardgrid.h"
+#include "datagenerator.h"
+
+#define SIZE 64
+#define PSIZE 4096
+#define NRECORDS 1000000
+#define NTHREADS 4
+#define NQUERIES 1000
+#define QSIZE (INT_MAX / 100)
+
+/* Fetches monotonic time in seconds
+*/
+double getTime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Inserts share of records into single grid, each thread inserting into
+   same strip as with sharded grid
+*/
+void insertGrid(struct gridfile *grid, int64_t worker, int *error)
+{
+	int64_t iter = 0;
+	int64_t x = 0;
+	int64_t y = 0;
+	int64_t rsize = 0;
+	void *record = NULL;
+
+	for (iter = 0; iter < NRECORDS / NTHREADS && *error == 0; iter++) {
+		getRandomRecord(&x, &y, &rsize, &record);
+		x = x / NTHREADS + worker * (INT_MAX / NTHREADS);
+		*error = grid->insertRecord(x, y, record, rsize);
+		free(record);
+	}
+}
+
+/* Inserts share of records into sharded grid, each thread inserting into
+   strip of its own
+*/
+void insertShards(struct shardgrid *grid, int64_t worker, int *error)
+{
+	int64_t iter = 0;
+	int64_t x = 0;
+	int64_t y = 0;
+	int64_t rsize = 0;
+	void *record = NULL;
+
+	for (iter = 0; iter < NRECORDS / NTHREADS && *error == 0; iter++) {
+		getRandomRecord(&x, &y, &rsize, &record);
+		x = x / NTHREADS + worker * (INT_MAX / NTHREADS);
+		*error = grid->insertRecord(x, y, record, rsize);
+		free(record);
+	}
+}
+
+int main()
+{
+	int error = 0;
+	int errors[NTHREADS];
+	int64_t iter = 0;
+	int64_t x = 0;
+	int64_t y = 0;
+	int64_t ds = 0;
+	int64_t found = 0;
+	int64_t shard = 0;
+	void *records = NULL;
+	double start = 0;
+	struct gridconfig vconfig;
+	struct gridfile vgrid;
+	struct shardgrid sgrid;
+	vector < int64_t > xparts;
+	thread workers[NTHREADS];
+
+	vconfig.size = SIZE;
+	vconfig.psize = PSIZE;
+
+	vconfig.name = "dbsingle";
+	error = vgrid.createGrid(&vconfig);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = vgrid.loadGrid();
+	if (error < 0) {
+		goto clean;
+	}
+
+	for (iter = 1; iter < NTHREADS; iter++) {
+		xparts.push_back(iter * (INT_MAX / NTHREADS) - 1);
+	}
+
+	vconfig.name = "dbsharded";
+	error = sgrid.createGrid(&vconfig, xparts);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = sgrid.loadGrid();
+	if (error < 0) {
+		goto pclean;
+	}
+
+	start = getTime();
+	for (iter = 0; iter < NTHREADS; iter++) {
+		errors[iter] = 0;
+		workers[iter] = thread(insertGrid, &vgrid, iter, &errors[iter]);
+	}
+	for (iter = 0; iter < NTHREADS; iter++) {
+		workers[iter].join();
+		error = error ? error : errors[iter];
+	}
+	if (error < 0) {
+		goto sclean;
+	}
+	printf("Single grid, %d threads insert: %.2f s\n", NTHREADS,
+	       getTime() - start);
+
+	start = getTime();
+	for (iter = 0; iter < NTHREADS; iter++) {
+		errors[iter] = 0;
+		workers[iter] =
+		    thread(insertShards, &sgrid, iter, &errors[iter]);
+	}
+	for (iter = 0; iter < NTHREADS; iter++) {
+		workers[iter].join();
+		error = error ? error : errors[iter];
+	}
+	if (error < 0) {
+		goto sclean;
+	}
+	printf("%ld shards, %d threads insert: %.2f s\n",
+	       sgrid.getShardCount(), NTHREADS, getTime() - start);
+
+	srand(2);
+	start = getTime();
+	for (iter = 0; iter < NQUERIES; iter++) {
+		x = rand();
+		y = rand();
+		ds = 0;
+		error =
+		    sgrid.findRangeRecords(x, y, x + QSIZE, y + QSIZE, &ds,
+					   &records);
+		if (error < 0) {
+			goto sclean;
+		}
+		found += ((int64_t *) records)[0];
+		free(records);
+	}
+	printf("Sharded range: %.4f s, %ld records\n", getTime() - start,
+	       found);
+
+	error = sgrid.getHotShard(&shard);
+	if (error < 0) {
+		goto sclean;
+	}
+
+	start = getTime();
+	error = sgrid.splitShard(shard);
+	if (error < 0) {
+		goto sclean;
+	}
+	printf("Split shard %ld: %.2f s, %ld shards\n", shard,
+	       getTime() - start, sgrid.getShardCount());
+
+	error = sgrid.countInRange(INT64_MIN, INT64_MIN, INT64_MAX, INT64_MAX,
+				   &found);
+	if (error < 0) {
+		goto sclean;
+	}
+	printf("Records counted: %ld\n", found);
+
+ sclean:
+	sgrid.unloadGrid();
+
+ pclean:
+	vgrid.unloadGrid();
+
+ clean:
+	printf("Error: %d\n", error);
+	return error;
+}
@@ -0,0 +1,878 @@
+#include <errno.h>
+#include <algorithm>
+#include <future>
+#include "shardgrid.h"
+
+/* Unloads shards and releases them
+*/
+shardgrid::~shardgrid()
+{
+	int64_t iter = 0;
+
+	unloadGrid();
+
+	for (iter = 0; iter < (int64_t) shards.size(); iter++) {
+		delete shards[iter];
+	}
+}
+
+/* Builds name of grid file of shard
+
+   Parameters:
+   id: Number in name of shard
+
+   Return:
+   Name of grid file of shard
+*/
+string shardgrid::getShardName(int64_t id)
+{
+	return shardConfig.name + "shard" + to_string(id);
+}
+
+/* Writes layout file of sharded grid, replacing previous one at once
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::writeShardMeta()
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t bounds[5];
+	FILE *f = NULL;
+	string name = shardConfig.name + "shards";
+	string tname = name + "tmp";
+	struct gridshard *shard = NULL;
+	struct shardmeta meta;
+
+	memset(&meta, 0, sizeof(meta));
+	meta.magic = SHARD_MAGIC;
+	meta.version = SHARD_VERSION;
+	meta.size = shardConfig.size;
+	meta.pageSize = shardConfig.psize;
+	meta.recordSize = shardConfig.fsize;
+	meta.coordinateSize = shardConfig.csize;
+	meta.splitPolicy = shardConfig.split;
+	meta.splitQuantile = shardConfig.quantile;
+	meta.randomCost = shardConfig.rcost;
+	meta.bucketPages = shardConfig.pages;
+	meta.shardNames = shardNames;
+	meta.shards = shards.size();
+
+	f = fopen(tname.c_str(), "w");
+	if (f == NULL) {
+		error = -errno;
+		goto clean;
+	}
+
+	if (fwrite(&meta, sizeof(meta), 1, f) != 1) {
+		error = -EIO;
+	}
+
+	for (iter = 0; iter < (int64_t) shards.size() && error == 0; iter++) {
+		shard = shards[iter];
+		bounds[0] = shard->x1;
+		bounds[1] = shard->y1;
+		bounds[2] = shard->x2;
+		bounds[3] = shard->y2;
+		bounds[4] = shard->id;
+		if (fwrite(bounds, sizeof(bounds), 1, f) != 1) {
+			error = -EIO;
+		}
+	}
+
+	if (error == 0 && fflush(f) != 0) {
+		error = -EIO;
+	}
+
+	fclose(f);
+
+	if (error == 0 && rename(tname.c_str(), name.c_str()) == -1) {
+		error = -errno;
+	}
+
+ clean:
+	return error;
+}
+
+/* Reads layout file of sharded grid, restoring configuration of shards
+   and shards with their bounds, grid files of shards being left unloaded
+
+   Parameters:
+   name: Name of sharded grid
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::readShardMeta(string name)
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t bounds[5];
+	FILE *f = NULL;
+	struct gridshard *shard = NULL;
+	struct shardmeta meta;
+
+	f = fopen((name + "shards").c_str(), "r");
+	if (f == NULL) {
+		error = -errno;
+		goto clean;
+	}
+
+	if (fread(&meta, sizeof(meta), 1, f) != 1
+	    || meta.magic != SHARD_MAGIC || meta.version != SHARD_VERSION) {
+		error = -EINVAL;
+		goto pclean;
+	}
+
+	shardConfig.name = name;
+	shardConfig.size = meta.size;
+	shardConfig.psize = meta.pageSize;
+	shardConfig.fsize = meta.recordSize;
+	shardConfig.csize = meta.coordinateSize;
+	shardConfig.split = meta.splitPolicy;
+	shardConfig.quantile = meta.splitQuantile;
+	shardConfig.rcost = meta.randomCost;
+	shardConfig.pages = meta.bucketPages;
+	shardNames = meta.shardNames;
+
+	for (iter = 0; iter < meta.shards; iter++) {
+		if (fread(bounds, sizeof(bounds), 1, f) != 1) {
+			error = -EINVAL;
+			goto pclean;
+		}
+
+		shard = new gridshard;
+		shard->x1 = bounds[0];
+		shard->y1 = bounds[1];
+		shard->x2 = bounds[2];
+		shard->y2 = bounds[3];
+		shard->id = bounds[4];
+		shard->operations = 0;
+		shards.push_back(shard);
+	}
+
+ pclean:
+	fclose(f);
+
+ clean:
+	return error;
+}
+
+/* Creates grid file of new shard
+
+   Parameters:
+   shard: New shard is stored
+   x1: Lowest coordinate (x) of shard
+   y1: Lowest coordinate (y) of shard
+   x2: Highest coordinate (x) of shard
+   y2: Highest coordinate (y) of shard
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::createShard(struct gridshard **shard, int64_t x1, int64_t y1,
+			   int64_t x2, int64_t y2)
+{
+	int error = 0;
+	struct gridconfig configuration = shardConfig;
+
+	*shard = new gridshard;
+	(*shard)->x1 = x1;
+	(*shard)->y1 = y1;
+	(*shard)->x2 = x2;
+	(*shard)->y2 = y2;
+	(*shard)->operations = 0;
+	(*shard)->id = shardNames;
+
+	configuration.name = getShardName(shardNames);
+	shardNames += 1;
+
+	error = (*shard)->grid.createGrid(&configuration);
+	if (error < 0) {
+		delete *shard;
+		*shard = NULL;
+	}
+
+	return error;
+}
+
+/* Fetches shard holding given coordinates, counting operation on it
+
+   Parameters:
+   x: Coordinate (x)
+   y: Coordinate (y)
+
+   Return:
+   Shard holding coordinates
+*/
+struct gridshard *shardgrid::getShard(int64_t x, int64_t y)
+{
+	int64_t iter = 0;
+	struct gridshard *shard = NULL;
+
+	for (iter = 0; iter < (int64_t) shards.size(); iter++) {
+		shard = shards[iter];
+		if (x >= shard->x1 && x <= shard->x2 && y >= shard->y1
+		    && y <= shard->y2) {
+			break;
+		}
+	}
+
+	shard->operations += 1;
+
+	return shard;
+}
+
+/* Retrieves entry of record for given coordinates as retrieved by range
+   queries, holding record size as well as record data
+
+   Parameters:
+   shard: Shard holding record
+   x: Coordinate (x) of record
+   y: Coordinate (y) of record
+   records: Buffer holding retrieved entry is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::fetchRecordEntry(struct gridshard *shard, int64_t x, int64_t y,
+				void **records)
+{
+	int error = 0;
+	int64_t ds = 0;
+
+	error = shard->grid.findRangeRecords(x, y, x, y, &ds, records);
+	if (error < 0) {
+		goto clean;
+	}
+
+	if (((int64_t *) * records)[0] == 0) {
+		error = -EINVAL;
+	}
+
+ clean:
+	return error;
+}
+
+/* Creates one shard per strip of coordinate space between partitions and
+   layout file of sharded grid. Shards are loaded by loadGrid
+
+   Parameters:
+   configuration: Configuration of grid file of every shard, name being
+   prefix of shard names
+   xparts: Ascending partitions (x), strip of a shard ending at each
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::createGrid(struct gridconfig *configuration,
+			  vector < int64_t > &xparts)
+{
+	unique_lock < shared_mutex > guard(shardLock);
+	int error = 0;
+	int64_t iter = 0;
+	int64_t x1 = INT64_MIN;
+	int64_t x2 = INT64_MAX;
+	struct gridshard *shard = NULL;
+
+	for (iter = 1; iter < (int64_t) xparts.size(); iter++) {
+		if (xparts[iter] <= xparts[iter - 1]) {
+			error = -EINVAL;
+			goto clean;
+		}
+	}
+
+	shardConfig = *configuration;
+	shardNames = 0;
+
+	for (iter = 0; iter <= (int64_t) xparts.size(); iter++) {
+		x2 = iter < (int64_t) xparts.size() ? xparts[iter] : INT64_MAX;
+
+		error = createShard(&shard, x1, INT64_MIN, x2, INT64_MAX);
+		if (error < 0) {
+			goto clean;
+		}
+
+		shards.push_back(shard);
+
+		if (x2 < INT64_MAX) {
+			x1 = x2 + 1;
+		}
+	}
+
+	error = writeShardMeta();
+
+ clean:
+	return error;
+}
+
+/* Opens existing sharded grid by name, taking layout of shards from its
+   layout file and opening grid file of every shard
+
+   Parameters:
+   name: Name sharded grid was created with
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::openGrid(string name)
+{
+	unique_lock < shared_mutex > guard(shardLock);
+	int error = 0;
+	int64_t iter = 0;
+
+	if (!shards.empty()) {
+		error = -EBUSY;
+		goto clean;
+	}
+
+	error = readShardMeta(name);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	for (iter = 0; iter < (int64_t) shards.size(); iter++) {
+		error =
+		    shards[iter]->grid.openGrid(getShardName(shards[iter]->id));
+		if (error < 0) {
+			break;
+		}
+	}
+
+	if (error < 0) {
+		while (iter > 0) {
+			iter -= 1;
+			shards[iter]->grid.unloadGrid();
+		}
+		goto pclean;
+	}
+
+	shardsLoaded = true;
+	goto clean;
+
+ pclean:
+	for (iter = 0; iter < (int64_t) shards.size(); iter++) {
+		delete shards[iter];
+	}
+	shards.clear();
+
+ clean:
+	return error;
+}
+
+/* Loads grid files of all shards, unloading those loaded on failure
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::loadGrid()
+{
+	unique_lock < shared_mutex > guard(shardLock);
+	int error = 0;
+	int64_t iter = 0;
+
+	if (shardsLoaded) {
+		error = -EBUSY;
+		goto clean;
+	}
+
+	for (iter = 0; iter < (int64_t) shards.size(); iter++) {
+		error = shards[iter]->grid.loadGrid();
+		if (error < 0) {
+			break;
+		}
+	}
+
+	if (error < 0) {
+		while (iter > 0) {
+			iter -= 1;
+			shards[iter]->grid.unloadGrid();
+		}
+		goto clean;
+	}
+
+	shardsLoaded = true;
+
+ clean:
+	return error;
+}
+
+/* Saves layout file and unloads grid files of all shards, if loaded
+*/
+void shardgrid::unloadGrid()
+{
+	unique_lock < shared_mutex > guard(shardLock);
+	int64_t iter = 0;
+
+	if (!shardsLoaded) {
+		return;
+	}
+
+	writeShardMeta();
+
+	for (iter = 0; iter < (int64_t) shards.size(); iter++) {
+		shards[iter]->grid.unloadGrid();
+	}
+
+	shardsLoaded = false;
+}
+
+/* Inserts new record in shard holding its coordinates
+
+   Parameters:
+   x: Coordinate (x) of new record
+   y: Coordinate (y) of new record
+   record: Buffer holding record data
+   rsize: Size of new record
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::insertRecord(int64_t x, int64_t y, void *record, int64_t rsize)
+{
+	shared_lock < shared_mutex > guard(shardLock);
+
+	return getShard(x, y)->grid.insertRecord(x, y, record, rsize);
+}
+
+/* Retrieves record for given coordinates from shard holding them
+
+   Parameters:
+   x: Coordinate (x) of record to be retrieved
+   y: Coordinate (y) of record to be retrieved
+   record: Buffer to hold retrieved record
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::findRecord(int64_t x, int64_t y, void **record)
+{
+	shared_lock < shared_mutex > guard(shardLock);
+
+	return getShard(x, y)->grid.findRecord(x, y, record);
+}
+
+/* Deletes record for given coordinates from shard holding them
+
+   Parameters:
+   x: Coordinate (x) of record to be deleted
+   y: Coordinate (y) of record to be deleted
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::deleteRecord(int64_t x, int64_t y)
+{
+	shared_lock < shared_mutex > guard(shardLock);
+
+	return getShard(x, y)->grid.deleteRecord(x, y);
+}
+
+/* Overwrites data of record for given coordinates in shard holding them
+
+   Parameters:
+   x: Coordinate (x) of record to be updated
+   y: Coordinate (y) of record to be updated
+   record: Buffer holding new record data
+   rsize: Size of new record data
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::updateRecord(int64_t x, int64_t y, void *record, int64_t rsize)
+{
+	shared_lock < shared_mutex > guard(shardLock);
+
+	return getShard(x, y)->grid.updateRecord(x, y, record, rsize);
+}
+
+/* Moves record to new coordinates, within its shard if it holds them, by
+   inserting record in shard holding new coordinates and deleting it from
+   its shard otherwise
+
+   Parameters:
+   x: Coordinate (x) of record to be moved
+   y: Coordinate (y) of record to be moved
+   nx: New coordinate (x) of record
+   ny: New coordinate (y) of record
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::moveRecord(int64_t x, int64_t y, int64_t nx, int64_t ny)
+{
+	shared_lock < shared_mutex > guard(shardLock);
+	int error = 0;
+	int64_t *entry = NULL;
+	void *records = NULL;
+	struct gridshard *shard = getShard(x, y);
+	struct gridshard *nshard = getShard(nx, ny);
+
+	if (shard == nshard) {
+		error = shard->grid.moveRecord(x, y, nx, ny);
+		goto clean;
+	}
+
+	error = fetchRecordEntry(shard, x, y, &records);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	entry = (int64_t *) records + 1;
+
+	error = nshard->grid.insertRecord(nx, ny, entry + 3, entry[2]);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = shard->grid.deleteRecord(x, y);
+
+ pclean:
+	free(records);
+
+ clean:
+	return error;
+}
+
+/* Retrieves records within range, querying every shard meeting range in
+   parallel and merging their results
+
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   dsize: Number of bytes written in buffer is stored
+   records: Buffer to hold retrieved records
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::findRangeRecords(int64_t x1, int64_t y1, int64_t x2,
+				int64_t y2, int64_t * dsize, void **records)
+{
+	shared_lock < shared_mutex > guard(shardLock);
+	int error = 0;
+	int64_t iter = 0;
+	int64_t nr = 0;
+	int64_t total = 0;
+	char *rrecords = NULL;
+	struct gridshard *shard = NULL;
+	vector < struct gridshard *>hit;
+	vector < future < int > >pending;
+	vector < void *>results;
+	vector < int64_t > sizes;
+
+	for (iter = 0; iter < (int64_t) shards.size(); iter++) {
+		shard = shards[iter];
+		if (x1 <= shard->x2 && x2 >= shard->x1 && y1 <= shard->y2
+		    && y2 >= shard->y1) {
+			hit.push_back(shard);
+		}
+	}
+
+	results.assign(hit.size(), NULL);
+	sizes.assign(hit.size(), 0);
+
+	for (iter = 0; iter < (int64_t) hit.size(); iter++) {
+		shard = hit[iter];
+		pending.push_back(async(launch::async,
+					&gridfile::findRangeRecords,
+					&shard->grid, max(x1, shard->x1),
+					max(y1, shard->y1), min(x2, shard->x2),
+					min(y2, shard->y2), &sizes[iter],
+					&results[iter]));
+	}
+
+	for (iter = 0; iter < (int64_t) pending.size(); iter++) {
+		if (pending[iter].get() < 0 && error == 0) {
+			error = -EIO;
+		}
+		total += sizes[iter];
+	}
+
+	if (error < 0) {
+		goto clean;
+	}
+
+	*records = (void *)malloc(total + 8);
+	if (*records == NULL) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	rrecords = (char *)(*records) + 8;
+
+	for (iter = 0; iter < (int64_t) hit.size(); iter++) {
+		memcpy(rrecords, (char *)results[iter] + 8, sizes[iter]);
+		rrecords += sizes[iter];
+		nr += ((int64_t *) results[iter])[0];
+	}
+
+	((int64_t *) * records)[0] = nr;
+	*dsize += total;
+
+ clean:
+	for (iter = 0; iter < (int64_t) results.size(); iter++) {
+		free(results[iter]);
+	}
+
+	return error;
+}
+
+/* Counts records within range, counting every shard meeting range in
+   parallel
+
+   Parameters:
+   x1: Coordinate (x) representing lower left corner of range
+   y1: Coordinate (y) representing lower left corner of range
+   x2: Coordinate (x) representing upper right corner of range
+   y2: Coordinate (y) representing upper right corner of range
+   count: Number of records is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::countInRange(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			    int64_t * count)
+{
+	shared_lock < shared_mutex > guard(shardLock);
+	int error = 0;
+	int64_t iter = 0;
+	struct gridshard *shard = NULL;
+	vector < future < int > >pending;
+	vector < int64_t > counts(shards.size(), 0);
+
+	*count = 0;
+
+	for (iter = 0; iter < (int64_t) shards.size(); iter++) {
+		shard = shards[iter];
+		if (x1 > shard->x2 || x2 < shard->x1 || y1 > shard->y2
+		    || y2 < shard->y1) {
+			continue;
+		}
+
+		pending.push_back(async(launch::async, &gridfile::countInRange,
+					&shard->grid, max(x1, shard->x1),
+					max(y1, shard->y1), min(x2, shard->x2),
+					min(y2, shard->y2), &counts[iter]));
+	}
+
+	for (iter = 0; iter < (int64_t) pending.size(); iter++) {
+		if (pending[iter].get() < 0) {
+			error = -EIO;
+		}
+	}
+
+	for (iter = 0; iter < (int64_t) counts.size(); iter++) {
+		*count += counts[iter];
+	}
+
+	return error;
+}
+
+/* Fetches number of shards
+
+   Return:
+   Number of shards
+*/
+int64_t shardgrid::getShardCount()
+{
+	shared_lock < shared_mutex > guard(shardLock);
+
+	return shards.size();
+}
+
+/* Fetches shard with most point operations since it was created or last
+   split
+
+   Parameters:
+   shard: Position of hottest shard is stored
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::getHotShard(int64_t * shard)
+{
+	shared_lock < shared_mutex > guard(shardLock);
+	int64_t iter = 0;
+
+	*shard = 0;
+
+	for (iter = 1; iter < (int64_t) shards.size(); iter++) {
+		if (shards[iter]->operations > shards[*shard]->operations) {
+			*shard = iter;
+		}
+	}
+
+	return 0;
+}
+
+/* Splits shard in two at median of its records along direction of larger
+   spread, records above median moving to new shard. Shard is left as it was
+   on failure
+
+   Parameters:
+   shard: Position of shard to be split
+
+   Return:
+   Zero on success, error on failure
+*/
+int shardgrid::splitShard(int64_t shard)
+{
+	unique_lock < shared_mutex > guard(shardLock);
+	int error = 0;
+	int vertical = 0;
+	int pass = 0;
+	int64_t ds = 0;
+	int64_t nr = 0;
+	int64_t iter = 0;
+	int64_t diter = 0;
+	int64_t partition = 0;
+	int64_t nmoved = 0;
+	int64_t *entry = NULL;
+	char *be = NULL;
+	void *records = NULL;
+	struct gridshard *oshard = NULL;
+	struct gridshard *nshard = NULL;
+	vector < int64_t > xs;
+	vector < int64_t > ys;
+	vector < int64_t > *cs = NULL;
+
+	if (!shardsLoaded || shard < 0 || shard >= (int64_t) shards.size()) {
+		error = -EINVAL;
+		goto clean;
+	}
+
+	oshard = shards[shard];
+
+	error = oshard->grid.findRangeRecords(oshard->x1, oshard->y1,
+					      oshard->x2, oshard->y2, &ds,
+					      &records);
+	if (error < 0) {
+		goto clean;
+	}
+
+	nr = ((int64_t *) records)[0];
+	be = (char *)records + 8;
+	for (iter = 0; iter < nr; iter++) {
+		entry = (int64_t *) be;
+		xs.push_back(entry[0]);
+		ys.push_back(entry[1]);
+		be += 24 + entry[2];
+	}
+
+	if (nr < 2) {
+		error = -EINVAL;
+		goto pclean;
+	}
+
+	vertical = *max_element(xs.begin(), xs.end()) -
+	    *min_element(xs.begin(), xs.end()) >=
+	    *max_element(ys.begin(), ys.end()) -
+	    *min_element(ys.begin(), ys.end());
+	cs = vertical ? &xs : &ys;
+
+	/* Partition keeps at least one record on either side */
+	sort(cs->begin(), cs->end());
+	partition = (*cs)[(nr - 1) / 2];
+	if (partition == cs->back()) {
+		iter = lower_bound(cs->begin(), cs->end(), partition) -
+		    cs->begin();
+		if (iter == 0) {
+			error = -EINVAL;
+			goto pclean;
+		}
+		partition = (*cs)[iter - 1];
+	}
+
+	if (vertical) {
+		error = createShard(&nshard, partition + 1, oshard->y1,
+				    oshard->x2, oshard->y2);
+	} else {
+		error = createShard(&nshard, oshard->x1, partition + 1,
+				    oshard->x2, oshard->y2);
+	}
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = nshard->grid.loadGrid();
+	if (error < 0) {
+		delete nshard;
+		nshard = NULL;
+		goto pclean;
+	}
+
+	/* Records are deleted only once all of them are in new shard */
+	for (pass = 0; pass < 2; pass++) {
+		be = (char *)records + 8;
+		for (iter = 0; iter < nr; iter++) {
+			entry = (int64_t *) be;
+			be += 24 + entry[2];
+
+			if ((vertical ? entry[0] : entry[1]) <= partition) {
+				continue;
+			}
+
+			if (pass == 0) {
+				error =
+				    nshard->grid.insertRecord(entry[0],
+							      entry[1],
+							      entry + 3,
+							      entry[2]);
+			} else {
+				error =
+				    oshard->grid.deleteRecord(entry[0],
+							      entry[1]);
+			}
+
+			if (error < 0) {
+				goto pclean;
+			}
+		}
+	}
+
+	if (vertical) {
+		oshard->x2 = partition;
+	} else {
+		oshard->y2 = partition;
+	}
+
+	oshard->operations = 0;
+	shards.push_back(nshard);
+	nshard = NULL;
+
+	error = writeShardMeta();
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = oshard->grid.compactBuckets(-1, &nmoved);
+
+ pclean:
+	/* Records deleted before failure go back, new shard being dropped */
+	if (error < 0 && pass == 1) {
+		be = (char *)records + 8;
+		for (diter = 0; diter < iter; diter++) {
+			entry = (int64_t *) be;
+			be += 24 + entry[2];
+
+			if ((vertical ? entry[0] : entry[1]) > partition) {
+				oshard->grid.insertRecord(entry[0], entry[1],
+							  entry + 3, entry[2]);
+			}
+		}
+	}
+
+	free(records);
+
+	if (nshard != NULL) {
+		nshard->grid.unloadGrid();
+		delete nshard;
+	}
+
+ clean:
+	return error;
+}
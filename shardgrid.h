@@ -0,0 +1,91 @@
+#ifndef SHARDGRID_HPP
+#define SHARDGRID_HPP
+
+#include <atomic>
+#include <shared_mutex>
+#include <vector>
+#include "gridfile.h"
+
+using namespace std;
+
+#define SHARD_MAGIC 0x5344524148534447
+#define SHARD_VERSION 1
+
+/* Header of layout file of sharded grid, followed by bounds (x1, y1, x2,
+   y2) and number in name of each shard
+*/
+struct shardmeta {
+	int64_t magic;
+	int64_t version;
+	int64_t size;
+	int64_t pageSize;
+	int64_t recordSize;
+	int64_t coordinateSize;
+	int64_t splitPolicy;
+	double splitQuantile;
+	double randomCost;
+	int64_t bucketPages;
+	int64_t shardNames;
+	int64_t shards;
+};
+
+/* Shard of sharded grid, holding records of a rectangle of coordinates in
+   its own grid file
+*/
+struct gridshard {
+	int64_t id;
+	int64_t x1;
+	int64_t y1;
+	int64_t x2;
+	int64_t y2;
+	atomic < int64_t > operations;
+	struct gridfile grid;
+};
+
+/* Grid partitioned over independent grid files by coordinates. Space is
+   first cut into strips along given partitions (x), each strip being one
+   shard, and a shard may later be split in two at median of its records.
+   Point operations go to the one shard holding coordinates, so callers on
+   different shards run in parallel, range queries fan out to shards
+   meeting range in parallel and results are merged. Layout of shards is
+   kept in layout file, so that sharded grid can be opened again.
+*/
+struct shardgrid {
+ private:
+	struct gridconfig shardConfig;
+	int64_t shardNames;
+	vector < struct gridshard *>shards;
+	shared_mutex shardLock;
+	bool shardsLoaded = false;
+
+	string getShardName(int64_t id);
+	int writeShardMeta();
+	int readShardMeta(string name);
+	int createShard(struct gridshard **shard, int64_t x1, int64_t y1,
+			int64_t x2, int64_t y2);
+	struct gridshard *getShard(int64_t x, int64_t y);
+	int fetchRecordEntry(struct gridshard *shard, int64_t x, int64_t y,
+			     void **records);
+
+ public:
+	~shardgrid();
+	int createGrid(struct gridconfig *configuration,
+		       vector < int64_t > &xparts);
+	int openGrid(string name);
+	int loadGrid();
+	void unloadGrid();
+	int insertRecord(int64_t x, int64_t y, void *record, int64_t rsize);
+	int findRecord(int64_t x, int64_t y, void **record);
+	int deleteRecord(int64_t x, int64_t y);
+	int updateRecord(int64_t x, int64_t y, void *record, int64_t rsize);
+	int moveRecord(int64_t x, int64_t y, int64_t nx, int64_t ny);
+	int findRangeRecords(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			     int64_t * dsize, void **records);
+	int countInRange(int64_t x1, int64_t y1, int64_t x2, int64_t y2,
+			 int64_t * count);
+	int64_t getShardCount();
+	int getHotShard(int64_t * shard);
+	int splitShard(int64_t shard);
+};
+
+#endif
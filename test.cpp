@@ -2,7 +2,10 @@
 #include <errno.h>
 #include <time.h>
 #include <limits.h>
+#include <math.h>
+#include <algorithm>
 #include "gridfile.h"
+#include "recordgrid.h"
 #include "datagenerator.h"
 
 #define SIZE 1000
@@ -13,6 +16,720 @@
 #define X2 INT_MAX
 #define Y1 0
 #define Y2 INT_MAX
+#define NQUERIES 10000
+#define KMAX 100
+#define RADIUS (INT_MAX / 1000)
+#define SIDE (INT_MAX / 1000)
+#define MEMTABLE (16 << 20)
+#define NHOT 200
+#define NCHECKS 1000
+#define NFILL 32
+#define FILLSIZE 100
+#define GROWNSIZE 300
+#define VIEWWAIT 100
+#define NTYPED 2000
+#define NSAMPLES 100
+#define KCHECK 10
+#define SHAPESIDE (INT_MAX / 50)
+
+/* Record of typed grid test
+*/
+struct typedrecord {
+	int64_t id;
+	double weight;
+};
+
+/* Fetches value stored as record at given coordinates
+
+   Parameters:
+   grid: Grid holding record
+   x: Coordinate (x) of record
+   y: Coordinate (y) of record
+
+   Return:
+   Value of record, -1 if no record is found
+*/
+int64_t findValue(struct gridfile *grid, int64_t x, int64_t y)
+{
+	int64_t value = -1;
+	void *record = NULL;
+
+	if (grid->findRecord(x, y, &record) == 0) {
+		value = *(int64_t *) record;
+	}
+
+	free(record);
+
+	return value;
+}
+
+/* Computes squared distance between coordinates, exact for coordinates of
+   test
+
+   Parameters:
+   x1: Coordinate (x) of first point
+   y1: Coordinate (y) of first point
+   x2: Coordinate (x) of second point
+   y2: Coordinate (y) of second point
+
+   Return:
+   Squared distance
+*/
+long double getSquaredDistance(int64_t x1, int64_t y1, int64_t x2, int64_t y2)
+{
+	long double dx = x1 - x2;
+	long double dy = y1 - y2;
+
+	return dx * dx + dy * dy;
+}
+
+/* Counts nearest neighbour queries at random coordinates answered wrong.
+   Distances of k records found must match k smallest distances of records
+   within square around query holding k-th distance, retrieved by range
+
+   Parameters:
+   grid: Grid holding records
+
+   Return:
+   Number of queries answered wrong, error on failure
+*/
+int64_t countNearestMismatches(struct gridfile *grid)
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t eiter = 0;
+	int64_t nbad = 0;
+	int64_t nr = 0;
+	int64_t ds = 0;
+	int64_t x = 0;
+	int64_t y = 0;
+	int64_t r = 0;
+	int64_t *entry = NULL;
+	char *be = NULL;
+	void *records = NULL;
+	long double d = 0;
+	long double dmax = 0;
+	vector < long double >found;
+	vector < long double >expected;
+
+	for (iter = 0; iter < NSAMPLES && error == 0; iter++) {
+		x = rand();
+		y = rand();
+		found.clear();
+		expected.clear();
+
+		ds = 0;
+		error = grid->findNearestRecords(x, y, KCHECK, &ds, &records);
+		if (error < 0) {
+			break;
+		}
+
+		nr = *(int64_t *) records;
+		be = (char *)records + 8;
+		for (eiter = 0; eiter < nr; eiter++) {
+			entry = (int64_t *) be;
+			found.push_back(getSquaredDistance(x, y, entry[0],
+							   entry[1]));
+			be += 24 + entry[2];
+		}
+
+		free(records);
+
+		if (nr != KCHECK) {
+			nbad += 1;
+			continue;
+		}
+
+		sort(found.begin(), found.end());
+		dmax = found[KCHECK - 1];
+		r = (int64_t) ceill(sqrtl(dmax));
+
+		error = grid->findRangeRecords(x - r, y - r, x + r, y + r, &ds,
+					       &records);
+		if (error < 0) {
+			break;
+		}
+
+		nr = *(int64_t *) records;
+		be = (char *)records + 8;
+		for (eiter = 0; eiter < nr; eiter++) {
+			entry = (int64_t *) be;
+			d = getSquaredDistance(x, y, entry[0], entry[1]);
+			if (d <= dmax) {
+				expected.push_back(d);
+			}
+			be += 24 + entry[2];
+		}
+
+		free(records);
+
+		sort(expected.begin(), expected.end());
+		expected.resize(min((int64_t) expected.size(),
+				    (int64_t) KCHECK));
+		if (found != expected) {
+			nbad += 1;
+		}
+	}
+
+	return error < 0 ? error : nbad;
+}
+
+/* Counts aggregates over random ranges answered wrong, compared with
+   count and coordinate sums of records retrieved by range
+
+   Parameters:
+   grid: Grid holding records
+
+   Return:
+   Number of ranges answered wrong, error on failure
+*/
+int64_t countAggregateMismatches(struct gridfile *grid)
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t eiter = 0;
+	int64_t nbad = 0;
+	int64_t nr = 0;
+	int64_t ds = 0;
+	int64_t x1 = 0;
+	int64_t y1 = 0;
+	int64_t x2 = 0;
+	int64_t y2 = 0;
+	int64_t count = 0;
+	int64_t sx = 0;
+	int64_t sy = 0;
+	int64_t rsx = 0;
+	int64_t rsy = 0;
+	int64_t *entry = NULL;
+	char *be = NULL;
+	void *records = NULL;
+	double cx = 0;
+	double cy = 0;
+
+	for (iter = 0; iter < NSAMPLES && error == 0; iter++) {
+		x1 = rand();
+		y1 = rand();
+		x2 = x1 + rand() % (INT_MAX / 10);
+		y2 = y1 + rand() % (INT_MAX / 10);
+
+		error = grid->findRangeRecords(x1, y1, x2, y2, &ds, &records);
+		if (error < 0) {
+			break;
+		}
+
+		rsx = 0;
+		rsy = 0;
+		nr = *(int64_t *) records;
+		be = (char *)records + 8;
+		for (eiter = 0; eiter < nr; eiter++) {
+			entry = (int64_t *) be;
+			rsx += entry[0];
+			rsy += entry[1];
+			be += 24 + entry[2];
+		}
+
+		free(records);
+
+		error = grid->countInRange(x1, y1, x2, y2, &count);
+		if (error == 0) {
+			error = grid->sumInRange(x1, y1, x2, y2, &sx, &sy);
+		}
+		if (error < 0) {
+			break;
+		}
+
+		if (count != nr || sx != rsx || sy != rsy) {
+			nbad += 1;
+			continue;
+		}
+
+		error = grid->centroidInRange(x1, y1, x2, y2, &cx, &cy);
+		if (nr == 0 && error == -EINVAL) {
+			error = 0;
+			continue;
+		}
+		if (error < 0) {
+			break;
+		}
+
+		if (cx != (double)rsx / nr || cy != (double)rsy / nr) {
+			nbad += 1;
+		}
+	}
+
+	return error < 0 ? error : nbad;
+}
+
+/* Checks if coordinates lie within triangle given counterclockwise,
+   edges included
+
+   Parameters:
+   xs: Coordinates (x) of vertices
+   ys: Coordinates (y) of vertices
+   x: Coordinate (x)
+   y: Coordinate (y)
+
+   Return:
+   True if coordinates lie within triangle
+*/
+bool isTrianglePoint(int64_t * xs, int64_t * ys, int64_t x, int64_t y)
+{
+	int64_t iter = 0;
+	int64_t next = 0;
+	long double cross = 0;
+
+	for (iter = 0; iter < 3; iter++) {
+		next = (iter + 1) % 3;
+		cross = (long double)(xs[next] - xs[iter]) * (y - ys[iter]) -
+		    (long double)(ys[next] - ys[iter]) * (x - xs[iter]);
+		if (cross < 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Counts records of circle or triangle query answered wrong, compared with
+   records of bounding range filtered by shape
+
+   Parameters:
+   grid: Grid holding records
+   x: Coordinate (x) of center of circle
+   y: Coordinate (y) of center of circle
+   radius: Radius of circle
+   xs: Coordinates (x) of triangle vertices, NULL for circle
+   ys: Coordinates (y) of triangle vertices, NULL for circle
+
+   Return:
+   Number of records found wrong, error on failure
+*/
+int64_t countShapeMismatches(struct gridfile *grid, int64_t x, int64_t y,
+			     int64_t radius, int64_t * xs, int64_t * ys)
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t nbad = 0;
+	int64_t nr = 0;
+	int64_t nexpected = 0;
+	int64_t ds = 0;
+	int64_t x1 = 0;
+	int64_t y1 = 0;
+	int64_t x2 = 0;
+	int64_t y2 = 0;
+	int64_t *entry = NULL;
+	char *be = NULL;
+	void *records = NULL;
+	bool inside = false;
+
+	if (xs == NULL) {
+		x1 = x - radius;
+		y1 = y - radius;
+		x2 = x + radius;
+		y2 = y + radius;
+	} else {
+		x1 = min(xs[0], min(xs[1], xs[2]));
+		y1 = min(ys[0], min(ys[1], ys[2]));
+		x2 = max(xs[0], max(xs[1], xs[2]));
+		y2 = max(ys[0], max(ys[1], ys[2]));
+	}
+
+	error = grid->findRangeRecords(x1, y1, x2, y2, &ds, &records);
+	if (error < 0) {
+		goto clean;
+	}
+
+	nr = *(int64_t *) records;
+	be = (char *)records + 8;
+	for (iter = 0; iter < nr; iter++) {
+		entry = (int64_t *) be;
+		if (xs == NULL) {
+			inside = getSquaredDistance(x, y, entry[0], entry[1]) <=
+			    (long double)radius *radius;
+		} else {
+			inside = isTrianglePoint(xs, ys, entry[0], entry[1]);
+		}
+		nexpected += inside;
+		be += 24 + entry[2];
+	}
+
+	free(records);
+
+	ds = 0;
+	if (xs == NULL) {
+		error = grid->findCircleRecords(x, y, radius, &ds, &records);
+	} else {
+		error = grid->findPolygonRecords(xs, ys, 3, &ds, &records);
+	}
+	if (error < 0) {
+		goto clean;
+	}
+
+	nr = *(int64_t *) records;
+	nbad = nr > nexpected ? nr - nexpected : nexpected - nr;
+	be = (char *)records + 8;
+	for (iter = 0; iter < nr; iter++) {
+		entry = (int64_t *) be;
+		if (xs == NULL) {
+			inside = getSquaredDistance(x, y, entry[0], entry[1]) <=
+			    (long double)radius *radius;
+		} else {
+			inside = isTrianglePoint(xs, ys, entry[0], entry[1]);
+		}
+		nbad += !inside;
+		be += 24 + entry[2];
+	}
+
+	free(records);
+
+ clean:
+	return error < 0 ? error : nbad;
+}
+
+/* Counts check records of memtable test not found as expected, odd ones
+   having been deleted
+
+   Parameters:
+   grid: Grid holding check records
+
+   Return:
+   Number of check records found wrong
+*/
+int64_t countMismatches(struct gridfile *grid)
+{
+	int64_t iter = 0;
+	int64_t nbad = 0;
+
+	for (iter = 0; iter < NCHECKS; iter++) {
+		if (findValue(grid, -1 - iter, -1 - iter) !=
+		    (iter % 2 ? -1 : iter)) {
+			nbad += 1;
+		}
+	}
+
+	return nbad;
+}
+
+/* Counts check records of memtable test retrieved wrong by range and count
+   queries, only even ones being left
+
+   Parameters:
+   grid: Grid holding check records
+
+   Return:
+   Number of check records retrieved wrong, error on failure
+*/
+int64_t countRangeMismatches(struct gridfile *grid)
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t nbad = 0;
+	int64_t nr = 0;
+	int64_t ds = 0;
+	int64_t *entry = NULL;
+	char *be = NULL;
+	void *records = NULL;
+
+	error = grid->findRangeRecords(-NCHECKS, -NCHECKS, -1, -1, &ds,
+				       &records);
+	if (error < 0) {
+		return error;
+	}
+
+	nr = *(int64_t *) records;
+	nbad = nr > NCHECKS / 2 ? nr - NCHECKS / 2 : NCHECKS / 2 - nr;
+	be = (char *)records + 8;
+	for (iter = 0; iter < nr; iter++) {
+		entry = (int64_t *) be;
+		if (entry[0] != entry[1] || entry[2] != 8 ||
+		    entry[3] != -1 - entry[0] || entry[3] % 2 != 0) {
+			nbad += 1;
+		}
+
+		be += 24 + entry[2];
+	}
+
+	free(records);
+
+	error = grid->countInRange(-NCHECKS, -NCHECKS, -1, -1, &nr);
+	if (error < 0) {
+		return error;
+	}
+
+	if (nr != NCHECKS / 2) {
+		nbad += 1;
+	}
+
+	return nbad;
+}
+
+/* Checks that delete of duplicate keys takes oldest record, both records
+   being stored in buckets, in memtable or split between them
+
+   Parameters:
+   grid: Grid to insert records into
+   x: Coordinate (x) of records
+   buffered: Number of records buffered in memtable, others being stored
+   before memtable is started
+
+   Return:
+   Zero if newer record is left, error otherwise
+*/
+int checkDuplicates(struct gridfile *grid, int64_t x, int64_t buffered)
+{
+	int error = 0;
+	int64_t value = 0;
+	int64_t ds = 0;
+	void *records = NULL;
+
+	for (value = 1; value <= 2 && error == 0; value++) {
+		if (value == 3 - buffered) {
+			error = grid->startMemtable(MEMTABLE);
+		}
+
+		if (error == 0) {
+			error = grid->insertRecord(x, x, &value, 8);
+		}
+	}
+
+	if (buffered == 0) {
+		error = error ? error : grid->startMemtable(MEMTABLE);
+	}
+
+	if (error == 0) {
+		error = grid->deleteRecord(x, x);
+	}
+
+	if (error == 0 && findValue(grid, x, x) != 2) {
+		error = -EINVAL;
+	}
+
+	if (error == 0) {
+		error = grid->findRangeRecords(x, x, x, x, &ds, &records);
+	}
+
+	if (error == 0 && (((int64_t *) records)[0] != 1 ||
+			   ((int64_t *) records)[4] != 2)) {
+		error = -EINVAL;
+	}
+
+	free(records);
+
+	if (grid->stopMemtable() < 0 && error == 0) {
+		error = -EIO;
+	}
+
+	if (error == 0 && findValue(grid, x, x) != 2) {
+		error = -EINVAL;
+	}
+
+	return error;
+}
+
+/* Checks that record updated past room left in its full bucket is stored
+   again with new data, other records of bucket being kept
+
+   Return:
+   Zero if records are read back as written, error otherwise
+*/
+int checkGrownUpdate()
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t size = 0;
+	char data[GROWNSIZE];
+	void *record = NULL;
+	struct gridconfig config;
+	struct gridfile grid;
+
+	config.size = 16;
+	config.psize = PSIZE;
+	config.name = NAME "update";
+
+	error = grid.createGrid(&config);
+	if (error < 0) {
+		goto clean;
+	}
+
+	error = grid.loadGrid();
+	if (error < 0) {
+		goto clean;
+	}
+
+	/* Records fill first bucket of grid up to last entry */
+	for (iter = 0; iter < NFILL && error == 0; iter++) {
+		memset(data, iter, FILLSIZE);
+		error = grid.insertRecord(iter, iter, data, FILLSIZE);
+	}
+
+	if (error == 0) {
+		memset(data, NFILL, GROWNSIZE);
+		error = grid.updateRecord(NFILL / 2, NFILL / 2, data, GROWNSIZE);
+	}
+
+	for (iter = 0; iter < NFILL && error == 0; iter++) {
+		size = iter == NFILL / 2 ? GROWNSIZE : FILLSIZE;
+		memset(data, iter == NFILL / 2 ? NFILL : iter, size);
+
+		error = grid.findRecord(iter, iter, &record);
+		if (error == 0 && memcmp(record, data, size) != 0) {
+			error = -EINVAL;
+		}
+
+		free(record);
+		record = NULL;
+	}
+
+	grid.unloadGrid();
+
+ clean:
+	return error;
+}
+
+/* Checks insert, find and range retrieval of grid typed on record and
+   coordinate type, negative coordinates included
+
+   Parameters:
+   name: Name of grid
+
+   Return:
+   Number of records retrieved wrong, error on failure
+*/
+template < typename Coord > int64_t checkRecordGrid(string name)
+{
+	int error = 0;
+	int64_t iter = 0;
+	int64_t nbad = 0;
+	int64_t nr = 0;
+	int64_t ds = 0;
+	int64_t *entry = NULL;
+	char *be = NULL;
+	void *records = NULL;
+	Coord x = 0;
+	struct typedrecord record;
+	struct gridconfig config;
+	recordgrid < struct typedrecord, Coord > grid;
+
+	config.size = 16;
+	config.psize = PSIZE;
+	config.name = name;
+
+	error = grid.createGrid(&config);
+	if (error < 0) {
+		return error;
+	}
+
+	error = grid.loadGrid();
+	if (error < 0) {
+		return error;
+	}
+
+	for (iter = 0; iter < NTYPED && error == 0; iter++) {
+		record.id = iter;
+		record.weight = iter / 2.0;
+		error = grid.insertRecord((Coord) (iter - NTYPED / 2),
+					  (Coord) (2 * iter), record);
+	}
+
+	for (iter = 0; iter < NTYPED && error == 0; iter++) {
+		error = grid.findRecord((Coord) (iter - NTYPED / 2),
+					(Coord) (2 * iter), &record);
+		if (error == 0 && (record.id != iter
+				   || record.weight != iter / 2.0)) {
+			nbad += 1;
+		}
+	}
+
+	if (error == 0) {
+		error = grid.findRangeRecords((Coord) (-NTYPED / 4), (Coord) 0,
+					      (Coord) (NTYPED / 4),
+					      (Coord) (2 * NTYPED), &ds,
+					      &records);
+	}
+
+	if (error == 0) {
+		nr = *(int64_t *) records;
+		if (nr != NTYPED / 2 + 1) {
+			nbad += 1;
+		}
+
+		be = (char *)records + 8;
+		for (iter = 0; iter < nr; iter++) {
+			entry = (int64_t *) be;
+			x = grid.getCoordinate(entry[0]);
+			memcpy(&record, entry + 3, sizeof(record));
+			if (x < (Coord) (-NTYPED / 4) || x > (Coord) (NTYPED / 4)
+			    || entry[2] != sizeof(record)
+			    || record.id != (int64_t) x + NTYPED / 2
+			    || grid.getCoordinate(entry[1]) !=
+			    (Coord) (2 * record.id)) {
+				nbad += 1;
+			}
+
+			be += 24 + entry[2];
+		}
+	}
+
+	free(records);
+	grid.unloadGrid();
+
+	return error < 0 ? error : nbad;
+}
+
+/* Checks that writer waits for view held by other thread, view keeping
+   its record meanwhile, and goes on once view is released. Writer stores
+   record again as it is
+
+   Parameters:
+   grid: Grid holding record
+   x: Coordinate (x) of record
+   y: Coordinate (y) of record
+
+   Return:
+   Zero if writer waited for view, error otherwise
+*/
+int checkHeldView(struct gridfile *grid, int64_t x, int64_t y)
+{
+	int error = 0;
+	int64_t size = 0;
+	char *data = NULL;
+	future < int >writer;
+	struct gridview view;
+
+	error = grid->lookupRecord(x, y, &view);
+	if (error < 0) {
+		goto clean;
+	}
+
+	size = view.getSize();
+	data = (char *)malloc(size);
+	if (data == NULL) {
+		error = -ENOMEM;
+		goto clean;
+	}
+
+	memcpy(data, view.getData(), size);
+
+	writer = async(launch::async, &gridfile::updateRecord, grid, x, y,
+		       (void *)data, size);
+
+	if (writer.wait_for(chrono::milliseconds(VIEWWAIT)) !=
+	    future_status::timeout || view.getSize() != size
+	    || memcmp(view.getData(), data, size) != 0) {
+		error = -EINVAL;
+	}
+
+	view.release();
+
+	if (writer.get() < 0 && error == 0) {
+		error = -EIO;
+	}
+
+ clean:
+	free(data);
+
+	return error;
+}
 
 int main()
 {
@@ -24,11 +741,25 @@ int main()
 	void *record = NULL;
 	struct gridconfig vconfig;
 	struct gridfile vgrid;
+	struct gridstats vstats;
 	int64_t ds = 0;
 	int64_t nr = 0;
+	int64_t k = 0;
 	time_t start;
 	time_t end;
 	double elapsed = 0;
+	int64_t rx = 0;
+	int64_t ry = 0;
+	int64_t tx[3];
+	int64_t ty[3];
+	vector < int64_t > xs(NQUERIES);
+	vector < int64_t > ys(NQUERIES);
+	vector < future < int > >pending(NQUERIES);
+	vector < void *>results(NQUERIES);
+	vector < int64_t > sizes(NQUERIES);
+	struct gridarena arena;
+	struct gridbuffer output;
+	struct gridview view;
 
 	vconfig.size = SIZE;
 	vconfig.psize = PSIZE;
@@ -49,6 +780,12 @@ int main()
 	for (iter = 0; iter < NRECORDS; iter++) {
 		getRandomRecord(&x, &y, &rsize, &record);
 
+		/* First records inserted are looked up through views */
+		if (iter < NQUERIES) {
+			xs[iter] = x;
+			ys[iter] = y;
+		}
+
 		error = vgrid.insertRecord(x, y, record, rsize);
 		if (error < 0) {
 			goto pclean;
@@ -62,6 +799,28 @@ int main()
 	elapsed = (double)(end - start);
 	printf("Elapsed time: %.2f.\n", elapsed);
 
+	error = vgrid.getGridStats(&vstats);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	printf("Grid splits: %ld, bucket splits: %ld, bucket growths: %ld\n",
+	       vstats.gridSplits, vstats.bucketSplits, vstats.bucketGrowths);
+	printf("Buckets: %ld, pages: %ld, fill factor: %.2f\n", vstats.buckets,
+	       vstats.pages, vstats.fill);
+
+	start = time(NULL);
+
+	error = vgrid.relocateBuckets(-1, &nr);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	end = time(NULL);
+
+	elapsed = (double)(end - start);
+	printf("Buckets relocated: %ld, elapsed time: %.2f.\n", nr, elapsed);
+
 	start = time(NULL);
 
 	error = vgrid.findRangeRecords(X1, Y1, X2, Y2, &ds, &record);
@@ -77,6 +836,372 @@ int main()
 
 	free(record);
 
+	start = time(NULL);
+
+	error = vgrid.countInRange(X1, Y1, X2, Y2, &nr);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	end = time(NULL);
+
+	elapsed = (double)(end - start);
+	printf("Elapsed time: %.2f.\n", elapsed);
+	printf("Records counted: %ld\n", nr);
+	if (nr != NRECORDS) {
+		error = -EINVAL;
+		goto pclean;
+	}
+
+	nr = countAggregateMismatches(&vgrid);
+	printf("Aggregate checks, %d ranges, mismatches: %ld\n", NSAMPLES,
+	       nr);
+	if (nr != 0) {
+		error = nr < 0 ? nr : -EINVAL;
+		goto pclean;
+	}
+
+	for (k = 1; k <= KMAX; k *= 10) {
+		start = time(NULL);
+
+		for (iter = 0; iter < NQUERIES; iter++) {
+			ds = 0;
+			error =
+			    vgrid.findNearestRecords(rand(), rand(), k, &ds,
+						     &record);
+			if (error < 0) {
+				goto pclean;
+			}
+
+			free(record);
+		}
+
+		end = time(NULL);
+
+		elapsed = (double)(end - start);
+		printf("Nearest %ld, %d queries, elapsed time: %.2f.\n", k,
+		       NQUERIES, elapsed);
+	}
+
+	nr = countNearestMismatches(&vgrid);
+	printf("Nearest checks, %d queries, mismatches: %ld\n", NSAMPLES, nr);
+	if (nr != 0) {
+		error = nr < 0 ? nr : -EINVAL;
+		goto pclean;
+	}
+
+	start = time(NULL);
+
+	for (iter = 0; iter < NQUERIES; iter++) {
+		error =
+		    vgrid.findCircleRecords(rand(), rand(), RADIUS, &ds,
+					    &record);
+		if (error < 0) {
+			goto pclean;
+		}
+
+		free(record);
+	}
+
+	end = time(NULL);
+
+	elapsed = (double)(end - start);
+	printf("Circle, %d queries, elapsed time: %.2f.\n", NQUERIES,
+	       elapsed);
+
+	/* Circles and counterclockwise triangles at random coordinates */
+	nr = 0;
+	for (iter = 0; iter < NSAMPLES && nr >= 0; iter++) {
+		rx = rand();
+		ry = rand();
+		tx[0] = rx;
+		ty[0] = ry;
+		tx[1] = rx + 2 * SHAPESIDE;
+		ty[1] = ry + rand() % SHAPESIDE;
+		tx[2] = rx + rand() % SHAPESIDE;
+		ty[2] = ry + 2 * SHAPESIDE;
+
+		ds = countShapeMismatches(&vgrid, rx, ry, SHAPESIDE, NULL,
+					  NULL);
+		if (ds >= 0) {
+			nr += ds;
+			ds = countShapeMismatches(&vgrid, 0, 0, 0, tx, ty);
+		}
+		nr = ds < 0 ? ds : nr + ds;
+	}
+
+	printf("Shape checks, %d circles and polygons, mismatches: %ld\n",
+	       NSAMPLES, nr);
+	if (nr != 0) {
+		error = nr < 0 ? nr : -EINVAL;
+		goto pclean;
+	}
+
+	start = time(NULL);
+
+	output.arena = &arena;
+	for (iter = 0; iter < NQUERIES; iter++) {
+		error =
+		    vgrid.findCircleRecordsInto(rand(), rand(), RADIUS,
+						&output);
+		if (error < 0) {
+			goto pclean;
+		}
+
+		arena.reset();
+	}
+
+	end = time(NULL);
+
+	elapsed = (double)(end - start);
+	printf("Circle into arena, %d queries, elapsed time: %.2f.\n",
+	       NQUERIES, elapsed);
+
+	start = time(NULL);
+
+	nr = 0;
+	for (iter = 0; iter < NQUERIES; iter++) {
+		error = vgrid.lookupRecord(xs[iter], ys[iter], &view);
+		if (error < 0) {
+			goto pclean;
+		}
+
+		nr += 1;
+	}
+
+	view.release();
+
+	end = time(NULL);
+
+	elapsed = (double)(end - start);
+	printf("Lookup view, %d queries, elapsed time: %.2f.\n", NQUERIES,
+	       elapsed);
+
+	/* Views match records found by copy */
+	k = 0;
+	output.arena = &arena;
+	for (iter = 0; iter < NQUERIES; iter++) {
+		error = vgrid.lookupRecord(xs[iter], ys[iter], &view);
+		if (error == 0) {
+			error = vgrid.findRecordInto(xs[iter], ys[iter], &output);
+		}
+		if (error < 0) {
+			goto pclean;
+		}
+
+		if (view.getSize() != output.size ||
+		    memcmp(view.getData(), output.data, output.size) != 0) {
+			k += 1;
+		}
+
+		view.release();
+		arena.reset();
+	}
+
+	printf("Records viewed: %ld, mismatches: %ld\n", nr, k);
+	if (nr != NQUERIES || k > 0) {
+		error = -EINVAL;
+		goto pclean;
+	}
+
+	error = checkHeldView(&vgrid, xs[0], ys[0]);
+	printf("Writer waiting for held view: %d\n", error);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	start = time(NULL);
+
+	for (iter = 0; iter < NQUERIES; iter++) {
+		rx = rand();
+		ry = rand();
+		pending[iter] =
+		    vgrid.findRangeRecordsAsync(rx, ry, rx + SIDE, ry + SIDE,
+						&sizes[iter], &results[iter]);
+	}
+
+	for (iter = 0; iter < NQUERIES; iter++) {
+		if (pending[iter].get() < 0) {
+			error = -EIO;
+		}
+
+		free(results[iter]);
+	}
+
+	if (error < 0) {
+		goto pclean;
+	}
+
+	end = time(NULL);
+
+	elapsed = (double)(end - start);
+	printf("Async range, %d queries, elapsed time: %.2f.\n", NQUERIES,
+	       elapsed);
+
+	start = time(NULL);
+
+	error = vgrid.startMemtable(MEMTABLE);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	for (iter = 0; iter < NQUERIES * 10; iter++) {
+		getRandomRecord(&x, &y, &rsize, &record);
+
+		error = vgrid.insertRecord(x, y, record, rsize);
+		if (error < 0) {
+			goto pclean;
+		}
+
+		free(record);
+	}
+
+	error = vgrid.stopMemtable();
+	if (error < 0) {
+		goto pclean;
+	}
+
+	end = time(NULL);
+
+	elapsed = (double)(end - start);
+	printf("Memtable, %d inserts, elapsed time: %.2f.\n", NQUERIES * 10,
+	       elapsed);
+
+	error = vgrid.startMemtable(MEMTABLE);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	for (iter = 0; iter < NCHECKS; iter++) {
+		k = iter;
+		error = vgrid.insertRecord(-1 - k, -1 - k, &k, 8);
+		if (error < 0) {
+			goto pclean;
+		}
+	}
+
+	for (iter = 1; iter < NCHECKS; iter += 2) {
+		error = vgrid.deleteRecord(-1 - iter, -1 - iter);
+		if (error < 0) {
+			goto pclean;
+		}
+	}
+
+	nr = countMismatches(&vgrid);
+
+	ds = countRangeMismatches(&vgrid);
+	if (ds < 0) {
+		error = ds;
+		goto pclean;
+	}
+
+	nr += ds;
+
+	error = vgrid.stopMemtable();
+	if (error < 0) {
+		goto pclean;
+	}
+
+	nr += countMismatches(&vgrid);
+	printf("Memtable checks, %d records, mismatches: %ld\n", NCHECKS, nr);
+	if (nr > 0) {
+		error = -EINVAL;
+		goto pclean;
+	}
+
+	for (iter = 0; iter <= 2; iter++) {
+		error = checkDuplicates(&vgrid, -1 - NCHECKS - iter, iter);
+		if (error < 0) {
+			printf("Duplicate delete, %d buffered: %d\n", iter, error);
+			goto pclean;
+		}
+	}
+
+	nr = checkRecordGrid < float > (NAME "float");
+	printf("Typed grid, float coordinates, mismatches: %ld\n", nr);
+	if (nr != 0) {
+		error = nr < 0 ? nr : -EINVAL;
+		goto pclean;
+	}
+
+	nr = checkRecordGrid < int32_t > (NAME "int");
+	printf("Typed grid, int32 coordinates, mismatches: %ld\n", nr);
+	if (nr != 0) {
+		error = nr < 0 ? nr : -EINVAL;
+		goto pclean;
+	}
+
+	error = checkGrownUpdate();
+	printf("Grown update in full bucket: %d\n", error);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	error = vgrid.countInRange(INT64_MIN, INT64_MIN, INT64_MAX, INT64_MAX,
+				   &nr);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	vgrid.unloadGrid();
+
+	start = time(NULL);
+
+	error = vgrid.openGrid(NAME);
+	if (error < 0) {
+		goto clean;
+	}
+
+	end = time(NULL);
+
+	elapsed = (double)(end - start);
+	printf("Reopen, elapsed time: %.2f.\n", elapsed);
+
+	/* Reopened grid holds records and statistics it was left with */
+	error = vgrid.countInRange(INT64_MIN, INT64_MIN, INT64_MAX, INT64_MAX,
+				   &k);
+	if (error == 0) {
+		error = vgrid.getGridStats(&vstats);
+	}
+	if (error < 0) {
+		goto pclean;
+	}
+
+	printf("Records before reopen: %ld, after reopen: %ld, in stats: %ld\n",
+	       nr, k, vstats.records);
+	if (k != nr || vstats.records != nr
+	    || findValue(&vgrid, -1, -1) != 0) {
+		error = -EINVAL;
+		goto pclean;
+	}
+
+	start = time(NULL);
+
+	getRandomRecord(&rx, &ry, &rsize, &record);
+	free(record);
+
+	for (iter = 0; iter < NHOT; iter++) {
+		getRandomRecord(&x, &y, &rsize, &record);
+
+		error = vgrid.insertRecord(rx, ry, record, rsize);
+		if (error < 0) {
+			goto pclean;
+		}
+
+		free(record);
+	}
+
+	end = time(NULL);
+
+	error = vgrid.getGridStats(&vstats);
+	if (error < 0) {
+		goto pclean;
+	}
+
+	elapsed = (double)(end - start);
+	printf("Hot cell, %d inserts, elapsed time: %.2f, bucket growths: %ld.\n",
+	       NHOT, elapsed, vstats.bucketGrowths);
+
  pclean:
 	vgrid.unloadGrid();
 